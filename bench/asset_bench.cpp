@@ -0,0 +1,334 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Times every phase of loading a scene on its own, and prints the results as JSON.
+// Meant for corpora from bench/asset_gen, but any directory with a scene.obj does.
+//
+//    bench/asset_bench <dir> [runs]
+//
+// The best of all runs is reported for each phase. Peak RSS is for the whole process
+// so far, so phases are run from the smallest to the largest.
+
+#include "object.hpp"
+#include "texture.hpp"
+#include "util.hpp"
+#include "headless_gl.hpp"
+#include "memory_json.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+using namespace std;
+
+retro_log_printf_t log_cb;
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static uint64_t file_size(const string& path)
+{
+   struct stat st;
+   return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+static long peak_rss_kb()
+{
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+   return usage.ru_maxrss;
+}
+
+struct Phase
+{
+   Phase() : files(0), bytes(0), seconds(0.0) {}
+   unsigned files;
+   uint64_t bytes;
+   double seconds;
+};
+
+static bool first_phase = true;
+static void print_phase(const char *name, const Phase& phase)
+{
+   if (!phase.files)
+      return;
+
+   printf("%s\n    {\"phase\": \"%s\", \"files\": %u, \"bytes\": %llu, \"ms\": %.3f, \"mb_per_s\": %.2f, \"peak_rss_kb\": %ld}",
+         first_phase ? "" : ",", name, phase.files, (unsigned long long)phase.bytes,
+         1000.0 * phase.seconds, phase.bytes / (1024.0 * 1024.0) / phase.seconds, peak_rss_kb());
+   first_phase = false;
+}
+
+// Texture names as referenced from the material library, so decoding covers what the scene uses.
+static vector<string> texture_names(const string& mtl_path)
+{
+   set<string> names;
+   ifstream file(mtl_path.c_str(), ios::in);
+   for (string line; getline(file, line); )
+   {
+      line = String::strip(line);
+      if (line.compare(0, 7, "map_Kd ") == 0 || line.compare(0, 7, "map_Ka ") == 0)
+         names.insert(line.substr(7));
+   }
+   return vector<string>(names.begin(), names.end());
+}
+
+static Phase time_images(const string& dir, const vector<string>& names, const string& ext, unsigned runs)
+{
+   Phase phase;
+   for (unsigned run = 0; run < runs; run++)
+   {
+      Phase current;
+      for (unsigned i = 0; i < names.size(); i++)
+      {
+         if (Path::ext(names[i]) != ext)
+            continue;
+
+         string path = Path::join(dir, names[i]);
+         uint8_t *data = NULL;
+         unsigned width = 0, height = 0;
+
+         double t = now();
+         bool ok = GL::load_image_rgba(path, data, width, height);
+         current.seconds += now() - t;
+         free(data);
+
+         if (!ok)
+         {
+            fprintf(stderr, "Failed to load %s.\n", path.c_str());
+            exit(1);
+         }
+
+         current.files++;
+         current.bytes += file_size(path);
+      }
+
+      if (run == 0 || current.seconds < phase.seconds)
+         phase = current;
+   }
+   return phase;
+}
+
+#ifndef GLES
+// Only the decode, uploading happens in the OBJ phase.
+static Phase time_dds(const string& dir, const vector<string>& names, unsigned runs)
+{
+   Phase phase;
+   for (unsigned run = 0; run < runs; run++)
+   {
+      Phase current;
+      for (unsigned i = 0; i < names.size(); i++)
+      {
+         if (Path::ext(names[i]) != "dds")
+            continue;
+
+         string path = Path::join(dir, names[i]);
+         double t = now();
+         size_t size = GL::read_dds(path);
+         current.seconds += now() - t;
+
+         if (!size)
+         {
+            fprintf(stderr, "Failed to load %s.\n", path.c_str());
+            exit(1);
+         }
+
+         current.files++;
+         current.bytes += file_size(path);
+      }
+
+      if (run == 0 || current.seconds < phase.seconds)
+         phase = current;
+   }
+   return phase;
+}
+#endif
+
+// Parsing alone. Every texture is already in the cache, so none are loaded.
+static Phase time_mtl(const string& path, const vector<string>& names, unsigned runs)
+{
+   Phase phase;
+   for (unsigned run = 0; run < runs; run++)
+   {
+      OBJ::TextureCache textures;
+      for (unsigned i = 0; i < names.size(); i++)
+         textures[names[i]] = std1::shared_ptr<GL::Texture>(new GL::Texture());
+
+      Phase current;
+      double t = now();
+      map<string, GL::Material> materials = OBJ::parse_mtllib(path, textures);
+      current.seconds = now() - t;
+      current.files = 1;
+      current.bytes = file_size(path);
+
+      if (materials.empty())
+      {
+         fprintf(stderr, "Failed to load %s.\n", path.c_str());
+         exit(1);
+      }
+
+      if (run == 0 || current.seconds < phase.seconds)
+         phase = current;
+   }
+   return phase;
+}
+
+// Everything the core does for a scene: OBJ, materials, textures, and uploading it all.
+static Phase time_obj(const string& path, unsigned runs, unsigned& meshes, unsigned& collision_triangles,
+      OBJ::LoadStats& stats)
+{
+   Phase phase;
+   for (unsigned run = 0; run < runs; run++)
+   {
+      vector<glm::vec3> collision;
+      Phase current;
+      double t = now();
+      vector<std1::shared_ptr<GL::Mesh> > loaded = OBJ::load_from_file(path, &collision,
+            OBJ::LoadOptions(), &stats);
+      SYM(glFinish)();
+      current.seconds = now() - t;
+      current.files = 1;
+      current.bytes = file_size(path);
+
+      if (loaded.empty())
+      {
+         fprintf(stderr, "Failed to load %s.\n", path.c_str());
+         exit(1);
+      }
+
+      meshes = loaded.size();
+      collision_triangles = collision.size() / 3;
+      if (run == 0 || current.seconds < phase.seconds)
+         phase = current;
+   }
+   return phase;
+}
+
+// A single 4x4 block of DXT1 or DXT5.
+static bool write_dds_block(const string& path, const char *fourcc)
+{
+   bool dxt1 = !strcmp(fourcc, "DXT1");
+   uint32_t header[32];
+   memset(header, 0, sizeof(header));
+   memcpy(header, "DDS ", 4);
+   header[1] = 124;                                // Header size.
+   header[2] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x80000; // Caps, height, width, pixel format, linear size.
+   header[3] = 4;
+   header[4] = 4;
+   header[5] = dxt1 ? 8 : 16;
+   header[19] = 32;                                // Pixel format size.
+   header[20] = 0x4;                               // FourCC, no alpha flag.
+   memcpy(&header[21], fourcc, 4);
+   header[27] = 0x1000;                            // Texture.
+
+   vector<uint8_t> data(reinterpret_cast<uint8_t*>(header), reinterpret_cast<uint8_t*>(header) + sizeof(header));
+   data.resize(data.size() + header[5], 0xff);
+   return File::write(path, data);
+}
+
+#ifndef GLES
+// Only the DDS format says whether there's alpha, and a mesh with alpha is drawn blended.
+// DXT1 without the alpha flag must come out opaque, DXT5 not.
+static bool check_dds_alpha(const string& dir)
+{
+   static const char *fourccs[] = { "DXT1", "DXT5" };
+   bool ok = true;
+   for (unsigned i = 0; i < 2; i++)
+   {
+      string path = Path::join(dir, string("alpha_check_") + fourccs[i] + ".dds");
+      if (!write_dds_block(path, fourccs[i]))
+      {
+         fprintf(stderr, "Failed to write %s.\n", path.c_str());
+         return false;
+      }
+
+      GL::Material material;
+      material.diffuse_map = std1::shared_ptr<GL::Texture>(new GL::Texture(path));
+      GL::Mesh mesh;
+      mesh.set_material(material);
+      remove(path.c_str());
+
+      bool expected = i != 0;
+      if (mesh.is_transparent() != expected)
+      {
+         fprintf(stderr, "A %s texture should make an %s mesh.\n", fourccs[i], expected ? "transparent" : "opaque");
+         ok = false;
+      }
+   }
+   return ok;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+   if (argc < 2)
+   {
+      fprintf(stderr, "Usage: %s <dir> [runs]\n", argv[0]);
+      return 1;
+   }
+
+   string dir = argv[1];
+   unsigned runs = argc > 2 ? strtoul(argv[2], NULL, 0) : 3;
+   if (!runs)
+      runs = 1;
+
+   string obj_path = Path::join(dir, "scene.obj");
+   string mtl_path = Path::join(dir, "scene.mtl");
+   vector<string> names = texture_names(mtl_path);
+
+   if (!create_headless_context())
+      return 1;
+   GL::set_function_cb(headless_get_proc_address);
+   GL::init_symbol_map();
+
+#ifndef GLES
+   if (!check_dds_alpha(dir))
+      return 1;
+#endif
+
+   printf("{\n  \"corpus\": \"%s\",\n  \"runs\": %u,\n  \"phases\": [", dir.c_str(), runs);
+   print_phase("png", time_images(dir, names, "png", runs));
+   print_phase("tga", time_images(dir, names, "tga", runs));
+#ifndef GLES
+   print_phase("dds", time_dds(dir, names, runs));
+#endif
+   print_phase("mtl", time_mtl(mtl_path, names, runs));
+
+   unsigned meshes = 0, collision_triangles = 0;
+   OBJ::LoadStats stats;
+   print_phase("obj", time_obj(obj_path, runs, meshes, collision_triangles, stats));
+   printf("\n  ],\n");
+
+   // Everything is released again by now, so only the peaks say anything.
+   print_memory_json(false);
+   printf("  \"vertex_cache\": {\"acmr_before\": %.3f, \"acmr_after\": %.3f, \"atvr_before\": %.3f, \"atvr_after\": %.3f},\n",
+         stats.original.acmr(), stats.optimized.acmr(), stats.original.atvr(), stats.optimized.atvr());
+   printf("  \"meshes\": %u,\n  \"collision_triangles\": %u\n}\n", meshes, collision_triangles);
+
+   return 0;
+}
+
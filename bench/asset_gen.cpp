@@ -0,0 +1,323 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Writes a synthetic scene for bench/asset_bench: scene.obj, scene.mtl and textures
+// as PNG, TGA and DDS.
+//
+//    bench/asset_gen <dir> [faces] [materials] [textures] [texture_size]
+//
+// The OBJ uses every face index form (v, v/vt, v//vn, v/vt/vn), and every other strip
+// of the grid uses negative indices. Output only depends on the arguments.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <zlib.h>
+
+using namespace std;
+
+static unsigned rand_state = 1;
+static unsigned urand()
+{
+   rand_state = rand_state * 1103515245u + 12345u;
+   return rand_state >> 8;
+}
+
+// Checkers and a gradient, with some noise so it doesn't compress to nothing.
+static void make_image(vector<uint8_t>& rgba, unsigned size, unsigned seed)
+{
+   rgba.resize(size * size * 4);
+   for (unsigned y = 0; y < size; y++)
+   {
+      for (unsigned x = 0; x < size; x++)
+      {
+         uint8_t *p = &rgba[(y * size + x) * 4];
+         bool check = ((x / 32) ^ (y / 32) ^ seed) & 1;
+         p[0] = (x * 255 / size) ^ (urand() & 7);
+         p[1] = (y * 255 / size) ^ (urand() & 7);
+         p[2] = check ? 200 : 60;
+         p[3] = 255;
+      }
+   }
+}
+
+static void put_be32(vector<uint8_t>& out, uint32_t v)
+{
+   out.push_back(v >> 24);
+   out.push_back(v >> 16);
+   out.push_back(v >> 8);
+   out.push_back(v);
+}
+
+static void png_chunk(vector<uint8_t>& out, const char *type, const vector<uint8_t>& data)
+{
+   put_be32(out, data.size());
+   size_t start = out.size();
+   out.insert(out.end(), type, type + 4);
+   out.insert(out.end(), data.begin(), data.end());
+   put_be32(out, crc32(0, &out[start], out.size() - start));
+}
+
+static bool write_file(const string& path, const vector<uint8_t>& data)
+{
+   FILE *file = fopen(path.c_str(), "wb");
+   if (!file)
+      return false;
+   bool ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+   return fclose(file) == 0 && ok;
+}
+
+static bool write_png(const string& path, const vector<uint8_t>& rgba, unsigned size)
+{
+   static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+   vector<uint8_t> out(signature, signature + 8);
+
+   vector<uint8_t> header;
+   put_be32(header, size);
+   put_be32(header, size);
+   header.push_back(8); // Bit depth.
+   header.push_back(6); // RGBA.
+   header.push_back(0);
+   header.push_back(0);
+   header.push_back(0);
+   png_chunk(out, "IHDR", header);
+
+   // No filtering, every scanline starts with filter type 0.
+   vector<uint8_t> raw;
+   raw.reserve(size * (size * 4 + 1));
+   for (unsigned y = 0; y < size; y++)
+   {
+      raw.push_back(0);
+      raw.insert(raw.end(), rgba.begin() + y * size * 4, rgba.begin() + (y + 1) * size * 4);
+   }
+
+   uLongf compressed_size = compressBound(raw.size());
+   vector<uint8_t> compressed(compressed_size);
+   if (compress2(&compressed[0], &compressed_size, &raw[0], raw.size(), 6) != Z_OK)
+      return false;
+   compressed.resize(compressed_size);
+   png_chunk(out, "IDAT", compressed);
+   png_chunk(out, "IEND", vector<uint8_t>());
+
+   return write_file(path, out);
+}
+
+// Uncompressed 32-bit, pixels stored BGRA.
+static bool write_tga(const string& path, const vector<uint8_t>& rgba, unsigned size)
+{
+   vector<uint8_t> out(18, 0);
+   out[2] = 2;
+   out[12] = size & 0xff;
+   out[13] = size >> 8;
+   out[14] = size & 0xff;
+   out[15] = size >> 8;
+   out[16] = 32;
+   out[17] = 8;
+
+   for (unsigned i = 0; i < size * size; i++)
+   {
+      out.push_back(rgba[i * 4 + 2]);
+      out.push_back(rgba[i * 4 + 1]);
+      out.push_back(rgba[i * 4 + 0]);
+      out.push_back(rgba[i * 4 + 3]);
+   }
+
+   return write_file(path, out);
+}
+
+// Uncompressed 32-bit with a single level, so the loader generates mipmaps.
+static bool write_dds(const string& path, const vector<uint8_t>& rgba, unsigned size)
+{
+   uint32_t header[32];
+   memset(header, 0, sizeof(header));
+   memcpy(header, "DDS ", 4);
+   header[1] = 124;                           // Header size.
+   header[2] = 0x1 | 0x2 | 0x4 | 0x8 | 0x1000; // Caps, height, width, pitch, pixel format.
+   header[3] = size;
+   header[4] = size;
+   header[5] = size * 4;
+   header[19] = 32;                           // Pixel format size.
+   header[20] = 0x40 | 0x1;                   // RGB with alpha.
+   header[22] = 32;
+   header[23] = 0x000000ff;
+   header[24] = 0x0000ff00;
+   header[25] = 0x00ff0000;
+   header[26] = 0xff000000;
+   header[27] = 0x1000;                       // Texture.
+
+   vector<uint8_t> out(reinterpret_cast<uint8_t*>(header), reinterpret_cast<uint8_t*>(header) + sizeof(header));
+   out.insert(out.end(), rgba.begin(), rgba.end());
+   return write_file(path, out);
+}
+
+static const char *texture_ext(unsigned index)
+{
+   static const char *exts[3] = { "png", "tga", "dds" };
+   return exts[index % 3];
+}
+
+static bool write_mtl(const string& path, unsigned materials, unsigned textures)
+{
+   FILE *file = fopen(path.c_str(), "w");
+   if (!file)
+      return false;
+
+   for (unsigned i = 0; i < materials; i++)
+   {
+      fprintf(file, "newmtl material%u\n", i);
+      fprintf(file, "Ka %.4f %.4f %.4f\n", (urand() % 256) / 1024.0f, (urand() % 256) / 1024.0f, (urand() % 256) / 1024.0f);
+      fprintf(file, "Kd %.4f %.4f %.4f\n", (urand() % 256) / 255.0f, (urand() % 256) / 255.0f, (urand() % 256) / 255.0f);
+      fprintf(file, "Ks 0.2 0.2 0.2\n");
+      fprintf(file, "Ns %u\n", 4 + urand() % 60);
+      fprintf(file, "d 1.0\n");
+      if (textures)
+         fprintf(file, "map_Kd texture%u.%s\n", i % textures, texture_ext(i % textures));
+      fprintf(file, "\n");
+   }
+
+   return fclose(file) == 0;
+}
+
+// Strips of a bumpy grid. Each strip has its own vertices, followed by its faces.
+static bool write_obj(const string& path, unsigned faces, unsigned materials)
+{
+   FILE *file = fopen(path.c_str(), "w");
+   if (!file)
+      return false;
+
+   const unsigned width = 256;
+   const unsigned faces_per_strip = 2 * width;
+   unsigned faces_per_material = (faces + materials - 1) / materials;
+
+   fprintf(file, "# Synthetic scene, %u faces, %u materials.\n", faces, materials);
+   fprintf(file, "mtllib scene.mtl\n");
+
+   unsigned written = 0, total_vertices = 0;
+   for (unsigned strip = 0; written < faces; strip++)
+   {
+      fprintf(file, "g strip%u\n", strip);
+      for (unsigned row = 0; row < 2; row++)
+      {
+         for (unsigned x = 0; x <= width; x++)
+         {
+            float z = strip + row;
+            fprintf(file, "v %.4f %.4f %.4f\n", float(x), 0.25f * std::sin(x * 0.3f) * std::cos(z * 0.2f), z);
+            fprintf(file, "vt %.4f %.4f\n", x / float(width), row ? 1.0f : 0.0f);
+            fprintf(file, "vn %.4f %.4f %.4f\n", 0.0f, 1.0f, 0.0f);
+         }
+      }
+      total_vertices += 2 * (width + 1);
+      unsigned first = total_vertices - 2 * (width + 1) + 1;
+      bool negative = strip & 1;
+
+      for (unsigned f = 0; f < faces_per_strip && written < faces; f++, written++)
+      {
+         if (written % faces_per_material == 0)
+            fprintf(file, "usemtl material%u\n", written / faces_per_material);
+
+         unsigned x = f / 2;
+         unsigned top = first + x, bottom = first + width + 1 + x;
+         int index[3];
+         if (f & 1)
+         {
+            index[0] = top + 1;
+            index[1] = bottom + 1;
+            index[2] = bottom;
+         }
+         else
+         {
+            index[0] = top;
+            index[1] = top + 1;
+            index[2] = bottom;
+         }
+
+         fprintf(file, "f");
+         for (unsigned i = 0; i < 3; i++)
+         {
+            int n = negative ? index[i] - int(total_vertices) - 1 : index[i];
+            switch (written % 4)
+            {
+               case 0: fprintf(file, " %d", n); break;
+               case 1: fprintf(file, " %d/%d", n, n); break;
+               case 2: fprintf(file, " %d//%d", n, n); break;
+               default: fprintf(file, " %d/%d/%d", n, n, n); break;
+            }
+         }
+         fprintf(file, "\n");
+      }
+   }
+
+   return fclose(file) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+   if (argc < 2)
+   {
+      fprintf(stderr, "Usage: %s <dir> [faces] [materials] [textures] [texture_size]\n", argv[0]);
+      return 1;
+   }
+
+   string dir = argv[1];
+   unsigned faces = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000;
+   unsigned materials = argc > 3 ? strtoul(argv[3], NULL, 0) : 256;
+   unsigned textures = argc > 4 ? strtoul(argv[4], NULL, 0) : 12;
+   unsigned texture_size = argc > 5 ? strtoul(argv[5], NULL, 0) : 512;
+   if (!faces || !materials || !texture_size || texture_size > 65535)
+   {
+      fprintf(stderr, "Usage: %s <dir> [faces] [materials] [textures] [texture_size]\n", argv[0]);
+      return 1;
+   }
+
+   vector<uint8_t> rgba;
+   for (unsigned i = 0; i < textures; i++)
+   {
+      char name[64];
+      snprintf(name, sizeof(name), "/texture%u.%s", i, texture_ext(i));
+      string path = dir + name;
+
+      make_image(rgba, texture_size, i);
+      bool ok = false;
+      switch (i % 3)
+      {
+         case 0: ok = write_png(path, rgba, texture_size); break;
+         case 1: ok = write_tga(path, rgba, texture_size); break;
+         default: ok = write_dds(path, rgba, texture_size); break;
+      }
+
+      if (!ok)
+      {
+         fprintf(stderr, "Failed to write %s.\n", path.c_str());
+         return 1;
+      }
+   }
+
+   if (!write_mtl(dir + "/scene.mtl", materials, textures) || !write_obj(dir + "/scene.obj", faces, materials))
+   {
+      fprintf(stderr, "Failed to write scene to %s.\n", dir.c_str());
+      return 1;
+   }
+
+   printf("Wrote %u faces, %u materials and %u textures of %ux%u to %s.\n",
+         faces, materials, textures, texture_size, texture_size, dir.c_str());
+   return 0;
+}
+
@@ -0,0 +1,364 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Times the collision kernels, world queries and a controller step over synthetic scenes
+// of several sizes. Prints one JSON object per line, for regression tracking.
+//
+//    bench/collision_bench [min_ms]
+//
+// Each measurement repeats until it has run for at least min_ms (default 200).
+
+#include "controller.hpp"
+#include "shared.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+using namespace glm;
+using namespace std;
+using namespace Collision;
+
+retro_log_printf_t log_cb;
+
+static double now()
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// Small deterministic LCG, so runs are comparable everywhere.
+static unsigned rand_state = 1;
+static float frand()
+{
+   rand_state = rand_state * 1103515245u + 12345u;
+   return ((rand_state >> 8) & 0xffff) / 65535.0f;
+}
+
+static vec3 rand_dir()
+{
+   vec3 v(frand() * 2.0f - 1.0f, frand() * 2.0f - 1.0f, frand() * 2.0f - 1.0f);
+   return length(v) > 0.001f ? normalize(v) : vec3(1, 0, 0);
+}
+
+// Quad facing towards the open side, split in two triangles.
+static void add_quad(World& world, const vec3& p0, const vec3& p1, const vec3& p2, const vec3& p3,
+      const vec3& facing)
+{
+   if (dot(cross(p1 - p0, p2 - p0), facing) >= 0.0f)
+   {
+      world.add_triangle(p0, p1, p2);
+      world.add_triangle(p0, p2, p3);
+   }
+   else
+   {
+      world.add_triangle(p0, p2, p1);
+      world.add_triangle(p0, p3, p2);
+   }
+}
+
+// A grid of rooms with tessellated floors, and walls with doorways between them.
+static void build_rooms(World& world, unsigned rooms)
+{
+   const float size = 8.0f;
+   for (unsigned rz = 0; rz < rooms; rz++)
+   {
+      for (unsigned rx = 0; rx < rooms; rx++)
+      {
+         float x0 = rx * size, z0 = rz * size;
+         for (float x = x0; x < x0 + size; x += 1.0f)
+            for (float z = z0; z < z0 + size; z += 1.0f)
+               add_quad(world, vec3(x, 0, z), vec3(x + 1, 0, z), vec3(x + 1, 0, z + 1), vec3(x, 0, z + 1), vec3(0, 1, 0));
+
+         // Wall along -z and -x, with a doorway in the middle of each.
+         add_quad(world, vec3(x0, 0, z0), vec3(x0 + 3, 0, z0), vec3(x0 + 3, 3, z0), vec3(x0, 3, z0), vec3(0, 0, 1));
+         add_quad(world, vec3(x0 + 5, 0, z0), vec3(x0 + size, 0, z0), vec3(x0 + size, 3, z0), vec3(x0 + 5, 3, z0), vec3(0, 0, 1));
+         add_quad(world, vec3(x0, 0, z0), vec3(x0, 0, z0 + 3), vec3(x0, 3, z0 + 3), vec3(x0, 3, z0), vec3(1, 0, 0));
+         add_quad(world, vec3(x0, 0, z0 + 5), vec3(x0, 0, z0 + size), vec3(x0, 3, z0 + size), vec3(x0, 3, z0 + 5), vec3(1, 0, 0));
+      }
+   }
+}
+
+// Flights of steps side by side, each going up along +x.
+static void build_stairs(World& world, unsigned flights)
+{
+   const unsigned steps = 64;
+   const float rise = 0.25f, run = 0.5f, width = 2.0f;
+   for (unsigned f = 0; f < flights; f++)
+   {
+      float z0 = f * width, z1 = z0 + width;
+      for (unsigned s = 0; s < steps; s++)
+      {
+         float x = s * run, y = s * rise;
+         add_quad(world, vec3(x, y, z0), vec3(x, y + rise, z0), vec3(x, y + rise, z1), vec3(x, y, z1), vec3(-1, 0, 0));
+         add_quad(world, vec3(x, y + rise, z0), vec3(x + run, y + rise, z0), vec3(x + run, y + rise, z1), vec3(x, y + rise, z1), vec3(0, 1, 0));
+      }
+   }
+}
+
+// Bumpy terrain, where no two triangles are coplanar.
+static float terrain_height(unsigned x, unsigned z)
+{
+   return 0.6f * std::sin(x * 0.37f) * std::cos(z * 0.29f) + 0.15f * ((x * 7919u + z * 104729u) % 13) / 13.0f;
+}
+
+static void build_terrain(World& world, unsigned cells)
+{
+   for (unsigned z = 0; z < cells; z++)
+      for (unsigned x = 0; x < cells; x++)
+         add_quad(world,
+               vec3(x, terrain_height(x, z), z), vec3(x + 1, terrain_height(x + 1, z), z),
+               vec3(x + 1, terrain_height(x + 1, z + 1), z + 1), vec3(x, terrain_height(x, z + 1), z + 1),
+               vec3(0, 1, 0));
+}
+
+struct Scene
+{
+   string name;
+   World world;
+   vec3 lo, hi; // Area walkers are dropped into, in world space.
+};
+
+static void make_scene(Scene& scene, const char *kind, unsigned size)
+{
+   char name[64];
+   snprintf(name, sizeof(name), "%s-%u", kind, size);
+   scene.name = name;
+   scene.world.set_ellipsoid(vec3(0.4f, 0.8f, 0.4f));
+
+   if (!strcmp(kind, "rooms"))
+   {
+      build_rooms(scene.world, size);
+      scene.lo = vec3(0.5f, 0.0f, 0.5f);
+      scene.hi = vec3(size * 8.0f - 0.5f, 0.0f, size * 8.0f - 0.5f);
+   }
+   else if (!strcmp(kind, "stairs"))
+   {
+      build_stairs(scene.world, size);
+      scene.lo = vec3(0.5f, 0.0f, 0.5f);
+      scene.hi = vec3(31.5f, 0.0f, size * 2.0f - 0.5f);
+   }
+   else
+   {
+      build_terrain(scene.world, size);
+      scene.lo = vec3(1.0f, 0.0f, 1.0f);
+      scene.hi = vec3(size - 1.0f, 0.0f, size - 1.0f);
+   }
+
+   scene.world.build();
+}
+
+// Somewhere on the ground, sunk in a little so pushing out has work to do.
+static vec3 rand_spot(const Scene& scene)
+{
+   vec3 pos = scene.lo + (scene.hi - scene.lo) * vec3(frand(), 0.0f, frand());
+   RayHit hit;
+   if (scene.world.raycast(Ray(pos + vec3(0, 50, 0), vec3(0, -1, 0), 100.0f), hit))
+      pos = hit.pos;
+   return pos + vec3(0, scene.world.get_ellipsoid().y * 0.99f, 0);
+}
+
+static unsigned min_ms = 200;
+static volatile float sink;
+
+typedef float (*Kernel)(const Scene& scene, unsigned i, unsigned& work);
+
+// Runs kernel over i = 0, 1, ... until min_ms has passed, and prints ns per call
+// and primitives per second. work is how many triangles or polygons a call looked at.
+static void measure(const char *kernel_name, const Scene& scene, Kernel kernel)
+{
+   unsigned ops = 0;
+   uint64_t work = 0;
+   float acc = 0.0f;
+   double start = now(), elapsed = 0.0;
+
+   do
+   {
+      for (unsigned i = 0; i < 1024; i++, ops++)
+      {
+         unsigned w = 0;
+         acc += kernel(scene, ops, w);
+         work += w;
+      }
+      elapsed = now() - start;
+   } while (elapsed * 1000.0 < min_ms);
+
+   sink = acc;
+   printf("{ \"kernel\": \"%s\", \"scene\": \"%s\", \"triangles\": %u, \"polygons\": %u, "
+         "\"ops\": %u, \"ns_per_op\": %.2f, \"prims_per_op\": %.2f, \"prims_per_s\": %.0f }\n",
+         kernel_name, scene.name.c_str(),
+         (unsigned)scene.world.size(), (unsigned)scene.world.polygon_count(),
+         ops, 1e9 * elapsed / ops, double(work) / ops, work / elapsed);
+   fflush(stdout);
+}
+
+// Inputs are made up front, so the timed loops only run the kernels.
+static const unsigned num_samples = 4096;
+static vector<vec3> sample_pos, sample_vel;
+static vector<unsigned> sample_tri;
+
+static void make_samples(const Scene& scene)
+{
+   sample_pos.resize(num_samples);
+   sample_vel.resize(num_samples);
+   sample_tri.resize(num_samples);
+   for (unsigned i = 0; i < num_samples; i++)
+   {
+      sample_tri[i] = unsigned(frand() * (scene.world.size() - 1));
+      sample_vel[i] = rand_dir() * vec3(0.05f + frand() * 0.3f);
+
+      // Near a random triangle, but not necessarily over it.
+      const Triangle& tri = scene.world.get_triangle(sample_tri[i]);
+      float u = frand() * 1.2f, v = frand() * 1.2f;
+      sample_pos[i] = tri.a + (tri.b - tri.a) * vec3(u) + (tri.c - tri.a) * vec3(v) -
+         tri.normal * vec3(0.5f + frand());
+   }
+}
+
+static float bench_inside_triangle(const Scene& scene, unsigned i, unsigned& work)
+{
+   unsigned s = i % num_samples;
+   work = 1;
+   return inside_triangle(scene.world.get_triangle(sample_tri[s]), sample_pos[s]);
+}
+
+static float bench_inside_polygon(const Scene& scene, unsigned i, unsigned& work)
+{
+   unsigned s = i % num_samples;
+   work = 1;
+   unsigned index = sample_tri[s] % scene.world.polygon_count();
+   return inside_polygon(scene.world.get_polygon(index), scene.world.get_polygon_verts(index), sample_pos[s]);
+}
+
+static float bench_point_crash_time(const Scene& scene, unsigned i, unsigned& work)
+{
+   unsigned s = i % num_samples;
+   work = 1;
+   return point_crash_time(sample_pos[s], sample_vel[s] * vec3(10.0f), scene.world.get_triangle(sample_tri[s]).a);
+}
+
+static float bench_line_crash_time(const Scene& scene, unsigned i, unsigned& work)
+{
+   unsigned s = i % num_samples;
+   const Triangle& tri = scene.world.get_triangle(sample_tri[s]);
+   vec3 crash_pos;
+   work = 1;
+   return line_crash_time(sample_pos[s], sample_vel[s] * vec3(10.0f), tri.a, tri.b, crash_pos);
+}
+
+// Walkers standing in the scene, in ellipsoid space.
+static vector<vec3> walk_pos;
+
+static void make_walkers(const Scene& scene)
+{
+   walk_pos.resize(num_samples);
+   for (unsigned i = 0; i < num_samples; i++)
+      walk_pos[i] = rand_spot(scene) / scene.world.get_ellipsoid();
+}
+
+// A full move: gather, sweep and slide, then push out of walls.
+static float bench_move(const Scene& scene, unsigned i, unsigned& work)
+{
+   unsigned s = i % num_samples;
+   vec3 pos = walk_pos[s];
+   vec3 fall(0, -0.02f, 0);
+   MoveResult res = scene.world.move(pos, vec3(sample_vel[s].x, 0, sample_vel[s].z), fall);
+   work = res.visited;
+   return pos.x;
+}
+
+// Standing still, which skips the sweep and leaves gathering and pushing out of walls.
+static float bench_move_still(const Scene& scene, unsigned i, unsigned& work)
+{
+   unsigned s = i % num_samples;
+   vec3 pos = walk_pos[s];
+   vec3 fall(0.0f);
+   MoveResult res = scene.world.move(pos, vec3(0.0f), fall);
+   work = res.visited;
+   return pos.y;
+}
+
+static float bench_raycast(const Scene& scene, unsigned i, unsigned& work)
+{
+   unsigned s = i % num_samples;
+   vec3 dir = normalize(vec3(sample_vel[s].x, -0.3f, sample_vel[s].z) + vec3(0.001f, 0, 0));
+   RayHit hit;
+   bool did_hit = scene.world.raycast(Ray(walk_pos[s] * scene.world.get_ellipsoid(), dir, 20.0f), hit);
+   work = hit.visited;
+   return did_hit ? hit.distance : 0.0f;
+}
+
+// Walkers wandering about with their own contact caches, stepped one after another.
+static vector<CharacterController> walkers;
+
+static float bench_controller_step(const Scene& scene, unsigned i, unsigned& work)
+{
+   CharacterController& walker = walkers[i % walkers.size()];
+   unsigned s = (i / walkers.size()) % num_samples;
+
+   ControllerInput input;
+   input.walk = vec3(sample_vel[s].x, 0, sample_vel[s].z) * vec3(20.0f);
+   input.jump = s % 61 == 0;
+   walker.step(scene.world, input, 1.0f / 60.0f);
+   work = walker.get_last_move().visited;
+   return walker.get_pos().y;
+}
+
+int main(int argc, char *argv[])
+{
+   if (argc > 1)
+      min_ms = strtoul(argv[1], NULL, 0);
+   if (!min_ms)
+   {
+      fprintf(stderr, "Usage: %s [min_ms]\n", argv[0]);
+      return 1;
+   }
+
+   static const struct { const char *kind; unsigned size; } scenes[] = {
+      { "rooms", 2 }, { "rooms", 8 }, { "rooms", 24 },
+      { "stairs", 4 }, { "stairs", 32 }, { "stairs", 256 },
+      { "terrain", 32 }, { "terrain", 128 }, { "terrain", 384 },
+   };
+
+   for (unsigned i = 0; i < sizeof(scenes) / sizeof(scenes[0]); i++)
+   {
+      Scene scene;
+      make_scene(scene, scenes[i].kind, scenes[i].size);
+      make_samples(scene);
+      make_walkers(scene);
+
+      measure("inside_triangle", scene, bench_inside_triangle);
+      measure("inside_polygon", scene, bench_inside_polygon);
+      measure("point_crash_time", scene, bench_point_crash_time);
+      measure("line_crash_time", scene, bench_line_crash_time);
+      measure("move", scene, bench_move);
+      measure("move_still", scene, bench_move_still);
+      measure("raycast", scene, bench_raycast);
+
+      walkers.clear();
+      for (unsigned w = 0; w < 256; w++)
+         walkers.push_back(CharacterController(rand_spot(scene)));
+      measure("controller_step", scene, bench_controller_step);
+   }
+
+   return 0;
+}
+
@@ -0,0 +1,303 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Steps many walkers through a synthetic level at various thread counts.
+//
+//    bench/controller_bench [agents] [frames] [max_threads]
+
+#include "controller.hpp"
+#include "thread_pool.hpp"
+#include "shared.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <sys/time.h>
+
+using namespace glm;
+using namespace std;
+using namespace Collision;
+
+retro_log_printf_t log_cb;
+
+static double now()
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// Small deterministic LCG, so runs are comparable everywhere.
+static unsigned rand_state = 1;
+static float frand()
+{
+   rand_state = rand_state * 1103515245u + 12345u;
+   return ((rand_state >> 8) & 0xffff) / 65535.0f;
+}
+
+// Quad facing towards the open side, split in two triangles.
+static void add_quad(World& world, const vec3& p0, const vec3& p1, const vec3& p2, const vec3& p3,
+      const vec3& facing)
+{
+   if (dot(cross(p1 - p0, p2 - p0), facing) >= 0.0f)
+   {
+      world.add_triangle(p0, p1, p2);
+      world.add_triangle(p0, p2, p3);
+   }
+   else
+   {
+      world.add_triangle(p0, p2, p1);
+      world.add_triangle(p0, p3, p2);
+   }
+}
+
+static void add_pillar(World& world, const vec3& lo, const vec3& hi)
+{
+   add_quad(world, vec3(lo.x, lo.y, lo.z), vec3(hi.x, lo.y, lo.z), vec3(hi.x, hi.y, lo.z), vec3(lo.x, hi.y, lo.z), vec3(0, 0, -1));
+   add_quad(world, vec3(lo.x, lo.y, hi.z), vec3(hi.x, lo.y, hi.z), vec3(hi.x, hi.y, hi.z), vec3(lo.x, hi.y, hi.z), vec3(0, 0, 1));
+   add_quad(world, vec3(lo.x, lo.y, lo.z), vec3(lo.x, lo.y, hi.z), vec3(lo.x, hi.y, hi.z), vec3(lo.x, hi.y, lo.z), vec3(-1, 0, 0));
+   add_quad(world, vec3(hi.x, lo.y, lo.z), vec3(hi.x, lo.y, hi.z), vec3(hi.x, hi.y, hi.z), vec3(hi.x, hi.y, lo.z), vec3(1, 0, 0));
+   add_quad(world, vec3(lo.x, hi.y, lo.z), vec3(hi.x, hi.y, lo.z), vec3(hi.x, hi.y, hi.z), vec3(lo.x, hi.y, hi.z), vec3(0, 1, 0));
+}
+
+// Tessellated floor with a fence around it and pillars scattered about.
+static void build_level(World& world, float extent, unsigned pillars)
+{
+   const float cell = 2.0f;
+   for (float x = -extent; x < extent; x += cell)
+      for (float z = -extent; z < extent; z += cell)
+         add_quad(world, vec3(x, 0, z), vec3(x + cell, 0, z), vec3(x + cell, 0, z + cell), vec3(x, 0, z + cell), vec3(0, 1, 0));
+
+   add_pillar(world, vec3(-extent - 1, 0, -extent - 1), vec3(-extent, 4, extent + 1));
+   add_pillar(world, vec3(extent, 0, -extent - 1), vec3(extent + 1, 4, extent + 1));
+   add_pillar(world, vec3(-extent, 0, -extent - 1), vec3(extent, 4, -extent));
+   add_pillar(world, vec3(-extent, 0, extent), vec3(extent, 4, extent + 1));
+
+   for (unsigned i = 0; i < pillars; i++)
+   {
+      vec3 center((frand() * 2.0f - 1.0f) * extent, 0, (frand() * 2.0f - 1.0f) * extent);
+      vec3 size(0.5f + frand() * 2.0f, 0.5f + frand() * 3.0f, 0.5f + frand() * 2.0f);
+      add_pillar(world, center - vec3(size.x, 0, size.z), center + size);
+   }
+}
+
+// Slabs which go up and down, like lifts.
+static vector<unsigned> add_platforms(World& world, float extent, unsigned count)
+{
+   vector<vec3> slab;
+   const vec3 corners[4] = { vec3(-2, 0, -2), vec3(2, 0, -2), vec3(2, 0, 2), vec3(-2, 0, 2) };
+   slab.push_back(corners[0]);
+   slab.push_back(corners[3]);
+   slab.push_back(corners[1]);
+   slab.push_back(corners[1]);
+   slab.push_back(corners[3]);
+   slab.push_back(corners[2]);
+
+   vector<unsigned> bodies;
+   for (unsigned i = 0; i < count; i++)
+   {
+      vec3 center((frand() * 2.0f - 1.0f) * extent, 0.1f, (frand() * 2.0f - 1.0f) * extent);
+      bodies.push_back(world.add_body(slab, 0, translate(mat4(1.0f), center)));
+   }
+   return bodies;
+}
+
+static void move_platforms(World& world, const vector<unsigned>& bodies, unsigned frame)
+{
+   for (unsigned i = 0; i < bodies.size(); i++)
+   {
+      const Body& body = world.get_body(bodies[i]);
+      vec3 center = vec3(body.transform[3]);
+      center.y = 0.1f + 1.5f * (1.0f - std::cos((frame + i * 17) * 0.02f));
+      world.set_body_transform(bodies[i], translate(mat4(1.0f), center));
+   }
+   world.refit();
+}
+
+// Every agent walks in a straight line, and picks a new heading now and then.
+// Headings only depend on agent index and frame, so every run replays the same paths.
+static void make_inputs(vector<ControllerInput>& inputs, unsigned frame)
+{
+   for (unsigned i = 0; i < inputs.size(); i++)
+   {
+      unsigned seed = (i * 2654435761u) ^ ((frame / 120) * 40503u);
+      float angle = (seed % 3600) * (float)M_PI / 1800.0f;
+      inputs[i].walk = vec3(std::cos(angle), 0, std::sin(angle)) * vec3(3.0f);
+      inputs[i].jump = (seed + frame) % 97 == 0;
+   }
+}
+
+static double run(World& world, const vector<unsigned>& platforms,
+      const vector<CharacterController>& start,
+      unsigned frames, unsigned threads, vector<CharacterController>& out, double& refit)
+{
+   Threading::ThreadPool pool(threads);
+   out = start;
+   vector<ControllerInput> inputs(start.size());
+
+   // Same starting point for the platforms on every run.
+   move_platforms(world, platforms, 0);
+
+   double total = 0.0;
+   refit = 0.0;
+   for (unsigned f = 0; f < frames; f++)
+   {
+      make_inputs(inputs, f);
+      double t = now();
+      move_platforms(world, platforms, f);
+      refit += now() - t;
+
+      t = now();
+      step_batch(world, &out[0], &inputs[0], out.size(), 1.0f / 60.0f, &pool);
+      total += now() - t;
+   }
+
+   return total;
+}
+
+int main(int argc, char *argv[])
+{
+   unsigned agents = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000;
+   unsigned frames = argc > 2 ? strtoul(argv[2], NULL, 0) : 300;
+   unsigned max_threads = argc > 3 ? strtoul(argv[3], NULL, 0) : Threading::cpu_count();
+   if (!agents || !frames || !max_threads)
+   {
+      fprintf(stderr, "Usage: %s [agents] [frames] [max_threads]\n", argv[0]);
+      return 1;
+   }
+
+   World world;
+   world.set_ellipsoid(vec3(0.4f, 0.8f, 0.4f));
+   build_level(world, 64.0f, 200);
+
+   // The hierarchy has to come out the same no matter how many threads build it.
+   vector<uint8_t> reference_tree;
+   for (unsigned threads = 1; threads <= max_threads;
+         threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2)
+   {
+      Threading::ThreadPool pool(threads);
+      double t = now();
+      world.build(&pool);
+      t = now() - t;
+
+      vector<uint8_t> tree;
+      world.serialize(tree);
+      if (threads == 1)
+         reference_tree = tree;
+      else if (tree != reference_tree)
+      {
+         fprintf(stderr, "Hierarchy differs with %u threads.\n", threads);
+         return 1;
+      }
+
+      printf("build: %u threads, %u nodes in %.3f ms\n", threads, (unsigned)world.node_count(), 1000.0 * t);
+   }
+
+   if (!world.unserialize(reference_tree))
+   {
+      fprintf(stderr, "Failed to load serialized hierarchy.\n");
+      return 1;
+   }
+
+   vector<unsigned> platforms = add_platforms(world, 60.0f, 64);
+
+   vector<CharacterController> start;
+   for (unsigned i = 0; i < agents; i++)
+      start.push_back(CharacterController(vec3((frand() * 2.0f - 1.0f) * 60.0f, 1.0f, (frand() * 2.0f - 1.0f) * 60.0f)));
+
+   printf("world: %u triangles (%u polygons), %u moving bodies, %u agents, %u frames\n",
+         (unsigned)world.size(), (unsigned)world.polygon_count(), (unsigned)world.body_count(),
+         agents, frames);
+   printf("%8s %10s %14s %8s %10s\n", "threads", "ms/frame", "agent-steps/s", "speedup", "efficiency");
+
+   vector<CharacterController> reference;
+   double base = 0.0, base_refit = 0.0;
+
+   for (unsigned threads = 1; threads <= max_threads;
+         threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2)
+   {
+      vector<CharacterController> result;
+      double refit;
+      double time = run(world, platforms, start, frames, threads, result, refit);
+
+      if (threads == 1)
+      {
+         base = time;
+         reference = result;
+      }
+      else
+      {
+         for (unsigned i = 0; i < agents; i++)
+         {
+            if (result[i].get_pos() != reference[i].get_pos())
+            {
+               fprintf(stderr, "Agent %u diverged with %u threads.\n", i, threads);
+               return 1;
+            }
+         }
+      }
+
+      printf("%8u %10.3f %14.0f %8.2f %9.0f%%\n", threads,
+            1000.0 * time / frames,
+            agents * frames / time,
+            base / time,
+            100.0 * base / (time * threads));
+
+      if (threads == 1)
+         base_refit = refit;
+   }
+
+   printf("refit: %.3f us/frame for %u bodies\n", 1000000.0 * base_refit / frames, (unsigned)platforms.size());
+
+   uint64_t hits = 0, misses = 0;
+   for (unsigned i = 0; i < reference.size(); i++)
+   {
+      hits += reference[i].get_cache().hits;
+      misses += reference[i].get_cache().misses;
+   }
+   printf("contact cache: %.1f%% hits\n", 100.0 * hits / (hits + misses));
+
+   // Line of sight between every walker and a handful of others.
+   const unsigned peers = 16;
+   vector<vec3> from, to;
+   for (unsigned i = 0; i < reference.size(); i++)
+   {
+      for (unsigned j = 1; j <= peers; j++)
+      {
+         from.push_back(reference[i].get_pos());
+         to.push_back(reference[(i + j * 37) % reference.size()].get_pos());
+      }
+   }
+
+   bool *visible = new bool[from.size()];
+   Threading::ThreadPool pool(max_threads);
+   double t = now();
+   world.line_of_sight_batch(&from[0], &to[0], visible, from.size(), &pool);
+   t = now() - t;
+
+   unsigned seen = 0;
+   for (unsigned i = 0; i < from.size(); i++)
+      seen += visible[i];
+   delete[] visible;
+
+   printf("line of sight: %u rays in %.3f ms (%.0f rays/s, %.1f%% visible)\n",
+         (unsigned)from.size(), 1000.0 * t, from.size() / t, 100.0 * seen / from.size());
+
+   return 0;
+}
+
@@ -0,0 +1,393 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs the whole core behind a minimal headless frontend, and prints timings as JSON.
+// Renders offscreen through EGL, so no display or GPU is needed. Mesa's llvmpipe does fine.
+//
+//    bench/frame_bench <scene.obj> [frames] [width]x[height] [replay]
+//
+// The camera follows a fixed script, or with replay, the input trace recorded next to the scene.
+// Runs with and without the depth pre-pass and prints both, unless modelviewer_depth_prepass is set.
+
+#include "libretro.h"
+#include "gl.hpp"
+#include "stats.hpp"
+#include "headless_gl.hpp"
+#include "scripted_input.hpp"
+#include "memory_json.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+static retro_time_t now_usec()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * (retro_time_t)1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned width = 1280;
+static unsigned height = 720;
+static string resolution;
+static bool replay;
+static unsigned frame;
+
+static retro_hw_render_callback hw_render;
+static retro_frame_time_callback frame_time;
+static GLuint fbo;
+
+static void log_printf(enum retro_log_level level, const char *fmt, ...)
+{
+   // Keep stdout clean for the JSON.
+   if (level < RETRO_LOG_WARN)
+      return;
+
+   va_list va;
+   va_start(va, fmt);
+   vfprintf(stderr, fmt, va);
+   va_end(va);
+}
+
+static uintptr_t get_current_framebuffer()
+{
+   return fbo;
+}
+
+static bool environment(unsigned cmd, void *data)
+{
+   switch (cmd)
+   {
+      case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+         static_cast<retro_log_callback*>(data)->log = log_printf;
+         return true;
+
+      case RETRO_ENVIRONMENT_GET_PERF_INTERFACE:
+      {
+         retro_perf_callback *perf = static_cast<retro_perf_callback*>(data);
+         memset(perf, 0, sizeof(*perf));
+         perf->get_time_usec = now_usec;
+         return true;
+      }
+
+      case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+      case RETRO_ENVIRONMENT_SET_VARIABLES:
+         return true;
+
+      case RETRO_ENVIRONMENT_SET_HW_RENDER:
+      {
+         retro_hw_render_callback *hw = static_cast<retro_hw_render_callback*>(data);
+         hw->get_current_framebuffer = get_current_framebuffer;
+         hw->get_proc_address = headless_get_proc_address;
+         hw_render = *hw;
+         return true;
+      }
+
+      case RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK:
+         frame_time = *static_cast<const retro_frame_time_callback*>(data);
+         return true;
+
+      case RETRO_ENVIRONMENT_GET_VARIABLE:
+      {
+         retro_variable *var = static_cast<retro_variable*>(data);
+         if (!strcmp(var->key, "modelviewer_resolution"))
+            var->value = resolution.c_str();
+         else if (!strcmp(var->key, "modelviewer_input_trace"))
+            var->value = replay ? "replay" : "off";
+         else
+            var->value = getenv(var->key); // Anything else can be tried from the environment.
+         return var->value != NULL;
+      }
+
+      case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
+         *static_cast<bool*>(data) = false;
+         return true;
+
+      default:
+         return false;
+   }
+}
+
+static void video_refresh(const void *, unsigned, unsigned, size_t)
+{}
+
+static void input_poll()
+{}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+   return scripted_input(frame, port, device, index, id);
+}
+
+static void audio_sample(int16_t, int16_t)
+{}
+
+static size_t audio_sample_batch(const int16_t *, size_t frames)
+{
+   return frames;
+}
+
+static bool init_framebuffer()
+{
+   if (!create_headless_context())
+      return false;
+
+   GLuint color, depth;
+   glGenFramebuffers(1, &fbo);
+   glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+   glGenRenderbuffers(1, &color);
+   glBindRenderbuffer(GL_RENDERBUFFER, color);
+   glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+   glGenRenderbuffers(1, &depth);
+   glBindRenderbuffer(GL_RENDERBUFFER, depth);
+   glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+   {
+      fprintf(stderr, "Offscreen framebuffer is incomplete.\n");
+      return false;
+   }
+
+   return true;
+}
+
+static string json_string(const char *str)
+{
+   string out = "\"";
+   for (; *str; str++)
+   {
+      if (*str == '"' || *str == '\\')
+         out += '\\';
+      out += *str;
+   }
+   return out + "\"";
+}
+
+static void print_times(const char *name, vector<retro_time_t> times, bool last)
+{
+   sort(times.begin(), times.end());
+
+   retro_time_t total = 0;
+   for (unsigned i = 0; i < times.size(); i++)
+      total += times[i];
+
+   size_t n = times.size();
+   printf("    \"%s\": { \"avg\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+         name, total / (1000.0 * n),
+         times[n / 2] / 1000.0, times[n * 9 / 10] / 1000.0, times[n * 99 / 100] / 1000.0,
+         times[n - 1] / 1000.0, last ? "" : ",");
+}
+
+// What the core has called so far, per GL function.
+static void count_gl_calls(map<string, uint64_t>& calls)
+{
+   calls.clear();
+   const GL::SymMap& symbols = GL::symbol_map();
+   for (GL::SymMap::const_iterator itr = symbols.begin(); itr != symbols.end(); ++itr)
+      calls[itr->first] = itr->second.calls;
+}
+
+// Loads and runs the scene once, and prints the results.
+static int run_scene(const char *scene, unsigned frames)
+{
+   if (!init_framebuffer())
+      return 1;
+
+   retro_set_environment(environment);
+   retro_set_video_refresh(video_refresh);
+   retro_set_input_poll(input_poll);
+   retro_set_input_state(input_state);
+   retro_set_audio_sample(audio_sample);
+   retro_set_audio_sample_batch(audio_sample_batch);
+   retro_init();
+
+   retro_game_info info;
+   memset(&info, 0, sizeof(info));
+   info.path = scene;
+
+   retro_time_t start = now_usec();
+   if (!retro_load_game(&info))
+   {
+      fprintf(stderr, "Failed to load %s.\n", scene);
+      return 1;
+   }
+   retro_time_t load_game = now_usec() - start;
+
+   start = now_usec();
+   hw_render.context_reset();
+   glFinish();
+   retro_time_t context_reset = now_usec() - start;
+
+   // The first frame pays for lazy driver work, like finishing shader compiles.
+   start = now_usec();
+   if (frame_time.callback)
+      frame_time.callback(frame_time.reference);
+   retro_run();
+   glFinish();
+   retro_time_t first_frame = now_usec() - start;
+   frame++;
+
+   map<string, uint64_t> calls_before, calls_after;
+   count_gl_calls(calls_before);
+
+   vector<retro_time_t> cpu_times, total_times;
+   cpu_times.reserve(frames);
+   total_times.reserve(frames);
+
+   for (unsigned i = 0; i < frames; i++, frame++)
+   {
+      // A steady clock, so the simulation takes the same path every run.
+      if (frame_time.callback)
+         frame_time.callback(frame_time.reference);
+
+      start = now_usec();
+      retro_run();
+      retro_time_t cpu_done = now_usec();
+      glFinish();
+      retro_time_t end = now_usec();
+
+      cpu_times.push_back(cpu_done - start);
+      total_times.push_back(end - start);
+   }
+
+   count_gl_calls(calls_after);
+   GLenum error = glGetError();
+
+   const Stats::LoadTimes& load = Stats::load_times();
+
+   printf("{\n");
+   printf("  \"scene\": %s,\n", json_string(scene).c_str());
+   printf("  \"renderer\": %s,\n", json_string(reinterpret_cast<const char*>(glGetString(GL_RENDERER))).c_str());
+   printf("  \"width\": %u,\n  \"height\": %u,\n  \"frames\": %u,\n", width, height, frames);
+   printf("  \"input\": \"%s\",\n", replay ? "replay" : "script");
+   printf("  \"depth_prepass\": %s,\n", json_string(getenv("modelviewer_depth_prepass")).c_str());
+   printf("  \"gl_error\": %u,\n", (unsigned)error);
+
+   printf("  \"load_ms\": {\n");
+   printf("    \"load_game\": %.3f,\n", load_game / 1000.0);
+   printf("    \"context_reset\": %.3f,\n", context_reset / 1000.0);
+   printf("    \"shaders\": %.3f,\n", load.shaders / 1000.0);
+   printf("    \"scene\": %.3f,\n", load.scene / 1000.0);
+   printf("    \"collision\": %.3f,\n", load.collision / 1000.0);
+   printf("    \"first_frame\": %.3f\n", first_frame / 1000.0);
+   printf("  },\n");
+
+   Stats::VertexCache cache = Stats::vertex_cache();
+   printf("  \"vertex_cache\": {\"acmr_before\": %.3f, \"acmr_after\": %.3f, \"atvr_before\": %.3f, \"atvr_after\": %.3f},\n",
+         cache.acmr_before, cache.acmr_after, cache.atvr_before, cache.atvr_after);
+
+   // cpu is retro_run() alone, total also waits for the GPU to finish the frame.
+   printf("  \"frame_ms\": {\n");
+   print_times("cpu", cpu_times, false);
+   print_times("total", total_times, true);
+   printf("  },\n");
+
+   uint64_t total_calls = 0;
+   for (map<string, uint64_t>::const_iterator itr = calls_after.begin(); itr != calls_after.end(); ++itr)
+      total_calls += itr->second - calls_before[itr->first];
+
+   print_memory_json(false);
+   printf("  \"gl_calls_per_frame\": %.2f,\n", double(total_calls) / frames);
+   printf("  \"gl_calls\": {");
+   bool first = true;
+   for (map<string, uint64_t>::const_iterator itr = calls_after.begin(); itr != calls_after.end(); ++itr)
+   {
+      uint64_t calls = itr->second - calls_before[itr->first];
+      if (!calls)
+         continue;
+      printf("%s\n    \"%s\": %llu", first ? "" : ",", itr->first.c_str(), (unsigned long long)calls);
+      first = false;
+   }
+   printf("\n  }\n");
+   printf("}\n");
+
+   retro_unload_game();
+   retro_deinit();
+   return error == GL_NO_ERROR ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+   if (argc < 2)
+   {
+      fprintf(stderr, "Usage: %s <scene.obj> [frames] [width]x[height] [replay]\n", argv[0]);
+      return 1;
+   }
+
+   const char *scene = argv[1];
+   unsigned frames = argc > 2 ? strtoul(argv[2], NULL, 0) : 600;
+   if (argc > 3 && sscanf(argv[3], "%ux%u", &width, &height) != 2)
+   {
+      fprintf(stderr, "Resolution must be given as [width]x[height].\n");
+      return 1;
+   }
+   replay = argc > 4 && !strcmp(argv[4], "replay");
+
+   if (!frames || !width || !height)
+   {
+      fprintf(stderr, "Usage: %s <scene.obj> [frames] [width]x[height] [replay]\n", argv[0]);
+      return 1;
+   }
+
+   char buf[32];
+   snprintf(buf, sizeof(buf), "%ux%u", width, height);
+   resolution = buf;
+
+   if (getenv("modelviewer_depth_prepass"))
+      return run_scene(scene, frames);
+
+   // Both ways, each in a fresh process, so neither starts with the other's GL or core state.
+   static const char *modes[] = { "off", "on" };
+   int status = 0;
+   printf("[\n");
+   for (unsigned i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+   {
+      if (i)
+         printf(",\n");
+      fflush(stdout);
+
+      pid_t pid = fork();
+      if (pid < 0)
+      {
+         perror("fork");
+         return 1;
+      }
+      else if (pid == 0)
+      {
+         setenv("modelviewer_depth_prepass", modes[i], 1);
+         exit(run_scene(scene, frames));
+      }
+
+      int child = 0;
+      if (waitpid(pid, &child, 0) < 0 || !WIFEXITED(child) || WEXITSTATUS(child))
+         status = 1;
+   }
+   printf("]\n");
+   return status;
+}
+
+
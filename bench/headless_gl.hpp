@@ -0,0 +1,78 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEADLESS_GL_HPP__
+#define HEADLESS_GL_HPP__
+
+// GL context for benchmarks, through EGL without any window or display.
+// Mesa's surfaceless platform, e.g. llvmpipe, is enough.
+
+#include "gl.hpp"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstdio>
+
+// Creates a context and makes it current. Rendering has to go to an FBO, there is no surface.
+static inline bool create_headless_context()
+{
+   EGLDisplay display = EGL_NO_DISPLAY;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+   PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+      reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+   if (get_platform_display)
+      display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+#endif
+   if (display == EGL_NO_DISPLAY)
+      display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+   if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+   {
+      fprintf(stderr, "Failed to initialize EGL.\n");
+      return false;
+   }
+
+#ifdef GLES
+   eglBindAPI(EGL_OPENGL_ES_API);
+   static const EGLint context_attribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+   static const EGLint config_attribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT, EGL_NONE };
+#else
+   eglBindAPI(EGL_OPENGL_API);
+   static const EGLint context_attribs[] = { EGL_NONE };
+   static const EGLint config_attribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+#endif
+
+   EGLConfig config = NULL;
+   EGLint configs = 0;
+   eglChooseConfig(display, config_attribs, &config, 1, &configs);
+
+   EGLContext context = eglCreateContext(display, configs ? config : NULL, EGL_NO_CONTEXT, context_attribs);
+   if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+   {
+      fprintf(stderr, "Failed to create a surfaceless GL context.\n");
+      return false;
+   }
+
+   return true;
+}
+
+static inline retro_proc_address_t headless_get_proc_address(const char *sym)
+{
+   return reinterpret_cast<retro_proc_address_t>(eglGetProcAddress(sym));
+}
+
+#endif
+
@@ -0,0 +1,40 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEMORY_JSON_HPP__
+#define MEMORY_JSON_HPP__
+
+#include "memory.hpp"
+#include <cstdio>
+
+// The core's memory counters as a "memory" member of a JSON object, in bytes.
+static inline void print_memory_json(bool last)
+{
+   printf("  \"memory\": {\n");
+   printf("    \"total\": {\"current\": %lu, \"peak\": %lu}",
+         (unsigned long)Memory::total().current, (unsigned long)Memory::total().peak);
+   for (unsigned i = 0; i < Memory::CATEGORY_COUNT; i++)
+   {
+      Memory::Category category = static_cast<Memory::Category>(i);
+      const Memory::Counter& counter = Memory::counter(category);
+      printf(",\n    \"%s\": {\"current\": %lu, \"peak\": %lu}", Memory::name(category),
+            (unsigned long)counter.current, (unsigned long)counter.peak);
+   }
+   printf("\n  }%s\n", last ? "" : ",");
+}
+
+#endif
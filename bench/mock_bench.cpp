@@ -0,0 +1,313 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs the whole core against the recording GL in mock_gl.cpp, and prints what it asked for as JSON.
+// Needs no GL at all, and the counts come out the same on every machine.
+//
+//    bench/mock_bench <scene.obj> [frames] [replay]
+//
+// draw_set_hash only depends on which draws were made with which bindings, not their order,
+// so it should stay put when draws are reordered, e.g. sorted by state.
+
+#include "libretro.h"
+#include "mock_gl.hpp"
+#include "scripted_input.hpp"
+#include "memory_json.hpp"
+#include "stats.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+
+using namespace std;
+
+static retro_time_t now_usec()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * (retro_time_t)1000000 + ts.tv_nsec / 1000;
+}
+
+static bool replay;
+static unsigned frame;
+
+static retro_hw_render_callback hw_render;
+static retro_frame_time_callback frame_time;
+
+static void log_printf(enum retro_log_level level, const char *fmt, ...)
+{
+   // Keep stdout clean for the JSON.
+   if (level < RETRO_LOG_WARN)
+      return;
+
+   va_list va;
+   va_start(va, fmt);
+   vfprintf(stderr, fmt, va);
+   va_end(va);
+}
+
+static uintptr_t get_current_framebuffer()
+{
+   return 0;
+}
+
+static bool environment(unsigned cmd, void *data)
+{
+   switch (cmd)
+   {
+      case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+         static_cast<retro_log_callback*>(data)->log = log_printf;
+         return true;
+
+      case RETRO_ENVIRONMENT_GET_PERF_INTERFACE:
+      {
+         retro_perf_callback *perf = static_cast<retro_perf_callback*>(data);
+         memset(perf, 0, sizeof(*perf));
+         perf->get_time_usec = now_usec;
+         return true;
+      }
+
+      case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+      case RETRO_ENVIRONMENT_SET_VARIABLES:
+         return true;
+
+      case RETRO_ENVIRONMENT_SET_HW_RENDER:
+      {
+         retro_hw_render_callback *hw = static_cast<retro_hw_render_callback*>(data);
+         hw->get_current_framebuffer = get_current_framebuffer;
+         hw->get_proc_address = MockGL::get_proc_address;
+         hw_render = *hw;
+         return true;
+      }
+
+      case RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK:
+         frame_time = *static_cast<const retro_frame_time_callback*>(data);
+         return true;
+
+      case RETRO_ENVIRONMENT_GET_VARIABLE:
+      {
+         retro_variable *var = static_cast<retro_variable*>(data);
+         if (!strcmp(var->key, "modelviewer_input_trace"))
+            var->value = replay ? "replay" : "off";
+         else
+            var->value = getenv(var->key); // Anything else can be tried from the environment.
+         return var->value != NULL;
+      }
+
+      case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
+         *static_cast<bool*>(data) = false;
+         return true;
+
+      default:
+         return false;
+   }
+}
+
+static void video_refresh(const void *, unsigned, unsigned, size_t)
+{}
+
+static void input_poll()
+{}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+   return scripted_input(frame, port, device, index, id);
+}
+
+static void audio_sample(int16_t, int16_t)
+{}
+
+static size_t audio_sample_batch(const int16_t *, size_t frames)
+{
+   return frames;
+}
+
+// FNV-1a.
+static void hash_bytes(uint64_t& hash, const void *data, size_t size)
+{
+   const uint8_t *bytes = static_cast<const uint8_t*>(data);
+   for (size_t i = 0; i < size; i++)
+   {
+      hash ^= bytes[i];
+      hash *= 1099511628211ull;
+   }
+}
+
+static void hash_draw(uint64_t& hash, const MockGL::Draw& draw)
+{
+   hash_bytes(hash, &draw.program, sizeof(draw.program));
+   hash_bytes(hash, &draw.buffer, sizeof(draw.buffer));
+   hash_bytes(hash, &draw.index_buffer, sizeof(draw.index_buffer));
+   hash_bytes(hash, draw.textures, sizeof(draw.textures));
+   hash_bytes(hash, &draw.mode, sizeof(draw.mode));
+   hash_bytes(hash, &draw.first, sizeof(draw.first));
+   hash_bytes(hash, &draw.count, sizeof(draw.count));
+}
+
+static bool draw_less(const MockGL::Draw& a, const MockGL::Draw& b)
+{
+   if (a.program != b.program)
+      return a.program < b.program;
+   if (a.buffer != b.buffer)
+      return a.buffer < b.buffer;
+   if (a.index_buffer != b.index_buffer)
+      return a.index_buffer < b.index_buffer;
+   if (a.textures[0] != b.textures[0])
+      return a.textures[0] < b.textures[0];
+   if (a.textures[1] != b.textures[1])
+      return a.textures[1] < b.textures[1];
+   if (a.mode != b.mode)
+      return a.mode < b.mode;
+   if (a.first != b.first)
+      return a.first < b.first;
+   return a.count < b.count;
+}
+
+static void print_counts(const char *name, const MockGL::Frame& counts, double scale, bool last)
+{
+   printf("  \"%s\": {\n", name);
+   printf("    \"calls\": %.2f,\n", counts.calls * scale);
+   printf("    \"draws\": %.2f,\n", counts.draws * scale);
+   printf("    \"vertices\": %.2f,\n", counts.vertices * scale);
+   printf("    \"binds\": %.2f,\n", counts.binds * scale);
+   printf("    \"redundant_binds\": %.2f,\n", counts.redundant_binds * scale);
+   printf("    \"state_changes\": %.2f,\n", counts.state_changes * scale);
+   printf("    \"redundant_states\": %.2f,\n", counts.redundant_states * scale);
+   printf("    \"uniform_uploads\": %.2f,\n", counts.uniform_uploads * scale);
+   printf("    \"redundant_uniforms\": %.2f,\n", counts.redundant_uniforms * scale);
+   printf("    \"uniform_bytes\": %.2f,\n", counts.uniform_bytes * scale);
+   printf("    \"bytes_uploaded\": %.2f,\n", counts.bytes_uploaded * scale);
+   printf("    \"unknown_calls\": %.2f\n", counts.unknown_calls * scale);
+   printf("  }%s\n", last ? "" : ",");
+}
+
+int main(int argc, char *argv[])
+{
+   if (argc < 2)
+   {
+      fprintf(stderr, "Usage: %s <scene.obj> [frames] [replay]\n", argv[0]);
+      return 1;
+   }
+
+   const char *scene = argv[1];
+   unsigned frames = argc > 2 ? strtoul(argv[2], NULL, 0) : 600;
+   replay = argc > 3 && !strcmp(argv[3], "replay");
+   if (!frames)
+   {
+      fprintf(stderr, "Usage: %s <scene.obj> [frames] [replay]\n", argv[0]);
+      return 1;
+   }
+
+   retro_set_environment(environment);
+   retro_set_video_refresh(video_refresh);
+   retro_set_input_poll(input_poll);
+   retro_set_input_state(input_state);
+   retro_set_audio_sample(audio_sample);
+   retro_set_audio_sample_batch(audio_sample_batch);
+   retro_init();
+
+   retro_game_info info;
+   memset(&info, 0, sizeof(info));
+   info.path = scene;
+
+   if (!retro_load_game(&info))
+   {
+      fprintf(stderr, "Failed to load %s.\n", scene);
+      return 1;
+   }
+
+   MockGL::begin_frame();
+   hw_render.context_reset();
+   MockGL::Frame load = MockGL::frame();
+
+   // Steady frame times, so the simulation takes the same path every run.
+   uint64_t order_hash = 14695981039346656037ull, set_hash = order_hash;
+   MockGL::Frame sum;
+   retro_time_t cpu = 0;
+
+   for (unsigned i = 0; i < frames; i++, frame++)
+   {
+      if (frame_time.callback)
+         frame_time.callback(frame_time.reference);
+
+      MockGL::begin_frame();
+      retro_time_t start = now_usec();
+      retro_run();
+      cpu += now_usec() - start;
+
+      const MockGL::Frame& counts = MockGL::frame();
+      vector<MockGL::Draw> draws = counts.draw_list;
+      for (unsigned j = 0; j < draws.size(); j++)
+         hash_draw(order_hash, draws[j]);
+      sort(draws.begin(), draws.end(), draw_less);
+      for (unsigned j = 0; j < draws.size(); j++)
+         hash_draw(set_hash, draws[j]);
+
+      sum.calls += counts.calls;
+      sum.draws += counts.draws;
+      sum.vertices += counts.vertices;
+      sum.binds += counts.binds;
+      sum.redundant_binds += counts.redundant_binds;
+      sum.state_changes += counts.state_changes;
+      sum.redundant_states += counts.redundant_states;
+      sum.uniform_uploads += counts.uniform_uploads;
+      sum.redundant_uniforms += counts.redundant_uniforms;
+      sum.uniform_bytes += counts.uniform_bytes;
+      sum.bytes_uploaded += counts.bytes_uploaded;
+      sum.unknown_calls += counts.unknown_calls;
+      for (map<string, uint64_t>::const_iterator itr = counts.calls_by_function.begin();
+            itr != counts.calls_by_function.end(); ++itr)
+         sum.calls_by_function[itr->first] += itr->second;
+   }
+
+   printf("{\n");
+   printf("  \"scene\": \"%s\",\n", scene);
+   printf("  \"frames\": %u,\n", frames);
+   printf("  \"input\": \"%s\",\n", replay ? "replay" : "script");
+   print_counts("load", load, 1.0, false);
+   print_counts("per_frame", sum, 1.0 / frames, false);
+   print_memory_json(false);
+
+   Stats::VertexCache cache = Stats::vertex_cache();
+   printf("  \"vertex_cache\": {\"acmr_before\": %.3f, \"acmr_after\": %.3f, \"atvr_before\": %.3f, \"atvr_after\": %.3f},\n",
+         cache.acmr_before, cache.acmr_after, cache.atvr_before, cache.atvr_after);
+   printf("  \"draw_order_hash\": \"%016llx\",\n", (unsigned long long)order_hash);
+   printf("  \"draw_set_hash\": \"%016llx\",\n", (unsigned long long)set_hash);
+   printf("  \"cpu_ms_per_frame\": %.4f,\n", cpu / (1000.0 * frames));
+
+   printf("  \"calls_per_frame\": {");
+   bool first = true;
+   for (map<string, uint64_t>::const_iterator itr = sum.calls_by_function.begin();
+         itr != sum.calls_by_function.end(); ++itr)
+   {
+      printf("%s\n    \"%s\": %.2f", first ? "" : ",", itr->first.c_str(), double(itr->second) / frames);
+      first = false;
+   }
+   printf("\n  }\n");
+   printf("}\n");
+
+   retro_unload_game();
+   retro_deinit();
+
+   // Anything the mock doesn't know would make the numbers wrong.
+   return MockGL::total().unknown_calls ? 1 : 0;
+}
+
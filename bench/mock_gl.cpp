@@ -0,0 +1,752 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mock_gl.hpp"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <set>
+#include <utility>
+
+using namespace std;
+
+namespace MockGL
+{
+   Frame::Frame() :
+      calls(0), draws(0), vertices(0),
+      binds(0), redundant_binds(0),
+      state_changes(0), redundant_states(0),
+      uniform_uploads(0), redundant_uniforms(0), uniform_bytes(0),
+      bytes_uploaded(0), unknown_calls(0)
+   {}
+
+   static const unsigned texture_units = 32;
+
+   struct State
+   {
+      State() :
+         next_name(1), program(0), array_buffer(0), element_buffer(0), framebuffer(0), active_unit(0),
+         blend_src(GL_ONE), blend_dst(GL_ZERO), front_face(GL_CCW), depth_func(GL_LESS), depth_mask(GL_TRUE)
+      {
+         memset(textures, 0, sizeof(textures));
+         memset(viewport, 0, sizeof(viewport));
+         memset(clear_color, 0, sizeof(clear_color));
+         memset(color_mask, GL_TRUE, sizeof(color_mask));
+      }
+
+      GLuint next_name;
+      GLuint program, array_buffer, element_buffer, framebuffer;
+      unsigned active_unit;
+      GLuint textures[texture_units];
+      GLenum blend_src, blend_dst, front_face;
+      GLenum depth_func;
+      GLboolean depth_mask;
+      GLboolean color_mask[4];
+      GLint viewport[4];
+      GLfloat clear_color[4];
+
+      map<GLenum, bool> caps;
+      map<GLuint, bool> attribs;
+      map<pair<GLuint, GLint>, vector<uint8_t> > uniforms;
+      map<GLuint, map<string, GLint> > uniform_locations, attrib_locations;
+      map<GLuint, vector<GLuint> > attached;
+   };
+
+   static State state;
+   static Frame current, totals;
+
+   // Counts in both the current frame and the totals.
+   static void add(uint64_t Frame::*field, uint64_t count = 1)
+   {
+      current.*field += count;
+      totals.*field += count;
+   }
+
+   static void record(const char *func)
+   {
+      add(&Frame::calls);
+      current.calls_by_function[func]++;
+      totals.calls_by_function[func]++;
+   }
+
+   static void bind(bool redundant)
+   {
+      add(&Frame::binds);
+      if (redundant)
+         add(&Frame::redundant_binds);
+   }
+
+   static void change_state(bool redundant)
+   {
+      add(&Frame::state_changes);
+      if (redundant)
+         add(&Frame::redundant_states);
+   }
+
+   static void upload_uniform(GLint location, const void *data, size_t size)
+   {
+      if (location < 0)
+         return;
+
+      add(&Frame::uniform_uploads);
+      add(&Frame::uniform_bytes, size);
+
+      const uint8_t *bytes = static_cast<const uint8_t*>(data);
+      vector<uint8_t>& value = state.uniforms[make_pair(state.program, location)];
+      if (value.size() == size && equal(value.begin(), value.end(), bytes))
+         add(&Frame::redundant_uniforms);
+      else
+         value.assign(bytes, bytes + size);
+   }
+
+   static GLint location(map<string, GLint>& locations, const GLchar *name)
+   {
+      map<string, GLint>::iterator itr = locations.find(name);
+      if (itr != locations.end())
+         return itr->second;
+
+      GLint loc = locations.size();
+      locations[name] = loc;
+      return loc;
+   }
+
+   static size_t pixel_size(GLenum format, GLenum type)
+   {
+      switch (type)
+      {
+         case GL_UNSIGNED_INT_8_8_8_8:
+         case GL_UNSIGNED_INT_8_8_8_8_REV:
+            return 4;
+         case GL_UNSIGNED_SHORT_5_6_5:
+         case GL_UNSIGNED_SHORT_4_4_4_4:
+         case GL_UNSIGNED_SHORT_5_5_5_1:
+            return 2;
+      }
+
+      size_t components = 1;
+      switch (format)
+      {
+         case GL_RGBA:
+         case GL_BGRA:
+            components = 4;
+            break;
+         case GL_RGB:
+         case GL_BGR:
+            components = 3;
+            break;
+         case GL_LUMINANCE_ALPHA:
+            components = 2;
+            break;
+      }
+
+      switch (type)
+      {
+         case GL_FLOAT:
+         case GL_INT:
+         case GL_UNSIGNED_INT:
+            return components * 4;
+         case GL_SHORT:
+         case GL_UNSIGNED_SHORT:
+         case GL_HALF_FLOAT:
+            return components * 2;
+         default:
+            return components;
+      }
+   }
+
+   static void gen_names(GLsizei n, GLuint *names)
+   {
+      for (GLsizei i = 0; i < n; i++)
+         names[i] = state.next_name++;
+   }
+
+   static void set_cap(GLenum cap, bool enable)
+   {
+      map<GLenum, bool>::iterator itr = state.caps.find(cap);
+      change_state(itr == state.caps.end() ? !enable : itr->second == enable);
+      state.caps[cap] = enable;
+   }
+
+   static void set_attrib(GLuint index, bool enable)
+   {
+      map<GLuint, bool>::iterator itr = state.attribs.find(index);
+      change_state(itr == state.attribs.end() ? !enable : itr->second == enable);
+      state.attribs[index] = enable;
+   }
+}
+
+using namespace MockGL;
+
+// GL 1.1, which the core and gli can reference directly, so these replace libGL's at link time.
+extern "C"
+{
+   void APIENTRY glEnable(GLenum cap)
+   {
+      record("glEnable");
+      set_cap(cap, true);
+   }
+
+   void APIENTRY glDisable(GLenum cap)
+   {
+      record("glDisable");
+      set_cap(cap, false);
+   }
+
+   void APIENTRY glBlendFunc(GLenum src, GLenum dst)
+   {
+      record("glBlendFunc");
+      change_state(src == state.blend_src && dst == state.blend_dst);
+      state.blend_src = src;
+      state.blend_dst = dst;
+   }
+
+   void APIENTRY glDepthFunc(GLenum func)
+   {
+      record("glDepthFunc");
+      change_state(func == state.depth_func);
+      state.depth_func = func;
+   }
+
+   void APIENTRY glColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a)
+   {
+      record("glColorMask");
+      GLboolean mask[4] = { r, g, b, a };
+      change_state(memcmp(mask, state.color_mask, sizeof(mask)) == 0);
+      memcpy(state.color_mask, mask, sizeof(mask));
+   }
+
+   void APIENTRY glDepthMask(GLboolean flag)
+   {
+      record("glDepthMask");
+      change_state(flag == state.depth_mask);
+      state.depth_mask = flag;
+   }
+
+   void APIENTRY glFrontFace(GLenum mode)
+   {
+      record("glFrontFace");
+      change_state(mode == state.front_face);
+      state.front_face = mode;
+   }
+
+   void APIENTRY glViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+   {
+      record("glViewport");
+      GLint viewport[4] = { x, y, width, height };
+      change_state(memcmp(viewport, state.viewport, sizeof(viewport)) == 0);
+      memcpy(state.viewport, viewport, sizeof(viewport));
+   }
+
+   void APIENTRY glClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
+   {
+      record("glClearColor");
+      GLfloat color[4] = { r, g, b, a };
+      change_state(memcmp(color, state.clear_color, sizeof(color)) == 0);
+      memcpy(state.clear_color, color, sizeof(color));
+   }
+
+   void APIENTRY glClear(GLbitfield)
+   {
+      record("glClear");
+   }
+
+   void APIENTRY glPixelStorei(GLenum, GLint)
+   {
+      record("glPixelStorei");
+   }
+
+   void APIENTRY glGenTextures(GLsizei n, GLuint *textures)
+   {
+      record("glGenTextures");
+      gen_names(n, textures);
+   }
+
+   void APIENTRY glDeleteTextures(GLsizei n, const GLuint *textures)
+   {
+      record("glDeleteTextures");
+      for (GLsizei i = 0; i < n; i++)
+         for (unsigned unit = 0; unit < texture_units; unit++)
+            if (textures[i] && state.textures[unit] == textures[i])
+               state.textures[unit] = 0;
+   }
+
+   void APIENTRY glBindTexture(GLenum, GLuint texture)
+   {
+      record("glBindTexture");
+      bind(state.textures[state.active_unit] == texture);
+      state.textures[state.active_unit] = texture;
+   }
+
+   void APIENTRY glTexParameteri(GLenum, GLenum, GLint)
+   {
+      record("glTexParameteri");
+   }
+
+   void APIENTRY glTexImage2D(GLenum, GLint, GLint, GLsizei width, GLsizei height,
+         GLint, GLenum format, GLenum type, const GLvoid *pixels)
+   {
+      record("glTexImage2D");
+      if (pixels)
+         add(&Frame::bytes_uploaded, width * height * pixel_size(format, type));
+   }
+
+   void APIENTRY glDrawArrays(GLenum mode, GLint first, GLsizei count)
+   {
+      record("glDrawArrays");
+      add(&Frame::draws);
+      add(&Frame::vertices, count);
+
+      Draw draw;
+      draw.program = state.program;
+      draw.buffer = state.array_buffer;
+      draw.index_buffer = 0;
+      draw.textures[0] = state.textures[0];
+      draw.textures[1] = state.textures[1];
+      draw.mode = mode;
+      draw.first = first;
+      draw.count = count;
+      current.draw_list.push_back(draw);
+   }
+
+   void APIENTRY glDrawElements(GLenum mode, GLsizei count, GLenum, const GLvoid *indices)
+   {
+      record("glDrawElements");
+      add(&Frame::draws);
+      add(&Frame::vertices, count);
+
+      Draw draw;
+      draw.program = state.program;
+      draw.buffer = state.array_buffer;
+      draw.index_buffer = state.element_buffer;
+      draw.textures[0] = state.textures[0];
+      draw.textures[1] = state.textures[1];
+      draw.mode = mode;
+      draw.first = reinterpret_cast<uintptr_t>(indices);
+      draw.count = count;
+      current.draw_list.push_back(draw);
+   }
+
+   GLenum APIENTRY glGetError(void)
+   {
+      record("glGetError");
+      return GL_NO_ERROR;
+   }
+
+   void APIENTRY glGetIntegerv(GLenum pname, GLint *params)
+   {
+      record("glGetIntegerv");
+      switch (pname)
+      {
+         case GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT:
+            *params = 16;
+            break;
+         case GL_UNPACK_ALIGNMENT:
+            *params = 4;
+            break;
+         case GL_TEXTURE_BINDING_2D:
+            *params = state.textures[state.active_unit];
+            break;
+         case GL_CURRENT_PROGRAM:
+            *params = state.program;
+            break;
+         default:
+            *params = 0;
+            break;
+      }
+   }
+
+   const GLubyte * APIENTRY glGetString(GLenum name)
+   {
+      record("glGetString");
+      switch (name)
+      {
+         case GL_VENDOR:
+         case GL_RENDERER:
+            return reinterpret_cast<const GLubyte*>("MockGL");
+         case GL_VERSION:
+            return reinterpret_cast<const GLubyte*>("2.1 MockGL");
+         default:
+            return reinterpret_cast<const GLubyte*>("");
+      }
+   }
+
+   void APIENTRY glFinish(void)
+   {
+      record("glFinish");
+   }
+}
+
+// Everything else is only reached through get_proc_address, so exact prototypes don't matter.
+namespace MockGL
+{
+   static void APIENTRY active_texture(GLenum unit)
+   {
+      record("glActiveTexture");
+      unsigned index = unit - GL_TEXTURE0;
+      change_state(index == state.active_unit);
+      state.active_unit = index < texture_units ? index : 0;
+   }
+
+   static void APIENTRY generate_mipmap(GLenum)
+   {
+      record("glGenerateMipmap");
+   }
+
+   static void APIENTRY gen_buffers(GLsizei n, GLuint *buffers)
+   {
+      record("glGenBuffers");
+      gen_names(n, buffers);
+   }
+
+   static void APIENTRY delete_buffers(GLsizei n, const GLuint *buffers)
+   {
+      record("glDeleteBuffers");
+      for (GLsizei i = 0; i < n; i++)
+      {
+         if (buffers[i] && state.array_buffer == buffers[i])
+            state.array_buffer = 0;
+         if (buffers[i] && state.element_buffer == buffers[i])
+            state.element_buffer = 0;
+      }
+   }
+
+   static void APIENTRY bind_buffer(GLenum target, GLuint buffer)
+   {
+      record("glBindBuffer");
+      GLuint& bound = target == GL_ELEMENT_ARRAY_BUFFER ? state.element_buffer : state.array_buffer;
+      bind(bound == buffer);
+      bound = buffer;
+   }
+
+   static void APIENTRY buffer_data(GLenum, GLsizeiptr size, const GLvoid *data, GLenum)
+   {
+      record("glBufferData");
+      if (data)
+         add(&Frame::bytes_uploaded, size);
+   }
+
+   static void APIENTRY buffer_sub_data(GLenum, GLintptr, GLsizeiptr size, const GLvoid *)
+   {
+      record("glBufferSubData");
+      add(&Frame::bytes_uploaded, size);
+   }
+
+   static void APIENTRY bind_framebuffer(GLenum, GLuint framebuffer)
+   {
+      record("glBindFramebuffer");
+      bind(state.framebuffer == framebuffer);
+      state.framebuffer = framebuffer;
+   }
+
+   static GLuint APIENTRY create_program()
+   {
+      record("glCreateProgram");
+      return state.next_name++;
+   }
+
+   static GLuint APIENTRY create_shader(GLenum)
+   {
+      record("glCreateShader");
+      return state.next_name++;
+   }
+
+   static void APIENTRY shader_source(GLuint, GLsizei, const GLchar **, const GLint *)
+   {
+      record("glShaderSource");
+   }
+
+   static void APIENTRY compile_shader(GLuint)
+   {
+      record("glCompileShader");
+   }
+
+   static void APIENTRY get_shader_iv(GLuint, GLenum pname, GLint *params)
+   {
+      record("glGetShaderiv");
+      *params = pname == GL_COMPILE_STATUS ? GL_TRUE : 0;
+   }
+
+   static void APIENTRY get_shader_info_log(GLuint, GLsizei max, GLsizei *length, GLchar *log)
+   {
+      record("glGetShaderInfoLog");
+      if (length)
+         *length = 0;
+      if (max > 0)
+         *log = '\0';
+   }
+
+   static void APIENTRY attach_shader(GLuint program, GLuint shader)
+   {
+      record("glAttachShader");
+      state.attached[program].push_back(shader);
+   }
+
+   static void APIENTRY detach_shader(GLuint program, GLuint shader)
+   {
+      record("glDetachShader");
+      vector<GLuint>& shaders = state.attached[program];
+      shaders.erase(remove(shaders.begin(), shaders.end(), shader), shaders.end());
+   }
+
+   static void APIENTRY get_attached_shaders(GLuint program, GLsizei max, GLsizei *count, GLuint *shaders)
+   {
+      record("glGetAttachedShaders");
+      const vector<GLuint>& attached = state.attached[program];
+      GLsizei n = 0;
+      for (; n < max && n < (GLsizei)attached.size(); n++)
+         shaders[n] = attached[n];
+      if (count)
+         *count = n;
+   }
+
+   static void APIENTRY delete_shader(GLuint)
+   {
+      record("glDeleteShader");
+   }
+
+   static void APIENTRY link_program(GLuint)
+   {
+      record("glLinkProgram");
+   }
+
+   static void APIENTRY get_program_iv(GLuint program, GLenum pname, GLint *params)
+   {
+      record("glGetProgramiv");
+      switch (pname)
+      {
+         case GL_LINK_STATUS:
+            *params = GL_TRUE;
+            break;
+         case GL_ATTACHED_SHADERS:
+            *params = state.attached[program].size();
+            break;
+         default:
+            *params = 0;
+            break;
+      }
+   }
+
+   static void APIENTRY get_program_info_log(GLuint, GLsizei max, GLsizei *length, GLchar *log)
+   {
+      record("glGetProgramInfoLog");
+      if (length)
+         *length = 0;
+      if (max > 0)
+         *log = '\0';
+   }
+
+   static void APIENTRY delete_program(GLuint program)
+   {
+      record("glDeleteProgram");
+      state.attached.erase(program);
+   }
+
+   static void APIENTRY use_program(GLuint program)
+   {
+      record("glUseProgram");
+      bind(state.program == program);
+      state.program = program;
+   }
+
+   static GLint APIENTRY get_uniform_location(GLuint program, const GLchar *name)
+   {
+      record("glGetUniformLocation");
+      return location(state.uniform_locations[program], name);
+   }
+
+   static GLint APIENTRY get_attrib_location(GLuint program, const GLchar *name)
+   {
+      record("glGetAttribLocation");
+      return location(state.attrib_locations[program], name);
+   }
+
+   static void APIENTRY uniform_1i(GLint loc, GLint v)
+   {
+      record("glUniform1i");
+      upload_uniform(loc, &v, sizeof(v));
+   }
+
+   static void APIENTRY uniform_1f(GLint loc, GLfloat v)
+   {
+      record("glUniform1f");
+      upload_uniform(loc, &v, sizeof(v));
+   }
+
+   static void APIENTRY uniform_2f(GLint loc, GLfloat x, GLfloat y)
+   {
+      record("glUniform2f");
+      const GLfloat v[2] = { x, y };
+      upload_uniform(loc, v, sizeof(v));
+   }
+
+   static void APIENTRY uniform_4f(GLint loc, GLfloat x, GLfloat y, GLfloat z, GLfloat w)
+   {
+      record("glUniform4f");
+      const GLfloat v[4] = { x, y, z, w };
+      upload_uniform(loc, v, sizeof(v));
+   }
+
+   static void APIENTRY uniform_2fv(GLint loc, GLsizei count, const GLfloat *v)
+   {
+      record("glUniform2fv");
+      upload_uniform(loc, v, 2 * count * sizeof(GLfloat));
+   }
+
+   static void APIENTRY uniform_3fv(GLint loc, GLsizei count, const GLfloat *v)
+   {
+      record("glUniform3fv");
+      upload_uniform(loc, v, 3 * count * sizeof(GLfloat));
+   }
+
+   static void APIENTRY uniform_4fv(GLint loc, GLsizei count, const GLfloat *v)
+   {
+      record("glUniform4fv");
+      upload_uniform(loc, v, 4 * count * sizeof(GLfloat));
+   }
+
+   static void APIENTRY uniform_matrix_4fv(GLint loc, GLsizei count, GLboolean, const GLfloat *v)
+   {
+      record("glUniformMatrix4fv");
+      upload_uniform(loc, v, 16 * count * sizeof(GLfloat));
+   }
+
+   static void APIENTRY enable_vertex_attrib_array(GLuint index)
+   {
+      record("glEnableVertexAttribArray");
+      set_attrib(index, true);
+   }
+
+   static void APIENTRY disable_vertex_attrib_array(GLuint index)
+   {
+      record("glDisableVertexAttribArray");
+      set_attrib(index, false);
+   }
+
+   static void APIENTRY vertex_attrib_pointer(GLuint, GLint, GLenum, GLboolean, GLsizei, const GLvoid *)
+   {
+      record("glVertexAttribPointer");
+   }
+
+   static void APIENTRY unknown_function()
+   {
+      record("unknown");
+      add(&Frame::unknown_calls);
+   }
+
+   struct Function
+   {
+      const char *name;
+      retro_proc_address_t proc;
+   };
+
+#define _D(sym, func) { #sym, reinterpret_cast<retro_proc_address_t>(func) }
+   static const Function functions[] = {
+      _D(glEnable, glEnable),
+      _D(glDisable, glDisable),
+      _D(glBlendFunc, glBlendFunc),
+      _D(glDepthFunc, glDepthFunc),
+      _D(glDepthMask, glDepthMask),
+      _D(glColorMask, glColorMask),
+      _D(glFrontFace, glFrontFace),
+      _D(glViewport, glViewport),
+      _D(glClearColor, glClearColor),
+      _D(glClear, glClear),
+      _D(glPixelStorei, glPixelStorei),
+      _D(glGenTextures, glGenTextures),
+      _D(glDeleteTextures, glDeleteTextures),
+      _D(glBindTexture, glBindTexture),
+      _D(glTexParameteri, glTexParameteri),
+      _D(glTexImage2D, glTexImage2D),
+      _D(glDrawArrays, glDrawArrays),
+      _D(glDrawElements, glDrawElements),
+      _D(glGetError, glGetError),
+      _D(glGetIntegerv, glGetIntegerv),
+      _D(glGetString, glGetString),
+      _D(glFinish, glFinish),
+      _D(glActiveTexture, active_texture),
+      _D(glGenerateMipmap, generate_mipmap),
+      _D(glGenBuffers, gen_buffers),
+      _D(glDeleteBuffers, delete_buffers),
+      _D(glBindBuffer, bind_buffer),
+      _D(glBufferData, buffer_data),
+      _D(glBufferSubData, buffer_sub_data),
+      _D(glBindFramebuffer, bind_framebuffer),
+      _D(glCreateProgram, create_program),
+      _D(glCreateShader, create_shader),
+      _D(glShaderSource, shader_source),
+      _D(glCompileShader, compile_shader),
+      _D(glGetShaderiv, get_shader_iv),
+      _D(glGetShaderInfoLog, get_shader_info_log),
+      _D(glAttachShader, attach_shader),
+      _D(glDetachShader, detach_shader),
+      _D(glGetAttachedShaders, get_attached_shaders),
+      _D(glDeleteShader, delete_shader),
+      _D(glLinkProgram, link_program),
+      _D(glGetProgramiv, get_program_iv),
+      _D(glGetProgramInfoLog, get_program_info_log),
+      _D(glDeleteProgram, delete_program),
+      _D(glUseProgram, use_program),
+      _D(glGetUniformLocation, get_uniform_location),
+      _D(glGetAttribLocation, get_attrib_location),
+      _D(glUniform1i, uniform_1i),
+      _D(glUniform1f, uniform_1f),
+      _D(glUniform2f, uniform_2f),
+      _D(glUniform2fv, uniform_2fv),
+      _D(glUniform3fv, uniform_3fv),
+      _D(glUniform4f, uniform_4f),
+      _D(glUniform4fv, uniform_4fv),
+      _D(glUniformMatrix4fv, uniform_matrix_4fv),
+      _D(glEnableVertexAttribArray, enable_vertex_attrib_array),
+      _D(glDisableVertexAttribArray, disable_vertex_attrib_array),
+      _D(glVertexAttribPointer, vertex_attrib_pointer),
+   };
+#undef _D
+
+   retro_proc_address_t get_proc_address(const char *sym)
+   {
+      for (unsigned i = 0; i < sizeof(functions) / sizeof(functions[0]); i++)
+         if (!strcmp(functions[i].name, sym))
+            return functions[i].proc;
+
+      // Calls are dropped, but counted, so a missing function doesn't go unnoticed.
+      static set<string> reported;
+      if (reported.insert(sym).second)
+         fprintf(stderr, "MockGL: %s is not implemented, calls to it do nothing.\n", sym);
+      return reinterpret_cast<retro_proc_address_t>(unknown_function);
+   }
+
+   void begin_frame()
+   {
+      current = Frame();
+   }
+
+   const Frame& frame()
+   {
+      return current;
+   }
+
+   const Frame& total()
+   {
+      return totals;
+   }
+
+   void reset()
+   {
+      state = State();
+   }
+}
+
@@ -0,0 +1,79 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MOCK_GL_HPP__
+#define MOCK_GL_HPP__
+
+// A GL which only records what it is asked to do.
+//
+// mock_gl.cpp defines the GL functions the core uses, so linking it instead of libGL
+// catches calls made directly as well as through SYM(). Nothing is drawn, but objects,
+// bindings and uniforms are tracked, so redundant work shows up.
+// Desktop GL builds only, GLES builds call GL directly and don't have the symbol map.
+
+#include "gl.hpp"
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace MockGL
+{
+   // What was bound when a draw call was made.
+   struct Draw
+   {
+      GLuint program;
+      GLuint buffer;
+      GLuint index_buffer; // 0 for glDrawArrays.
+      GLuint textures[2];
+      GLenum mode;
+      GLint first;         // Byte offset into the index buffer for glDrawElements.
+      GLsizei count;
+   };
+
+   struct Frame
+   {
+      Frame();
+
+      uint64_t calls;
+      uint64_t draws, vertices;
+      uint64_t binds, redundant_binds;            // Buffers, textures, programs and framebuffers.
+      uint64_t state_changes, redundant_states;   // Enables, blending, attribute arrays, viewport, ...
+      uint64_t uniform_uploads, redundant_uniforms, uniform_bytes;
+      uint64_t bytes_uploaded;                    // Buffer and texture data.
+      uint64_t unknown_calls;                     // To functions the mock doesn't implement.
+
+      std::map<std::string, uint64_t> calls_by_function;
+      std::vector<Draw> draw_list;
+   };
+
+   // Hand this to the core as retro_hw_render_callback::get_proc_address.
+   retro_proc_address_t get_proc_address(const char *sym);
+
+   // Starts recording a new frame. Totals keep counting.
+   void begin_frame();
+
+   // Everything since begin_frame(), and since the start.
+   const Frame& frame();
+   const Frame& total();
+
+   // Drops all objects and state, like a fresh context.
+   void reset();
+}
+
+#endif
+
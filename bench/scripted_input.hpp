@@ -0,0 +1,42 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCRIPTED_INPUT_HPP__
+#define SCRIPTED_INPUT_HPP__
+
+#include "libretro.h"
+
+// Input for benchmark runs without a recorded trace.
+// Walks forward for two seconds, turns for one, jumps now and then, and nods up and down.
+static inline int16_t scripted_input(unsigned frame, unsigned port, unsigned device, unsigned index, unsigned id)
+{
+   if (port != 0)
+      return 0;
+
+   unsigned phase = frame % 180;
+   if (device == RETRO_DEVICE_ANALOG && index == RETRO_DEVICE_INDEX_ANALOG_LEFT && id == RETRO_DEVICE_ID_ANALOG_Y)
+      return phase < 120 ? -24000 : 0;
+   if (device == RETRO_DEVICE_ANALOG && index == RETRO_DEVICE_INDEX_ANALOG_RIGHT && id == RETRO_DEVICE_ID_ANALOG_X)
+      return phase >= 120 ? 20000 : 0;
+   if (device == RETRO_DEVICE_ANALOG && index == RETRO_DEVICE_INDEX_ANALOG_RIGHT && id == RETRO_DEVICE_ID_ANALOG_Y)
+      return (frame / 240) % 2 ? 12000 : -12000;
+   if (device == RETRO_DEVICE_JOYPAD && id == RETRO_DEVICE_ID_JOYPAD_B)
+      return frame % 150 == 60;
+   return 0;
+}
+
+#endif
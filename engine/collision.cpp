@@ -0,0 +1,1159 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "collision.hpp"
+#include "shared.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include <algorithm>
+#include <cmath>
+#include <assert.h>
+
+using namespace glm;
+using namespace std;
+
+namespace Collision
+{
+   // Probably not the most efficient way to do collision handling ... :)
+   bool inside_triangle(const Triangle& tri, const vec3& pos)
+   {
+      vec3 real_normal = -tri.normal;
+
+      vec3 ab = tri.b - tri.a;
+      vec3 ac = tri.c - tri.a;
+      vec3 ap = pos - tri.a;
+      vec3 bp = pos - tri.b;
+      vec3 bc = tri.c - tri.b;
+
+      // Checks if point exists inside triangle.
+      if (dot(cross(ab, ap), real_normal) < 0.0f)
+         return false;
+
+      if (dot(cross(ap, ac), real_normal) < 0.0f)
+         return false;
+
+      if (dot(cross(bc, bp), real_normal) < 0.0f)
+         return false;
+
+      return true;
+   }
+
+   // Same as above, for every edge of a convex polygon.
+   bool inside_polygon(const Polygon& poly, const PolygonVerts& verts, const vec3& pos)
+   {
+      vec3 real_normal = -poly.normal;
+
+      vec3 first = verts[0];
+      vec3 a = first;
+      for (unsigned i = 0; i < poly.count; i++)
+      {
+         vec3 b = i + 1 < poly.count ? verts[i + 1] : first;
+         if (dot(cross(b - a, pos - a), real_normal) < 0.0f)
+            return false;
+         a = b;
+      }
+
+      return true;
+   }
+
+   static const float twiddle_factor = -0.5f;
+
+   // Here be dragons. 2-3 pages of mathematical derivations.
+   float point_crash_time(const vec3& pos, const vec3& v, const vec3& edge)
+   {
+      vec3 l = pos - edge;
+
+      float A = dot(v, v);
+      float B = 2 * dot(l, v);
+      float C = dot(l, l) - 1;
+
+      float d = B * B - 4.0f * A * C;
+      if (d < 0.0f) // No solution, can't hit the sphere ever.
+         return 10.0f; // Return number > 1.0f to signal no collision. Makes taking min() easier.
+
+      float d_sqrt = std::sqrt(d);
+      float sol0 = (-B + d_sqrt) / (2.0f * A);
+      float sol1 = (-B - d_sqrt) / (2.0f * A);
+      if (sol0 >= twiddle_factor && sol1 >= twiddle_factor)
+         return std::min(sol0, sol1);
+      else if (sol0 >= twiddle_factor && sol1 < twiddle_factor)
+         return sol0;
+      else if (sol0 < twiddle_factor && sol1 >= twiddle_factor)
+         return sol1;
+
+      return 10.0f;
+   }
+
+   float line_crash_time(const vec3& pos, const vec3& v, const vec3& a, const vec3& b, vec3& crash_pos)
+   {
+      crash_pos = vec3(0.0f);
+
+      vec3 ab = b - a;
+      vec3 d = pos - a;
+
+      float ab_sqr = dot(ab, ab);
+      float T = dot(ab, v) / ab_sqr;
+      float S = dot(ab, d) / ab_sqr;
+
+      vec3 V = v - vec3(T) * ab;
+      vec3 W = d - vec3(S) * ab;
+
+      float A = dot(V, V);
+      float B = 2.0f * dot(V, W);
+      float C = dot(W, W) - 1.0f;
+
+      float D = B * B - 4.0f * A * C;
+      if (D < 0.0f) // No solutions exist :(
+         return 10.0f;
+
+      float D_sqrt = std::sqrt(D);
+      float sol0 = (-B + D_sqrt) / (2.0f * A);
+      float sol1 = (-B - D_sqrt) / (2.0f * A);
+
+      float solution;
+      if (sol0 >= twiddle_factor && sol1 >= twiddle_factor)
+         solution = std::min(sol0, sol1);
+      else if (sol0 >= twiddle_factor && sol1 < twiddle_factor)
+         solution = sol0;
+      else if (sol0 < twiddle_factor && sol1 >= twiddle_factor)
+         solution = sol1;
+      else
+         return 10.0f;
+
+      // Check if solution hits the actual line ...
+      float k = dot(ab, d + vec3(solution) * v) / ab_sqr;
+      if (k >= 0.0f && k <= 1.0f)
+      {
+         crash_pos = a + vec3(k) * ab;
+         return solution;
+      }
+      else
+         return 10.0f;
+   }
+   /////////// End dragons
+
+   void World::clear()
+   {
+      positions.clear();
+      materials.clear();
+      polygons.clear();
+      polygon_vertices.clear();
+      polygon_triangles.clear();
+      nodes.clear();
+      indices.clear();
+      bodies.clear();
+      body_nodes.clear();
+      body_indices.clear();
+      generation++;
+   }
+
+   void World::reserve(std::size_t triangles)
+   {
+      positions.reserve(triangles * 3);
+      materials.reserve(triangles);
+      polygons.reserve(triangles);
+      polygon_vertices.reserve(triangles * 3);
+      polygon_triangles.reserve(triangles);
+   }
+
+   std::size_t World::memory_usage() const
+   {
+      std::size_t bytes =
+         positions.capacity() * sizeof(vec3) +
+         materials.capacity() * sizeof(unsigned) +
+         polygons.capacity() * sizeof(Polygon) +
+         polygon_vertices.capacity() * sizeof(unsigned) +
+         polygon_triangles.capacity() * sizeof(unsigned) +
+         nodes.capacity() * sizeof(BVHNode) +
+         indices.capacity() * sizeof(unsigned) +
+         bodies.capacity() * sizeof(Body) +
+         body_nodes.capacity() * sizeof(BVHNode) +
+         body_indices.capacity() * sizeof(unsigned);
+
+      for (unsigned i = 0; i < bodies.size(); i++)
+         if (bodies[i].shape)
+            bytes += sizeof(World) + bodies[i].shape->memory_usage();
+      return bytes;
+   }
+
+   static Triangle make_triangle(const vec3& a, const vec3& b, const vec3& c, unsigned material)
+   {
+      Triangle tri;
+      tri.a = a;
+      tri.b = b;
+      tri.c = c;
+      tri.material = material;
+
+      vec3 normal = cross(tri.b - tri.a, tri.c - tri.a);
+      float len = length(normal);
+      tri.normal = len > 0.0f ? -normal / vec3(len) : vec3(0.0f); // Make normals point inward. Makes for simpler computation.
+      tri.n0 = dot(tri.normal, tri.a); // Plane constant
+      return tri;
+   }
+
+   Triangle World::get_triangle(unsigned index) const
+   {
+      const vec3 *v = &positions[index * 3];
+      return make_triangle(v[0], v[1], v[2], materials[index]);
+   }
+
+   Triangle World::espace_triangle(unsigned index) const
+   {
+      const vec3 *v = &positions[index * 3];
+      return make_triangle(v[0] * espace_scale, v[1] * espace_scale, v[2] * espace_scale, materials[index]);
+   }
+
+   void World::add_triangle(const vec3& a, const vec3& b, const vec3& c, unsigned material)
+   {
+      positions.push_back(a);
+      positions.push_back(b);
+      positions.push_back(c);
+      materials.push_back(material);
+      Triangle tri = espace_triangle(materials.size() - 1);
+
+      // Until build() merges things, every triangle is its own polygon.
+      // Degenerate triangles can't be collided with, so don't bother.
+      if (tri.normal != vec3(0.0f))
+      {
+         unsigned first = positions.size() - 3;
+         Polygon poly;
+         poly.first_vertex = polygon_vertices.size();
+         poly.count = 3;
+         polygon_vertices.push_back(first + 0);
+         polygon_vertices.push_back(first + 1);
+         polygon_vertices.push_back(first + 2);
+         poly.normal = tri.normal;
+         poly.n0 = tri.n0;
+         poly.bb_min = min(min(tri.a, tri.b), tri.c);
+         poly.bb_max = max(max(tri.a, tri.b), tri.c);
+         poly.first_triangle = polygon_triangles.size();
+         poly.triangle_count = 1;
+         polygon_triangles.push_back(materials.size() - 1);
+         polygons.push_back(poly);
+      }
+
+      // Hierarchy is stale now.
+      nodes.clear();
+      indices.clear();
+      generation++;
+   }
+
+   static inline bool overlaps(const vec3& a_min, const vec3& a_max, const vec3& b_min, const vec3& b_max)
+   {
+      return !(a_max.x < b_min.x || a_min.x > b_max.x ||
+            a_max.y < b_min.y || a_min.y > b_max.y ||
+            a_max.z < b_min.z || a_min.z > b_max.z);
+   }
+
+   static inline bool overlaps(const Polygon& poly, const vec3& bb_min, const vec3& bb_max)
+   {
+      return overlaps(poly.bb_min, poly.bb_max, bb_min, bb_max);
+   }
+
+   // Returns number of triangles tested.
+   unsigned World::gather(const vec3& bb_min, const vec3& bb_max,
+         vector<unsigned>& candidates) const
+   {
+      if (nodes.empty())
+      {
+         for (unsigned i = 0; i < polygons.size(); i++)
+            if (overlaps(polygons[i], bb_min, bb_max))
+               candidates.push_back(i);
+         return polygons.size();
+      }
+
+      unsigned tested = 0;
+      unsigned stack[bvh_stack_size];
+      unsigned stack_size = 0;
+      stack[stack_size++] = 0;
+
+      while (stack_size)
+      {
+         const BVHNode& node = nodes[stack[--stack_size]];
+         if (!overlaps(node.bb_min, node.bb_max, bb_min, bb_max))
+            continue;
+
+         if (node.count)
+         {
+            for (unsigned i = node.first; i < node.first + node.count; i++)
+               if (overlaps(polygons[indices[i]], bb_min, bb_max))
+                  candidates.push_back(indices[i]);
+            tested += node.count;
+         }
+         else
+         {
+            assert(stack_size + 2 <= bvh_stack_size);
+            stack[stack_size++] = node.first;
+            stack[stack_size++] = &node - &nodes[0] + 1;
+         }
+      }
+
+      return tested;
+   }
+
+   void World::gather(const vec3& bb_min, const vec3& bb_max,
+         const vector<unsigned>& from, vector<unsigned>& candidates) const
+   {
+      for (unsigned i = 0; i < from.size(); i++)
+         if (overlaps(polygons[from[i]], bb_min, bb_max))
+            candidates.push_back(from[i]);
+   }
+
+   void World::set_body_transform(unsigned index, const mat4& transform)
+   {
+      Body& body = bodies[index];
+      body.previous = body.transform;
+      body.transform = transform;
+      body.to_espace = scale(mat4(1.0f), vec3(1.0f) / ellipsoid) * transform;
+      body.to_object = inverse(body.to_espace);
+      body.flipped = determinant(mat3(transform)) < 0.0f;
+   }
+
+   vec3 World::body_motion(unsigned index, const vec3& pos) const
+   {
+      const Body& body = bodies[index];
+      return vec3(body.transform * inverse(body.previous) * vec4(pos, 1.0f));
+   }
+
+   // Copy of a body's polygon, moved into ellipsoid space. Its vertices go to the end of verts.
+   static inline Polygon transform_polygon(const Polygon& src, const PolygonVerts& src_verts,
+         const mat4& transform, bool flipped, vector<vec3>& verts)
+   {
+      Polygon poly = src;
+      poly.first_vertex = verts.size();
+      verts.resize(verts.size() + src.count);
+      vec3 *dst = &verts[poly.first_vertex];
+      for (unsigned i = 0; i < src.count; i++)
+         dst[flipped ? src.count - 1 - i : i] = vec3(transform * vec4(src_verts[i], 1.0f));
+
+      poly.normal = -normalize(cross(dst[1] - dst[0], dst[2] - dst[0]));
+      poly.n0 = dot(poly.normal, dst[0]);
+      poly.bb_min = poly.bb_max = dst[0];
+      for (unsigned i = 1; i < poly.count; i++)
+      {
+         poly.bb_min = min(poly.bb_min, dst[i]);
+         poly.bb_max = max(poly.bb_max, dst[i]);
+      }
+      return poly;
+   }
+
+   // Box around a transformed box.
+   void transform_box(const mat4& transform, const vec3& bb_min, const vec3& bb_max,
+         vec3& out_min, vec3& out_max)
+   {
+      for (unsigned i = 0; i < 8; i++)
+      {
+         vec3 corner(i & 1 ? bb_max.x : bb_min.x, i & 2 ? bb_max.y : bb_min.y, i & 4 ? bb_max.z : bb_min.z);
+         vec3 pos = vec3(transform * vec4(corner, 1.0f));
+         out_min = i ? min(out_min, pos) : pos;
+         out_max = i ? max(out_max, pos) : pos;
+      }
+   }
+
+   void World::gather_bodies(const vec3& bb_min, const vec3& bb_max,
+         BodyCandidates& candidates) const
+   {
+      if (body_nodes.empty())
+         return;
+
+      unsigned stack[bvh_stack_size];
+      unsigned stack_size = 0;
+      stack[stack_size++] = 0;
+
+      while (stack_size)
+      {
+         const BVHNode& node = body_nodes[stack[--stack_size]];
+         if (!overlaps(node.bb_min, node.bb_max, bb_min, bb_max))
+            continue;
+
+         if (!node.count)
+         {
+            assert(stack_size + 2 <= bvh_stack_size);
+            stack[stack_size++] = node.first;
+            stack[stack_size++] = &node - &body_nodes[0] + 1;
+            continue;
+         }
+
+         for (unsigned i = node.first; i < node.first + node.count; i++)
+         {
+            const Body& body = bodies[body_indices[i]];
+            if (!overlaps(body.bb_min, body.bb_max, bb_min, bb_max))
+               continue;
+
+            vec3 obj_min, obj_max;
+            transform_box(body.to_object, bb_min, bb_max, obj_min, obj_max);
+
+            // Gather straight into sources, then keep the ones which still overlap once moved.
+            unsigned start = candidates.sources.size();
+            body.shape->gather(obj_min, obj_max, candidates.sources);
+
+            unsigned kept = start;
+            for (unsigned j = start; j < candidates.sources.size(); j++)
+            {
+               const Polygon& src = body.shape->polygons[candidates.sources[j]];
+               Polygon poly = transform_polygon(src, body.shape->polygon_verts(src),
+                     body.to_espace, body.flipped, candidates.verts);
+               if (!overlaps(poly, bb_min, bb_max))
+               {
+                  candidates.verts.resize(poly.first_vertex);
+                  continue;
+               }
+
+               candidates.polygons.push_back(poly);
+               candidates.bodies.push_back(body_indices[i]);
+               candidates.sources[kept++] = candidates.sources[j];
+            }
+            candidates.sources.resize(kept);
+         }
+      }
+   }
+
+   static inline bool hug_polygon(const Polygon& poly, const PolygonVerts& verts, const vec3& pos,
+         float& min_dist, const Polygon *&closest_hug)
+   {
+      float plane_dist = poly.n0 - dot(pos, poly.normal);
+
+      // Might be hugging too close.
+      if (plane_dist >= -0.01f && plane_dist < min_dist)
+      {
+         vec3 projected_pos = pos + poly.normal * vec3(plane_dist);
+         if (inside_polygon(poly, verts, projected_pos))
+         {
+            min_dist = plane_dist;
+            closest_hug = &poly;
+            return true;
+         }
+      }
+
+      return false;
+   }
+
+   // Returns the polygon we were pushed out of, if any, and the body it belongs to.
+   const Polygon *World::wall_hug(const vector<unsigned>& candidates, const BodyCandidates& moving,
+         vec3& pos, unsigned& body) const
+   {
+      float min_dist = 1.0f;
+      const Polygon *closest_hug = 0;
+      body = ~0u;
+
+      for (unsigned i = 0; i < candidates.size(); i++)
+      {
+         const Polygon& poly = polygons[candidates[i]];
+         hug_polygon(poly, polygon_verts(poly), pos, min_dist, closest_hug);
+      }
+      for (unsigned i = 0; i < moving.polygons.size(); i++)
+      {
+         const Polygon& poly = moving.polygons[i];
+         if (hug_polygon(poly, PolygonVerts(&moving.verts[poly.first_vertex]), pos, min_dist, closest_hug))
+            body = moving.bodies[i];
+      }
+
+      // Push player out.
+      if (closest_hug)
+         pos += vec3(min_dist - 1.0f) * closest_hug->normal;
+      return closest_hug;
+   }
+
+   // Sweeps a unit sphere at pos along v against one polygon.
+   // Returns the new min_time and updates contact_normal (unit, pointing into the surface)
+   // if we hit it before min_time.
+   static float sweep_polygon(const Polygon& poly, const PolygonVerts& verts,
+         const vec3& pos, const vec3& v, float min_time, vec3& contact_normal)
+   {
+      float plane_dist = poly.n0 - dot(pos, poly.normal);
+      float towards_plane_v = dot(v, poly.normal);
+
+      if (towards_plane_v <= 0.00001f) // We're not moving towards the plane.
+         return min_time;
+
+      float ticks_to_hit = (plane_dist - 1.0f) / towards_plane_v;
+
+      // We'll hit the plane in this frame.
+      if (ticks_to_hit >= 0.0f && ticks_to_hit < min_time)
+      {
+         vec3 projected_pos = (pos + poly.normal) + vec3(ticks_to_hit) * v;
+
+         if (inside_polygon(poly, verts, projected_pos))
+         {
+            min_time = ticks_to_hit;
+            contact_normal = poly.normal;
+         }
+      }
+      else if (plane_dist >= 0.0f && plane_dist < 1.0f + towards_plane_v) // Can potentially hit vertex ...
+      {
+         vec3 crash_pos_tmp;
+         float min_time_crash = 10.0f;
+
+         // Check how we can hit the polygon. Can hit vertices or edges ...
+         vec3 first = verts[0];
+         vec3 b = first;
+         for (unsigned i = 0; i < poly.count; i++)
+         {
+            vec3 a = b;
+            b = i + 1 < poly.count ? verts[i + 1] : first;
+
+            float time_point = point_crash_time(pos, v, a);
+            if (time_point < min_time_crash)
+            {
+               crash_pos_tmp  = a;
+               min_time_crash = time_point;
+            }
+
+            vec3 crash_pos_line;
+            float time_line = line_crash_time(pos, v, a, b, crash_pos_line);
+            if (time_line < min_time_crash)
+            {
+               crash_pos_tmp  = crash_pos_line;
+               min_time_crash = time_line;
+            }
+         }
+
+         if (min_time_crash < min_time)
+         {
+            // Ignore edges we're already sliding along, or we'd keep hitting them at t = 0.
+            vec3 normal = crash_pos_tmp - (pos + vec3(min_time_crash) * v);
+            float len = length(normal);
+            if (len > 0.0f && dot(v, normal) > 0.00001f * len)
+            {
+               min_time = min_time_crash;
+               contact_normal = normal / vec3(len);
+            }
+         }
+      }
+
+      return min_time;
+   }
+
+   // Finds the first contact along velocity.
+   // Returns time of impact in [0, 1) and the unit contact normal (pointing into the surface),
+   // or 1.0f if we can move freely. body is set to the body we hit, or ~0u.
+   float World::sweep(const vector<unsigned>& candidates, const BodyCandidates& moving,
+         const vec3& pos, const vec3& velocity, vec3& contact_normal, unsigned& body) const
+   {
+      float min_time = 1.0f;
+      body = ~0u;
+
+      for (unsigned i = 0; i < candidates.size(); i++)
+      {
+         const Polygon& poly = polygons[candidates[i]];
+         min_time = sweep_polygon(poly, polygon_verts(poly), pos, velocity, min_time, contact_normal);
+      }
+
+      for (unsigned i = 0; i < moving.polygons.size(); i++)
+      {
+         const Polygon& poly = moving.polygons[i];
+         float time = sweep_polygon(poly, PolygonVerts(&moving.verts[poly.first_vertex]),
+               pos, velocity, min_time, contact_normal);
+         if (time < min_time)
+         {
+            min_time = time;
+            body = moving.bodies[i];
+         }
+      }
+
+      return min_time;
+   }
+
+   MoveResult World::move(vec3& pos, const vec3& walk, vec3& fall) const
+   {
+      // Sliding never makes us travel further than the original velocity,
+      // and wall hugging only cares about triangles within a unit of where we end up.
+      float reach = length(walk + fall) + 1.05f;
+
+      vector<unsigned> candidates;
+      unsigned visited = gather(pos - vec3(reach), pos + vec3(reach), candidates);
+
+      BodyCandidates moving;
+      gather_bodies(pos - vec3(reach), pos + vec3(reach), moving);
+
+      MoveResult res = slide(candidates, moving, pos, walk, fall);
+      res.visited += visited;
+      return res;
+   }
+
+   MoveResult World::move(vec3& pos, const vec3& walk, vec3& fall,
+         ContactCache& cache) const
+   {
+      float reach = length(walk + fall) + 1.05f;
+      vec3 bb_min = pos - vec3(reach);
+      vec3 bb_max = pos + vec3(reach);
+
+      unsigned visited = 0;
+
+      if (cache.generation != generation ||
+            any(lessThan(bb_min, cache.bb_min)) ||
+            any(greaterThan(bb_max, cache.bb_max)))
+      {
+         cache.bb_min = bb_min - vec3(cache.margin);
+         cache.bb_max = bb_max + vec3(cache.margin);
+         cache.generation = generation;
+         cache.polygons.clear();
+         visited += gather(cache.bb_min, cache.bb_max, cache.polygons);
+         cache.misses++;
+      }
+      else
+         cache.hits++;
+
+      cache.candidates.clear();
+      gather(bb_min, bb_max, cache.polygons, cache.candidates);
+      visited += cache.polygons.size();
+
+      cache.moving.clear();
+      gather_bodies(bb_min, bb_max, cache.moving);
+
+      MoveResult res = slide(cache.candidates, cache.moving, pos, walk, fall);
+      res.visited += visited;
+      return res;
+   }
+
+   MoveResult World::slide(const vector<unsigned>& candidates, const BodyCandidates& moving,
+         vec3& pos, const vec3& walk, vec3& fall) const
+   {
+      MoveResult res;
+
+      // Gravity and walking are swept together, but tracked separately so that
+      // landing can cancel the fall without also eating the walk.
+      vec3 walk_v = walk;
+      vec3 fall_v = fall;
+      vec3 velocity = walk_v + fall_v;
+
+      for (unsigned i = 0; i < max_slide_planes && velocity != vec3(0.0f); i++)
+      {
+         res.visited += candidates.size() + moving.polygons.size();
+
+         vec3 normal;
+         unsigned body;
+         float time = sweep(candidates, moving, pos, velocity, normal, body);
+         if (time >= 1.0f)
+         {
+            pos += velocity;
+            velocity = vec3(0.0f);
+            break;
+         }
+
+         res.planes++;
+
+         // Move player to the contact.
+         pos += vec3(time) * velocity;
+
+         // Make velocity vector parallel with contact plane, and
+         // remove the time we used up moving to the wall.
+         walk_v -= vec3(dot(walk_v, normal)) * normal;
+         fall_v -= vec3(dot(fall_v, normal)) * normal;
+         walk_v *= vec3(1.0f - time);
+         fall_v *= vec3(1.0f - time);
+
+         if (normal.y < -0.01f)
+         {
+            res.on_ground = true;
+            res.ground_body = body;
+         }
+         else if (normal.y > 0.01f)
+            res.on_ceiling = true;
+
+         // Once we land, gravity stops pulling us along slopes.
+         if (res.on_ground || res.on_ceiling)
+            fall_v = vec3(0.0f);
+
+         velocity = walk_v + fall_v;
+      }
+
+      // If we ran out of slide planes, we're wedged in a corner. Just stay put.
+
+      res.visited += candidates.size() + moving.polygons.size();
+
+      // Being pushed out of a floor counts as standing on it. This is how we
+      // stay on lifts that move up into us.
+      unsigned hug_body;
+      const Polygon *hug = wall_hug(candidates, moving, pos, hug_body);
+      if (hug && hug->normal.y < -0.01f)
+      {
+         res.on_ground = true;
+         res.ground_body = hug_body;
+      }
+
+      if (res.on_ground || res.on_ceiling)
+         fall = vec3(0.0f);
+
+      return res;
+   }
+
+   static inline float safe_inverse(float v)
+   {
+      if (std::fabs(v) < 1e-20f)
+         return v < 0.0f ? -1e20f : 1e20f;
+      return 1.0f / v;
+   }
+
+   static inline bool ray_box(const vec3& origin, const vec3& inv_dir, float max_t,
+         const vec3& bb_min, const vec3& bb_max)
+   {
+      vec3 t0 = (bb_min - origin) * inv_dir;
+      vec3 t1 = (bb_max - origin) * inv_dir;
+      vec3 t_near = min(t0, t1);
+      vec3 t_far = max(t0, t1);
+
+      float enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.0f));
+      float leave = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, max_t));
+      return enter <= leave;
+   }
+
+   // Two-sided ray/polygon test.
+   static inline bool ray_polygon(const Polygon& poly, const PolygonVerts& verts,
+         const vec3& origin, const vec3& dir, float max_t, float& t)
+   {
+      float denom = dot(dir, poly.normal);
+      if (std::fabs(denom) < 1e-12f)
+         return false;
+
+      float hit_t = (poly.n0 - dot(origin, poly.normal)) / denom;
+      if (hit_t < 0.0f || hit_t > max_t)
+         return false;
+
+      if (!inside_polygon(poly, verts, origin + dir * vec3(hit_t)))
+         return false;
+
+      t = hit_t;
+      return true;
+   }
+
+   // Which of the polygon's source triangles pos (on the plane, in ellipsoid space) is in.
+   // The triangles aren't scaled, pos is scaled back instead.
+   unsigned World::find_triangle(const Polygon& poly, const vec3& pos) const
+   {
+      vec3 unscaled = pos * ellipsoid;
+      for (unsigned i = 0; i < poly.triangle_count; i++)
+      {
+         unsigned index = polygon_triangles[poly.first_triangle + i];
+         if (inside_triangle(get_triangle(index), unscaled))
+            return index;
+      }
+
+      // Right on an internal edge, and rounding got in the way.
+      return polygon_triangles[poly.first_triangle];
+   }
+
+   // Traces origin + t * dir for t in [0, max_t], in ellipsoid space.
+   // On a hit, fills in triangle, material and distance (as t). visited is always filled in.
+   bool World::trace(const vec3& origin, const vec3& dir, float max_t,
+         bool any_hit, RayHit& hit) const
+   {
+      float best_t = max_t;
+      unsigned best = ~0u;
+      unsigned visited = 0;
+
+      if (nodes.empty())
+      {
+         for (unsigned i = 0; i < polygons.size(); i++)
+         {
+            visited++;
+            float t;
+            if (ray_polygon(polygons[i], polygon_verts(polygons[i]), origin, dir, best_t, t))
+            {
+               best_t = t;
+               best = i;
+               if (any_hit)
+                  break;
+            }
+         }
+      }
+      else
+      {
+         vec3 inv_dir(safe_inverse(dir.x), safe_inverse(dir.y), safe_inverse(dir.z));
+
+         unsigned stack[bvh_stack_size];
+         unsigned stack_size = 0;
+         stack[stack_size++] = 0;
+
+         while (stack_size)
+         {
+            const BVHNode& node = nodes[stack[--stack_size]];
+            if (!ray_box(origin, inv_dir, best_t, node.bb_min, node.bb_max))
+               continue;
+
+            if (node.count)
+            {
+               visited += node.count;
+               for (unsigned i = node.first; i < node.first + node.count; i++)
+               {
+                  float t;
+                  const Polygon& poly = polygons[indices[i]];
+                  if (ray_polygon(poly, polygon_verts(poly), origin, dir, best_t, t))
+                  {
+                     best_t = t;
+                     best = indices[i];
+                  }
+               }
+
+               if (any_hit && best != ~0u)
+                  break;
+            }
+            else
+            {
+               assert(stack_size + 2 <= bvh_stack_size);
+               stack[stack_size++] = node.first;
+               stack[stack_size++] = &node - &nodes[0] + 1;
+            }
+         }
+      }
+
+      if (any_hit && best != ~0u)
+      {
+         hit.distance = best_t;
+         hit.triangle = find_triangle(polygons[best], origin + dir * vec3(best_t));
+         hit.material = materials[hit.triangle];
+         hit.visited = visited;
+         return true;
+      }
+
+      // Bodies trace in their own space. Affine transforms keep t as is.
+      RayHit body_hit;
+      if (!body_nodes.empty())
+      {
+         vec3 inv_dir(safe_inverse(dir.x), safe_inverse(dir.y), safe_inverse(dir.z));
+
+         unsigned stack[bvh_stack_size];
+         unsigned stack_size = 0;
+         stack[stack_size++] = 0;
+
+         while (stack_size)
+         {
+            const BVHNode& node = body_nodes[stack[--stack_size]];
+            if (!ray_box(origin, inv_dir, best_t, node.bb_min, node.bb_max))
+               continue;
+
+            if (!node.count)
+            {
+               assert(stack_size + 2 <= bvh_stack_size);
+               stack[stack_size++] = node.first;
+               stack[stack_size++] = &node - &body_nodes[0] + 1;
+               continue;
+            }
+
+            for (unsigned i = node.first; i < node.first + node.count; i++)
+            {
+               const Body& body = bodies[body_indices[i]];
+               if (!ray_box(origin, inv_dir, best_t, body.bb_min, body.bb_max))
+                  continue;
+
+               RayHit res;
+               bool did_hit = body.shape->trace(vec3(body.to_object * vec4(origin, 1.0f)),
+                     vec3(body.to_object * vec4(dir, 0.0f)), best_t, any_hit, res);
+               visited += res.visited;
+               if (did_hit)
+               {
+                  best_t = res.distance;
+                  body_hit = res;
+                  body_hit.body = body_indices[i];
+                  if (any_hit)
+                  {
+                     hit = body_hit;
+                     hit.visited = visited;
+                     return true;
+                  }
+               }
+            }
+         }
+      }
+
+      hit.visited = visited;
+      if (body_hit.hit())
+      {
+         hit = body_hit;
+         hit.visited = visited;
+         return true;
+      }
+
+      if (best == ~0u)
+         return false;
+
+      const Polygon& poly = polygons[best];
+      hit.distance = best_t;
+      hit.triangle = find_triangle(poly, origin + dir * vec3(best_t));
+      hit.material = materials[hit.triangle];
+      return true;
+   }
+
+   bool World::raycast(const Ray& ray, RayHit& hit) const
+   {
+      RayHit res;
+      if (!trace(ray.origin / ellipsoid, ray.dir / ellipsoid, ray.max_dist, false, res))
+      {
+         hit.visited = res.visited;
+         return false;
+      }
+
+      // Since dir is normalized, t is already world space distance.
+      res.pos = ray.origin + ray.dir * vec3(res.distance);
+
+      // Source triangles are unscaled, so their normals are already world space.
+      vec3 normal;
+      if (res.body == ~0u)
+         normal = get_triangle(res.triangle).normal;
+      else
+      {
+         const Body& body = bodies[res.body];
+         normal = normalize(transpose(inverse(mat3(body.transform))) * body.shape->get_triangle(res.triangle).normal);
+      }
+      res.normal = dot(normal, ray.dir) > 0.0f ? -normal : normal;
+
+      hit = res;
+      return true;
+   }
+
+   bool World::segment_cast(const vec3& from, const vec3& to, RayHit& hit) const
+   {
+      float len = length(to - from);
+      if (len <= 0.0f)
+         return false;
+
+      return raycast(Ray(from, (to - from) / vec3(len), len), hit);
+   }
+
+   bool World::line_of_sight(const vec3& from, const vec3& to) const
+   {
+      RayHit hit;
+      return !trace(from / ellipsoid, (to - from) / ellipsoid, 1.0f, true, hit);
+   }
+
+   bool World::sphere_cast(const vec3& from, const vec3& to, float radius, RayHit& hit) const
+   {
+      if (radius <= 0.0f)
+         return segment_cast(from, to, hit);
+
+      vec3 delta = to - from;
+      vec3 bb_min = (min(from, to) - vec3(radius)) / ellipsoid;
+      vec3 bb_max = (max(from, to) + vec3(radius)) / ellipsoid;
+      vector<unsigned> candidates;
+      unsigned visited = gather(bb_min, bb_max, candidates);
+      BodyCandidates moving;
+      gather_bodies(bb_min, bb_max, moving);
+      visited += candidates.size() + moving.polygons.size();
+      hit.visited = visited;
+
+      // Sweep a unit sphere in a world scaled down by radius.
+      vec3 pos = from / vec3(radius);
+      vec3 v = delta / vec3(radius);
+      if (v == vec3(0.0f))
+         return false;
+
+      vec3 scale = ellipsoid / vec3(radius);
+      float min_time = 1.0f;
+      vec3 normal;
+      unsigned best = ~0u;
+
+      unsigned total = candidates.size() + moving.polygons.size();
+      for (unsigned i = 0; i < total; i++)
+      {
+         bool is_static = i < candidates.size();
+         const Polygon& src = is_static ? polygons[candidates[i]] : moving.polygons[i - candidates.size()];
+         PolygonVerts src_verts = is_static ? polygon_verts(src) : PolygonVerts(&moving.verts[src.first_vertex]);
+
+         vec3 verts[Polygon::max_vertices];
+         for (unsigned j = 0; j < src.count; j++)
+            verts[j] = src_verts[j] * scale;
+         Polygon poly = src;
+         poly.normal = -normalize(cross(verts[1] - verts[0], verts[2] - verts[0]));
+         poly.n0 = dot(poly.normal, verts[0]);
+
+         float time = sweep_polygon(poly, PolygonVerts(verts), pos, v, min_time, normal);
+         if (time < min_time)
+         {
+            min_time = time;
+            best = i;
+         }
+      }
+
+      if (best == ~0u)
+         return false;
+
+      min_time = std::max(min_time, 0.0f);
+      hit.distance = min_time * length(delta);
+      hit.pos = from + delta * vec3(min_time);
+      hit.normal = -normal;
+
+      // Closest point on the plane tells us which source triangle we hit.
+      vec3 pos_espace = hit.pos / ellipsoid;
+      if (best < candidates.size())
+      {
+         const Polygon& poly = polygons[candidates[best]];
+         hit.triangle = find_triangle(poly, pos_espace + poly.normal * vec3(poly.n0 - dot(pos_espace, poly.normal)));
+         hit.material = materials[hit.triangle];
+         hit.body = ~0u;
+      }
+      else
+      {
+         best -= candidates.size();
+         const Body& body = bodies[moving.bodies[best]];
+         const Polygon& poly = body.shape->polygons[moving.sources[best]];
+         vec3 pos_object = vec3(body.to_object * vec4(pos_espace, 1.0f));
+         hit.triangle = body.shape->find_triangle(poly, pos_object + poly.normal * vec3(poly.n0 - dot(pos_object, poly.normal)));
+         hit.material = body.shape->materials[hit.triangle];
+         hit.body = moving.bodies[best];
+      }
+      return true;
+   }
+
+   struct RayBatch
+   {
+      const World *world;
+      const Ray *rays;
+      RayHit *hits;
+   };
+
+   static void raycast_range(void *data, size_t begin, size_t end)
+   {
+      const RayBatch *job = static_cast<const RayBatch*>(data);
+      for (size_t i = begin; i < end; i++)
+      {
+         job->hits[i] = RayHit();
+         job->world->raycast(job->rays[i], job->hits[i]);
+      }
+   }
+
+   void World::raycast_batch(const Ray *rays, RayHit *hits, size_t count,
+         Threading::ThreadPool *pool) const
+   {
+      RayBatch job = { this, rays, hits };
+      if (pool)
+         pool->parallel_for(count, 64, raycast_range, &job);
+      else
+         raycast_range(&job, 0, count);
+   }
+
+   struct SightBatch
+   {
+      const World *world;
+      const vec3 *from;
+      const vec3 *to;
+      bool *visible;
+   };
+
+   static void line_of_sight_range(void *data, size_t begin, size_t end)
+   {
+      const SightBatch *job = static_cast<const SightBatch*>(data);
+      for (size_t i = begin; i < end; i++)
+         job->visible[i] = job->world->line_of_sight(job->from[i], job->to[i]);
+   }
+
+   void World::line_of_sight_batch(const vec3 *from, const vec3 *to, bool *visible,
+         size_t count, Threading::ThreadPool *pool) const
+   {
+      SightBatch job = { this, from, to, visible };
+      if (pool)
+         pool->parallel_for(count, 64, line_of_sight_range, &job);
+      else
+         line_of_sight_range(&job, 0, count);
+   }
+
+   static inline bool fequal(float a, float b)
+   {
+      return std::fabs(a - b) < 0.0001f;
+   }
+
+   static inline bool vequal(const vec3& a, const vec3& b)
+   {
+      return fequal(a[0], b[0]) &&
+         fequal(a[1], b[1]) &&
+         fequal(a[2], b[2]);
+   }
+
+   void test_crash_detection()
+   {
+      vec3 pos = vec3(0.0f);
+
+      float a = point_crash_time(pos, vec3(1, 0, 0), vec3(3, 0, 0));
+      assert(fequal(a, 2.0f));
+
+      float b = point_crash_time(pos, vec3(1, 0, 0), vec3(2, 2, 0));
+      assert(fequal(b, 10.0f));
+
+      float c = point_crash_time(pos, vec3(1, 0, 0), vec3(1.0, 0.5, 0.0));
+      assert(fequal(c, 1.0f - std::cos(30.0f / 180.0f * M_PI)));
+
+      float d = point_crash_time(pos, vec3(0, 1, 0), vec3(0.5, 1.0, 0.0));
+      assert(fequal(d, 1.0f - std::cos(30.0f / 180.0f * M_PI)));
+
+      vec3 out_pos;
+      float e = line_crash_time(pos, vec3(1, 0, 0), vec3(4, -1, 0), vec3(4, 1, 0), out_pos);
+      assert(fequal(e, 3.0f) && vequal(out_pos, vec3(4, 0, 0)));
+
+      // A sphere resting on a floor should land and stay put.
+      World world;
+      world.add_triangle(vec3(-10, 0, -10), vec3(-10, 0, 10), vec3(10, 0, -10));
+      world.add_triangle(vec3(10, 0, -10), vec3(-10, 0, 10), vec3(10, 0, 10));
+      vec3 player(0, 1.5f, 0);
+      vec3 fall(0, -1.0f, 0);
+      MoveResult res = world.move(player, vec3(0.0f), fall);
+      assert(res.on_ground && fall == vec3(0.0f) && vequal(player, vec3(0, 1, 0)));
+
+      // Walking while standing on it should slide freely.
+      fall = vec3(0, -0.01f, 0);
+      res = world.move(player, vec3(0.5f, 0, 0), fall);
+      assert(res.on_ground && vequal(player, vec3(0.5f, 1, 0)));
+
+      // Cached moves should agree with uncached ones, and only refresh when leaving the cached region.
+      ContactCache cache;
+      vec3 cached_player = player;
+      for (unsigned i = 0; i < 8; i++)
+      {
+         vec3 cached_fall = fall = vec3(0, -0.01f, 0);
+         world.move(player, vec3(0.5f, 0, 0), fall);
+         world.move(cached_player, vec3(0.5f, 0, 0), cached_fall, cache);
+         assert(vequal(player, cached_player));
+      }
+      assert(cache.misses == 2 && cache.hits == 6);
+
+      // Hierarchy and ray queries against the same floor, which is now one quad.
+      world.build();
+      assert(world.polygon_count() == 1 && world.get_polygon(0).count == 4);
+      RayHit hit;
+      bool did_hit = world.raycast(Ray(vec3(1, 5, 1), vec3(0, -1, 0), 10.0f), hit);
+      assert(did_hit && fequal(hit.distance, 5.0f) && vequal(hit.normal, vec3(0, 1, 0)) && hit.triangle == 1);
+      did_hit = world.sphere_cast(vec3(1, 5, 1), vec3(1, -5, 1), 0.5f, hit);
+      assert(did_hit && vequal(hit.pos, vec3(1, 0.5f, 1)) && vequal(hit.normal, vec3(0, 1, 0)));
+      assert(!world.line_of_sight(vec3(0, 1, 0), vec3(0, -1, 0)));
+      assert(world.line_of_sight(vec3(0, 1, 0), vec3(5, 1, 5)));
+
+      // The same floor as a lift, raised by 2. We should land on it and know how it moved.
+      World lift_world;
+      vector<vec3> lift;
+      lift.push_back(vec3(-10, 0, -10));
+      lift.push_back(vec3(-10, 0, 10));
+      lift.push_back(vec3(10, 0, -10));
+      lift.push_back(vec3(10, 0, -10));
+      lift.push_back(vec3(-10, 0, 10));
+      lift.push_back(vec3(10, 0, 10));
+      unsigned lift_body = lift_world.add_body(lift, 7);
+      lift_world.set_body_transform(lift_body, translate(mat4(1.0f), vec3(0, 2, 0)));
+      lift_world.refit();
+      player = vec3(0, 3.5f, 0);
+      fall = vec3(0, -1.0f, 0);
+      res = lift_world.move(player, vec3(0.0f), fall);
+      assert(res.on_ground && res.ground_body == lift_body && vequal(player, vec3(0, 3, 0)));
+      assert(vequal(lift_world.body_motion(lift_body, player), vec3(0, 5, 0)));
+      did_hit = lift_world.raycast(Ray(vec3(1, 5, 1), vec3(0, -1, 0), 10.0f), hit);
+      assert(did_hit && hit.body == lift_body && hit.material == 7 &&
+            fequal(hit.distance, 3.0f) && vequal(hit.normal, vec3(0, 1, 0)));
+      (void)lift_body;
+      (void)did_hit;
+      (void)res;
+
+      if (log_cb)
+         log_cb(RETRO_LOG_INFO, "Collision tests passed!\n");
+   }
+}
+
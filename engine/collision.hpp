@@ -0,0 +1,347 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COLLISION_HPP__
+#define COLLISION_HPP__
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+#include "glm/glm.hpp"
+#include "thread_pool.hpp"
+#include "shared.hpp"
+
+namespace Collision
+{
+   // All collision math happens in "ellipsoid space", where the player is a unit sphere.
+   struct Triangle
+   {
+      glm::vec3 a, b, c;
+      glm::vec3 normal;
+      float n0;
+
+      unsigned material; // Opaque tag passed to add_triangle().
+   };
+
+   // What we actually collide with. Adjacent coplanar triangles with the same material
+   // are merged into one convex polygon, so their shared edges never get tested.
+   // Vertices are kept by whoever owns the polygon, see PolygonVerts.
+   struct Polygon
+   {
+      enum { max_vertices = 8 };
+
+      unsigned first_vertex; // In the owner's vertex store. Same winding as the source triangles.
+      unsigned count;
+
+      glm::vec3 normal;
+      float n0;
+
+      // Bounding box, used to reject polygons before the narrow phase.
+      glm::vec3 bb_min, bb_max;
+
+      unsigned first_triangle; // Source triangles, in World's polygon_triangles. Material is theirs.
+      unsigned triangle_count;
+   };
+
+   // A polygon's vertices in ellipsoid space.
+   // World's own polygons index its unscaled source positions, and are scaled as they're read.
+   // Polygons moved out of a body have theirs stored already scaled.
+   struct PolygonVerts
+   {
+      explicit PolygonVerts(const glm::vec3 *verts) :
+         verts(verts), positions(0), index(0), scale(1.0f) {}
+      PolygonVerts(const glm::vec3 *positions, const unsigned *index, const glm::vec3& scale) :
+         verts(0), positions(positions), index(index), scale(scale) {}
+
+      glm::vec3 operator[](unsigned i) const
+      {
+         return verts ? verts[i] : positions[index[i]] * scale;
+      }
+
+      const glm::vec3 *verts;
+      const glm::vec3 *positions;
+      const unsigned *index;
+      glm::vec3 scale; // Reciprocal of the ellipsoid, as in World::espace_scale.
+   };
+
+   // Ray queries are in world space.
+   struct Ray
+   {
+      Ray() : dir(0, 0, -1), max_dist(1.0f) {}
+      Ray(const glm::vec3& origin, const glm::vec3& dir, float max_dist) :
+         origin(origin), dir(dir), max_dist(max_dist) {}
+
+      glm::vec3 origin;
+      glm::vec3 dir; // Normalized.
+      float max_dist;
+   };
+
+   struct RayHit
+   {
+      RayHit() : distance(0.0f), triangle(~0u), material(0), body(~0u), visited(0) {}
+
+      bool hit() const { return triangle != ~0u; }
+
+      float distance;    // Along the ray, in world units.
+      glm::vec3 pos;     // World space position of the hit. For sphere casts, the center of the sphere.
+      glm::vec3 normal;  // Surface normal, facing back towards the query.
+      unsigned triangle; // Index in the order triangles were added (to the body, if any). ~0u on a miss.
+      unsigned material;
+      unsigned body;     // Body that was hit, ~0u for static geometry.
+      unsigned visited;  // Polygons tested, filled in on a miss too.
+   };
+
+   // Bounding volume hierarchy node. Leaves have count > 0.
+   struct BVHNode
+   {
+      glm::vec3 bb_min, bb_max;
+      unsigned first; // First index for leaves, right child for inner nodes (left child is the next node).
+      unsigned count;
+   };
+
+   // Traversals keep pending nodes on a fixed stack, which never holds more than the depth plus one.
+   // Trees are built no deeper than bvh_max_depth, counting the root as 0.
+   static const unsigned bvh_stack_size = 64;
+   static const unsigned bvh_max_depth = bvh_stack_size - 1;
+
+   struct MoveResult
+   {
+      MoveResult() :
+         on_ground(false),
+         on_ceiling(false),
+         planes(0),
+         visited(0),
+         ground_body(~0u)
+      {}
+
+      bool on_ground;   // Hit a surface facing upwards.
+      bool on_ceiling;  // Hit a surface facing downwards.
+      unsigned planes;  // Number of slide planes resolved.
+      unsigned visited; // Polygons visited in total.
+      unsigned ground_body; // Body we landed on, ~0u if none or static geometry.
+   };
+
+   // Polygons of moving bodies near a query, moved into ellipsoid space.
+   struct BodyCandidates
+   {
+      std::vector<Polygon> polygons;
+      std::vector<glm::vec3> verts;  // Vertices of the polygons, moved along with them.
+      std::vector<unsigned> bodies;  // Body each polygon came from.
+      std::vector<unsigned> sources; // Index of the polygon within that body.
+
+      void clear()
+      {
+         polygons.clear();
+         verts.clear();
+         bodies.clear();
+         sources.clear();
+      }
+   };
+
+   // Per-agent cache of polygons near the agent.
+   // Agents move a fraction of a unit per frame, so we gather everything within
+   // an inflated box once and only go back to the world when we leave it,
+   // or when the world geometry changes.
+   struct ContactCache
+   {
+      ContactCache() :
+         margin(2.0f),
+         generation(0),
+         hits(0),
+         misses(0)
+      {}
+
+      float margin; // How far to inflate the cached region on refresh.
+
+      glm::vec3 bb_min, bb_max;
+      unsigned generation; // World generation the cache was built from. 0 is never valid.
+      std::vector<unsigned> polygons;
+      std::vector<unsigned> candidates; // Scratch for the per-frame narrow phase.
+      BodyCandidates moving;            // Bodies move, so these are never cached.
+
+      uint64_t hits;
+      uint64_t misses;
+
+      void invalidate() { generation = 0; }
+      void reset_stats() { hits = misses = 0; }
+   };
+
+   class World;
+
+   // Geometry that moves as one piece, like doors and lifts.
+   // Triangles are kept in object space with their own hierarchy, so moving
+   // a body only changes its transform and its box in the top level.
+   struct Body
+   {
+      std1::shared_ptr<World> shape; // Object space, ellipsoid of 1.
+      glm::mat4 transform;  // Object to world space.
+      glm::mat4 previous;   // Transform before the last set_body_transform().
+      glm::mat4 to_espace;  // Object to ellipsoid space.
+      glm::mat4 to_object;  // Ellipsoid to object space.
+      bool flipped;         // Transform mirrors, so winding flips.
+      glm::vec3 local_min, local_max; // Object space.
+      glm::vec3 bb_min, bb_max;       // Ellipsoid space, as of the last refit().
+   };
+
+   class World
+   {
+      public:
+         World() : ellipsoid(1.0f), espace_scale(1.0f), generation(1) {}
+
+         // Radii of the agents' ellipsoid. Geometry is scaled by this when added.
+         void set_ellipsoid(const glm::vec3& radii)
+         {
+            ellipsoid = radii;
+            espace_scale = glm::vec3(1.0f) / radii;
+         }
+         const glm::vec3& get_ellipsoid() const { return ellipsoid; }
+
+         void clear();
+         void reserve(std::size_t triangles);
+         void add_triangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c,
+               unsigned material = 0);
+         std::size_t size() const { return materials.size(); }
+
+         // As added, before ellipsoid scaling. Only positions are kept, the rest is worked out here.
+         Triangle get_triangle(unsigned index) const;
+
+         std::size_t polygon_count() const { return polygons.size(); }
+         const Polygon& get_polygon(unsigned index) const { return polygons[index]; }
+         PolygonVerts get_polygon_verts(unsigned index) const { return polygon_verts(polygons[index]); }
+
+         // Merges coplanar triangles and builds the hierarchy over the result.
+         // Until this is called, every triangle is its own polygon and
+         // queries fall back to testing all of them.
+         // The tree only depends on the triangles, not on how many threads pool has.
+         void build(Threading::ThreadPool *pool = NULL);
+
+         // Adds a moving body from object space triangles (3 vertices each),
+         // all tagged with material. Returns the body index.
+         unsigned add_body(const std::vector<glm::vec3>& vertices, unsigned material,
+               const glm::mat4& transform = glm::mat4(1.0f));
+         std::size_t body_count() const { return bodies.size(); }
+         const Body& get_body(unsigned index) const { return bodies[index]; }
+
+         // Moves a body. Call refit() once all bodies for this frame are moved,
+         // before querying the world again.
+         void set_body_transform(unsigned body, const glm::mat4& transform);
+         void refit();
+
+         // Where a world space point riding along with body ended up after its last move.
+         glm::vec3 body_motion(unsigned body, const glm::vec3& pos) const;
+
+         // Identifies the triangles added so far (and the ellipsoid they were scaled by).
+         uint64_t source_hash() const;
+
+         // Built polygons and hierarchy, so build() can be skipped next time.
+         // unserialize() only accepts data built from the exact same triangles,
+         // which must already have been added.
+         void serialize(std::vector<uint8_t>& data) const;
+         bool unserialize(const std::vector<uint8_t>& data);
+         std::size_t node_count() const { return nodes.size(); }
+
+         // Bytes held, bodies included. Capacity, so cleared worlds still count until destroyed.
+         std::size_t memory_usage() const;
+
+         // Moves a sphere at pos by walk + fall with slide response. Everything is in ellipsoid space.
+         // The world is swept once for candidates, then up to max_slide_planes
+         // contacts are resolved against those before pushing out of walls.
+         // fall is cleared when we land on something or bump our head.
+         MoveResult move(glm::vec3& pos, const glm::vec3& walk, glm::vec3& fall) const;
+
+         // Same as above, but candidates come from the agent's cache when possible.
+         MoveResult move(glm::vec3& pos, const glm::vec3& walk, glm::vec3& fall,
+               ContactCache& cache) const;
+
+         // Closest hit along the ray, if any.
+         bool raycast(const Ray& ray, RayHit& hit) const;
+         bool segment_cast(const glm::vec3& from, const glm::vec3& to, RayHit& hit) const;
+
+         // Sweeps a sphere from from to to. Only surfaces facing the sphere are hit.
+         bool sphere_cast(const glm::vec3& from, const glm::vec3& to, float radius, RayHit& hit) const;
+
+         // True if nothing is in the way. Stops at the first hit.
+         bool line_of_sight(const glm::vec3& from, const glm::vec3& to) const;
+
+         // Batched versions, spread over pool if not NULL.
+         void raycast_batch(const Ray *rays, RayHit *hits, std::size_t count,
+               Threading::ThreadPool *pool) const;
+         void line_of_sight_batch(const glm::vec3 *from, const glm::vec3 *to, bool *visible,
+               std::size_t count, Threading::ThreadPool *pool) const;
+
+         static const unsigned max_slide_planes = 4;
+
+      private:
+         // Source triangles, three positions each. Scaled into ellipsoid space where needed,
+         // so this is the only copy, and the one place the scene's positions live after load.
+         // Polygons don't have their own, polygon_vertices indexes into these.
+         std::vector<glm::vec3> positions;
+         std::vector<unsigned> materials;
+         std::vector<Polygon> polygons;
+         std::vector<unsigned> polygon_vertices;
+         std::vector<unsigned> polygon_triangles;
+         glm::vec3 ellipsoid;
+         glm::vec3 espace_scale; // 1 / ellipsoid. Polygon vertices are scaled on every read, so multiply.
+         unsigned generation; // Bumped whenever geometry changes.
+
+         std::vector<BVHNode> nodes;
+         std::vector<unsigned> indices; // Polygon indices, in leaf order.
+
+         std::vector<Body> bodies;
+         std::vector<BVHNode> body_nodes; // Top level over bodies. Topology only changes in add_body().
+         std::vector<unsigned> body_indices;
+
+         void build_bodies();
+         void gather_bodies(const glm::vec3& bb_min, const glm::vec3& bb_max,
+               BodyCandidates& candidates) const;
+
+         Triangle espace_triangle(unsigned index) const;
+         PolygonVerts polygon_verts(const Polygon& poly) const
+         {
+            return PolygonVerts(&positions[0], &polygon_vertices[poly.first_vertex], espace_scale);
+         }
+         void merge_coplanar();
+         unsigned find_triangle(const Polygon& poly, const glm::vec3& pos) const;
+         bool trace(const glm::vec3& origin, const glm::vec3& dir, float max_t,
+               bool any_hit, RayHit& hit) const;
+
+         unsigned gather(const glm::vec3& bb_min, const glm::vec3& bb_max,
+               std::vector<unsigned>& candidates) const;
+         void gather(const glm::vec3& bb_min, const glm::vec3& bb_max,
+               const std::vector<unsigned>& from, std::vector<unsigned>& candidates) const;
+         MoveResult slide(const std::vector<unsigned>& candidates, const BodyCandidates& moving,
+               glm::vec3& pos, const glm::vec3& walk, glm::vec3& fall) const;
+         float sweep(const std::vector<unsigned>& candidates, const BodyCandidates& moving,
+               const glm::vec3& pos, const glm::vec3& velocity,
+               glm::vec3& normal, unsigned& body) const;
+         const Polygon *wall_hug(const std::vector<unsigned>& candidates, const BodyCandidates& moving,
+               glm::vec3& pos, unsigned& body) const;
+   };
+
+   bool inside_triangle(const Triangle& tri, const glm::vec3& pos);
+   bool inside_polygon(const Polygon& poly, const PolygonVerts& verts, const glm::vec3& pos);
+   void transform_box(const glm::mat4& transform, const glm::vec3& bb_min, const glm::vec3& bb_max,
+         glm::vec3& out_min, glm::vec3& out_max);
+   float point_crash_time(const glm::vec3& pos, const glm::vec3& v, const glm::vec3& edge);
+   float line_crash_time(const glm::vec3& pos, const glm::vec3& v,
+         const glm::vec3& a, const glm::vec3& b, glm::vec3& crash_pos);
+
+   void test_crash_detection();
+}
+
+#endif
+
@@ -0,0 +1,879 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "collision.hpp"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstring>
+
+using namespace glm;
+using namespace std;
+
+namespace Collision
+{
+   // Directed edge, keyed on exact positions. Vertices shared in the source
+   // mesh end up bit-identical after scaling, which is all we need.
+   struct EdgeKey
+   {
+      EdgeKey(const vec3& a, const vec3& b)
+      {
+         v[0] = a.x; v[1] = a.y; v[2] = a.z;
+         v[3] = b.x; v[4] = b.y; v[5] = b.z;
+      }
+
+      bool operator<(const EdgeKey& other) const
+      {
+         for (unsigned i = 0; i < 6; i++)
+            if (v[i] != other.v[i])
+               return v[i] < other.v[i];
+         return false;
+      }
+
+      float v[6];
+   };
+
+   struct Edge
+   {
+      Edge(const vec3& a, const vec3& b, unsigned id) : key(a, b), id(id) {}
+
+      EdgeKey key;
+      unsigned id; // Triangle * 3 + edge.
+
+      // Sorted by id within a key, so lookups see neighbours in a fixed order.
+      bool operator<(const Edge& other) const
+      {
+         if (key < other.key)
+            return true;
+         if (other.key < key)
+            return false;
+         return id < other.id;
+      }
+   };
+
+   struct EdgeKeyLess
+   {
+      bool operator()(const Edge& edge, const EdgeKey& key) const { return edge.key < key; }
+      bool operator()(const EdgeKey& key, const Edge& edge) const { return key < edge.key; }
+   };
+
+   static const unsigned max_boundary = 32;
+
+   // Turn at cur is convex (or straight) with respect to the face normal.
+   static inline bool convex_turn(const vec3& prev, const vec3& cur, const vec3& next, const vec3& face)
+   {
+      vec3 e0 = cur - prev;
+      vec3 e1 = next - cur;
+      return dot(cross(e0, e1), face) >= -1e-6f * length(e0) * length(e1);
+   }
+
+   static inline bool straight_turn(const vec3& prev, const vec3& cur, const vec3& next)
+   {
+      vec3 e0 = cur - prev;
+      vec3 e1 = next - cur;
+      return length(cross(e0, e1)) <= 1e-6f * length(e0) * length(e1);
+   }
+
+   // Boundary without the vertices in the middle of straight edges.
+   // out gets the positions in boundary of the ones left.
+   static unsigned simplify(const vector<vec3>& boundary, unsigned *out, unsigned max_out)
+   {
+      unsigned count = 0;
+      unsigned size = boundary.size();
+      for (unsigned i = 0; i < size; i++)
+      {
+         const vec3& prev = boundary[(i + size - 1) % size];
+         const vec3& next = boundary[(i + 1) % size];
+         if (straight_turn(prev, boundary[i], next))
+            continue;
+
+         if (count >= max_out)
+            return max_out + 1;
+         if (out)
+            out[count] = i;
+         count++;
+      }
+      return count;
+   }
+
+   // Greedily grows convex polygons from triangles, in index order, so the
+   // result only depends on the input.
+   void World::merge_coplanar()
+   {
+      // Let go of the polygon per triangle from add_triangle(), rather than keep its capacity.
+      vector<Polygon>().swap(polygons);
+      vector<unsigned>().swap(polygon_vertices);
+      vector<unsigned>().swap(polygon_triangles);
+
+      // Only while merging. Ellipsoid space, like the polygons.
+      vector<Triangle> triangles(materials.size());
+      for (unsigned i = 0; i < triangles.size(); i++)
+         triangles[i] = espace_triangle(i);
+
+      vector<Edge> edges;
+      edges.reserve(triangles.size() * 3);
+      for (unsigned i = 0; i < triangles.size(); i++)
+      {
+         const Triangle& tri = triangles[i];
+         edges.push_back(Edge(tri.a, tri.b, i * 3 + 0));
+         edges.push_back(Edge(tri.b, tri.c, i * 3 + 1));
+         edges.push_back(Edge(tri.c, tri.a, i * 3 + 2));
+      }
+      sort(edges.begin(), edges.end());
+      // A polygon of n triangles has at most n + 2 vertices.
+      polygons.reserve(triangles.size());
+      polygon_vertices.reserve(triangles.size() * 3);
+      polygon_triangles.reserve(triangles.size());
+
+      vector<bool> used(triangles.size());
+      vector<vec3> boundary;
+      vector<unsigned> boundary_ids; // Where in positions each boundary vertex came from.
+      vector<unsigned> members;
+
+      for (unsigned i = 0; i < triangles.size(); i++)
+      {
+         const Triangle& seed = triangles[i];
+         if (used[i] || seed.normal == vec3(0.0f)) // Degenerate.
+            continue;
+
+         used[i] = true;
+         boundary.clear();
+         boundary.push_back(seed.a);
+         boundary.push_back(seed.b);
+         boundary.push_back(seed.c);
+         boundary_ids.clear();
+         boundary_ids.push_back(i * 3 + 0);
+         boundary_ids.push_back(i * 3 + 1);
+         boundary_ids.push_back(i * 3 + 2);
+         members.clear();
+         members.push_back(i);
+
+         // Winding is clockwise around the normal, since it points inward.
+         vec3 face = -seed.normal;
+
+         for (unsigned k = 0; k < boundary.size() && boundary.size() < max_boundary; )
+         {
+            unsigned size = boundary.size();
+            const vec3& p0 = boundary[k];
+            const vec3& p1 = boundary[(k + 1) % size];
+
+            bool merged = false;
+            pair<vector<Edge>::const_iterator, vector<Edge>::const_iterator> range =
+               equal_range(edges.begin(), edges.end(), EdgeKey(p1, p0), EdgeKeyLess());
+            for (vector<Edge>::const_iterator itr = range.first; itr != range.second; ++itr)
+            {
+               unsigned index = itr->id / 3;
+               const Triangle& tri = triangles[index];
+               if (used[index] || tri.material != seed.material ||
+                     dot(tri.normal, seed.normal) < 1.0f - 1e-5f)
+                  continue;
+
+               const vec3 *verts[3] = { &tri.a, &tri.b, &tri.c };
+               unsigned corner = (itr->id % 3 + 2) % 3;
+               const vec3& q = *verts[corner];
+               if (std::fabs(dot(seed.normal, q) - seed.n0) > 1e-4f)
+                  continue;
+
+               // q goes in between p0 and p1. Only the turns at p0 and p1 can go concave.
+               const vec3& prev = boundary[(k + size - 1) % size];
+               const vec3& next = boundary[(k + 2) % size];
+               if (!convex_turn(prev, p0, q, face) || !convex_turn(q, p1, next, face))
+                  continue;
+
+               vector<vec3> grown(boundary);
+               grown.insert(grown.begin() + k + 1, q);
+               if (simplify(grown, NULL, Polygon::max_vertices) > Polygon::max_vertices)
+                  continue;
+
+               boundary.swap(grown);
+               boundary_ids.insert(boundary_ids.begin() + k + 1, index * 3 + corner);
+               members.push_back(index);
+               used[index] = true;
+               merged = true;
+               break;
+            }
+
+            // The new edge p0 -> q might have neighbours of its own.
+            if (!merged)
+               k++;
+         }
+
+         unsigned kept[Polygon::max_vertices];
+         Polygon poly;
+         poly.first_vertex = polygon_vertices.size();
+         poly.count = simplify(boundary, kept, Polygon::max_vertices);
+         poly.normal = seed.normal;
+         poly.n0 = seed.n0;
+         poly.bb_min = poly.bb_max = boundary[kept[0]];
+         for (unsigned j = 0; j < poly.count; j++)
+         {
+            polygon_vertices.push_back(boundary_ids[kept[j]]);
+            poly.bb_min = min(poly.bb_min, boundary[kept[j]]);
+            poly.bb_max = max(poly.bb_max, boundary[kept[j]]);
+         }
+         poly.first_triangle = polygon_triangles.size();
+         poly.triangle_count = members.size();
+         polygon_triangles.insert(polygon_triangles.end(), members.begin(), members.end());
+         polygons.push_back(poly);
+      }
+   }
+
+   static const unsigned max_leaf_size = 4;
+   static const unsigned num_bins = 16;
+
+   // SAH may split one off at a time. Past this depth, median splits take at most 32 more levels
+   // to get any count down to a leaf, which stays within bvh_max_depth.
+   static const unsigned median_depth = bvh_max_depth - 32;
+
+   // Subtrees below this size are built as independent tasks.
+   // Fixed, so the tree doesn't depend on the number of threads.
+   static const unsigned task_size = 4096;
+   static const unsigned max_task_depth = 8;
+
+   // Binning is split over the pool in chunks of this many polygons.
+   static const unsigned bin_chunk = 8192;
+
+   struct Bounds
+   {
+      Bounds() :
+         bb_min(numeric_limits<float>::max()), bb_max(-numeric_limits<float>::max()),
+         c_min(numeric_limits<float>::max()), c_max(-numeric_limits<float>::max())
+      {}
+
+      vec3 bb_min, bb_max; // Of the polygons.
+      vec3 c_min, c_max;   // Of their centroids.
+
+      void merge(const Bounds& other)
+      {
+         bb_min = min(bb_min, other.bb_min);
+         bb_max = max(bb_max, other.bb_max);
+         c_min = min(c_min, other.c_min);
+         c_max = max(c_max, other.c_max);
+      }
+   };
+
+   struct Bin
+   {
+      Bin() : bb_min(numeric_limits<float>::max()), bb_max(-numeric_limits<float>::max()), count(0) {}
+
+      vec3 bb_min, bb_max;
+      unsigned count;
+   };
+
+   static inline float half_area(const vec3& bb_min, const vec3& bb_max)
+   {
+      vec3 d = bb_max - bb_min;
+      return d.x * d.y + d.y * d.z + d.z * d.x;
+   }
+
+   struct CentroidLess
+   {
+      CentroidLess(const vector<vec3>& centroids, unsigned axis) : centroids(centroids), axis(axis) {}
+
+      // Ties are broken by index so the tree doesn't depend on the sort implementation.
+      bool operator()(unsigned a, unsigned b) const
+      {
+         if (centroids[a][axis] != centroids[b][axis])
+            return centroids[a][axis] < centroids[b][axis];
+         return a < b;
+      }
+
+      const vector<vec3>& centroids;
+      unsigned axis;
+   };
+
+   // Which bin a centroid falls in along one axis.
+   struct BinMapping
+   {
+      BinMapping() : axis(0), offset(0.0f), scale(0.0f) {}
+      BinMapping(unsigned axis, float offset, float scale) : axis(axis), offset(offset), scale(scale) {}
+
+      unsigned operator()(const vec3& c) const
+      {
+         int bin = int((c[axis] - offset) * scale);
+         return std::min(unsigned(std::max(bin, 0)), num_bins - 1);
+      }
+
+      unsigned axis;
+      float offset, scale;
+   };
+
+   struct LeftOfSplit
+   {
+      LeftOfSplit(const vector<vec3>& centroids, const BinMapping& mapping, unsigned split) :
+         centroids(centroids), mapping(mapping), split(split) {}
+
+      bool operator()(unsigned index) const { return mapping(centroids[index]) < split; }
+
+      const vector<vec3>& centroids;
+      BinMapping mapping;
+      unsigned split;
+   };
+
+   // Top-down binned SAH builder, over anything with a bounding box.
+   // The top of the tree is built on the calling thread, with binning spread over the pool.
+   // Everything below task_size items is built as separate subtrees, one per task,
+   // which are stitched together in depth-first order at the end.
+   template<typename T>
+   class BVHBuilder
+   {
+      public:
+         BVHBuilder(const vector<T>& items, const vector<vec3>& centroids,
+               vector<unsigned>& indices, Threading::ThreadPool *pool) :
+            items(items), centroids(centroids), indices(indices), pool(pool)
+         {}
+
+         void build(vector<BVHNode>& nodes)
+         {
+            vector<BVHNode> top;
+            build_node(top, 0, indices.size(), 0, true);
+
+            if (pool)
+               pool->parallel_for(tasks.size(), 1, task_entry, this);
+            else
+               task_entry(this, 0, tasks.size());
+
+            nodes.clear();
+            nodes.reserve(2 * indices.size() / max_leaf_size + 1);
+            emit(top, 0, nodes);
+         }
+
+      private:
+         const vector<T>& items;
+         const vector<vec3>& centroids;
+         vector<unsigned>& indices;
+         Threading::ThreadPool *pool;
+
+         struct Task
+         {
+            unsigned first, count, depth;
+            vector<BVHNode> nodes;
+         };
+         vector<Task> tasks;
+         vector<unsigned> task_of; // Top node -> task, or ~0u.
+
+         struct BinJob
+         {
+            const BVHBuilder *self;
+            unsigned first, last;
+            const BinMapping *mappings; // Per axis. NULL for the bounds pass.
+            Bounds *bounds;              // Per chunk.
+            Bin *bins;                   // Per chunk, 3 * num_bins each.
+         };
+
+         static void bin_entry(void *data, size_t begin, size_t end)
+         {
+            const BinJob *job = static_cast<const BinJob*>(data);
+            for (size_t chunk = begin; chunk < end; chunk++)
+            {
+               unsigned first = job->first + chunk * bin_chunk;
+               unsigned last = std::min(first + bin_chunk, job->last);
+               if (job->mappings)
+                  job->self->bin_range(first, last, job->mappings, job->bins + chunk * 3 * num_bins);
+               else
+                  job->self->bounds_range(first, last, job->bounds[chunk]);
+            }
+         }
+
+         void bounds_range(unsigned first, unsigned last, Bounds& bounds) const
+         {
+            for (unsigned i = first; i < last; i++)
+            {
+               const T& item = items[indices[i]];
+               const vec3& c = centroids[indices[i]];
+               bounds.bb_min = min(bounds.bb_min, item.bb_min);
+               bounds.bb_max = max(bounds.bb_max, item.bb_max);
+               bounds.c_min = min(bounds.c_min, c);
+               bounds.c_max = max(bounds.c_max, c);
+            }
+         }
+
+         void bin_range(unsigned first, unsigned last, const BinMapping *mappings, Bin *bins) const
+         {
+            for (unsigned i = first; i < last; i++)
+            {
+               const T& item = items[indices[i]];
+               const vec3& c = centroids[indices[i]];
+               for (unsigned axis = 0; axis < 3; axis++)
+               {
+                  if (mappings[axis].scale <= 0.0f)
+                     continue;
+
+                  Bin& bin = bins[axis * num_bins + mappings[axis](c)];
+                  bin.bb_min = min(bin.bb_min, item.bb_min);
+                  bin.bb_max = max(bin.bb_max, item.bb_max);
+                  bin.count++;
+               }
+            }
+         }
+
+         // Min, max and counts are exact, so merging the chunks in any order gives the same result.
+         void compute_bins(unsigned first, unsigned count, bool parallel,
+               Bounds& bounds, const BinMapping *mappings, Bin *bins)
+         {
+            unsigned chunks = (count + bin_chunk - 1) / bin_chunk;
+            if (!parallel || !pool || chunks < 2)
+            {
+               if (mappings)
+                  bin_range(first, first + count, mappings, bins);
+               else
+                  bounds_range(first, first + count, bounds);
+               return;
+            }
+
+            vector<Bounds> chunk_bounds(mappings ? 0 : chunks);
+            vector<Bin> chunk_bins(mappings ? chunks * 3 * num_bins : 0);
+
+            BinJob job;
+            job.self = this;
+            job.first = first;
+            job.last = first + count;
+            job.mappings = mappings;
+            job.bounds = mappings ? NULL : &chunk_bounds[0];
+            job.bins = mappings ? &chunk_bins[0] : NULL;
+            pool->parallel_for(chunks, 1, bin_entry, &job);
+
+            for (unsigned chunk = 0; chunk < chunks; chunk++)
+            {
+               if (!mappings)
+               {
+                  bounds.merge(chunk_bounds[chunk]);
+                  continue;
+               }
+
+               for (unsigned i = 0; i < 3 * num_bins; i++)
+               {
+                  const Bin& src = chunk_bins[chunk * 3 * num_bins + i];
+                  bins[i].bb_min = min(bins[i].bb_min, src.bb_min);
+                  bins[i].bb_max = max(bins[i].bb_max, src.bb_max);
+                  bins[i].count += src.count;
+               }
+            }
+         }
+
+         static void task_entry(void *data, size_t begin, size_t end)
+         {
+            BVHBuilder *self = static_cast<BVHBuilder*>(data);
+            for (size_t i = begin; i < end; i++)
+            {
+               Task& task = self->tasks[i];
+               self->build_node(task.nodes, task.first, task.count, task.depth, false);
+            }
+         }
+
+         // Builds depth-first, with the left child right after its parent and
+         // first pointing at the right child, same as the final layout.
+         unsigned build_node(vector<BVHNode>& nodes, unsigned first, unsigned count,
+               unsigned depth, bool top)
+         {
+            unsigned index = nodes.size();
+            nodes.push_back(BVHNode());
+            if (top)
+               task_of.push_back(~0u);
+
+            if (top && (count <= task_size || depth >= max_task_depth))
+            {
+               task_of[index] = tasks.size();
+               tasks.push_back(Task());
+               tasks.back().first = first;
+               tasks.back().count = count;
+               tasks.back().depth = depth;
+               return index;
+            }
+
+            Bounds bounds;
+            compute_bins(first, count, top, bounds, NULL, NULL);
+            nodes[index].bb_min = bounds.bb_min;
+            nodes[index].bb_max = bounds.bb_max;
+
+            // The depth check is only a backstop, median splits keep trees shallower than that.
+            vec3 extent = bounds.c_max - bounds.c_min;
+            if (count <= max_leaf_size || depth >= bvh_max_depth ||
+                  (extent.x <= 0.0f && extent.y <= 0.0f && extent.z <= 0.0f))
+            {
+               nodes[index].first = first;
+               nodes[index].count = count;
+               return index;
+            }
+
+            BinMapping mappings[3];
+            for (unsigned axis = 0; axis < 3; axis++)
+               if (extent[axis] > 0.0f)
+                  mappings[axis] = BinMapping(axis, bounds.c_min[axis], num_bins / extent[axis]);
+
+            // Cheapest split of the bins, by surface area heuristic. Too deep, always the median.
+            bool sah = depth < median_depth;
+            Bin bins[3 * num_bins];
+            if (sah)
+               compute_bins(first, count, top, bounds, mappings, bins);
+
+            float best_cost = numeric_limits<float>::max();
+            unsigned best_axis = 0, best_split = 0;
+            for (unsigned axis = 0; sah && axis < 3; axis++)
+            {
+               if (mappings[axis].scale <= 0.0f)
+                  continue;
+
+               const Bin *axis_bins = bins + axis * num_bins;
+               float right_area[num_bins];
+               unsigned right_count[num_bins];
+
+               Bin acc;
+               for (unsigned i = num_bins - 1; i > 0; i--)
+               {
+                  acc.bb_min = min(acc.bb_min, axis_bins[i].bb_min);
+                  acc.bb_max = max(acc.bb_max, axis_bins[i].bb_max);
+                  acc.count += axis_bins[i].count;
+                  right_area[i] = acc.count ? half_area(acc.bb_min, acc.bb_max) : 0.0f;
+                  right_count[i] = acc.count;
+               }
+
+               acc = Bin();
+               for (unsigned split = 1; split < num_bins; split++)
+               {
+                  const Bin& bin = axis_bins[split - 1];
+                  acc.bb_min = min(acc.bb_min, bin.bb_min);
+                  acc.bb_max = max(acc.bb_max, bin.bb_max);
+                  acc.count += bin.count;
+                  if (!acc.count || !right_count[split])
+                     continue;
+
+                  float cost = acc.count * half_area(acc.bb_min, acc.bb_max) +
+                     right_count[split] * right_area[split];
+                  if (cost < best_cost)
+                  {
+                     best_cost = cost;
+                     best_axis = axis;
+                     best_split = split;
+                  }
+               }
+            }
+
+            unsigned half;
+            if (best_split)
+            {
+               half = partition(indices.begin() + first, indices.begin() + first + count,
+                     LeftOfSplit(centroids, mappings[best_axis], best_split)) - (indices.begin() + first);
+            }
+            else
+            {
+               // Everything ended up in one bin, or too deep. Fall back to a median split.
+               unsigned axis = 0;
+               if (extent.y > extent[axis])
+                  axis = 1;
+               if (extent.z > extent[axis])
+                  axis = 2;
+
+               half = count / 2;
+               nth_element(indices.begin() + first, indices.begin() + first + half,
+                     indices.begin() + first + count, CentroidLess(centroids, axis));
+            }
+
+            build_node(nodes, first, half, depth + 1, top);
+            unsigned right = build_node(nodes, first + half, count - half, depth + 1, top);
+
+            nodes[index].first = right;
+            nodes[index].count = 0;
+            return index;
+         }
+
+         // Copies the top of the tree into nodes depth-first, splicing in task subtrees.
+         void emit(const vector<BVHNode>& top, unsigned index, vector<BVHNode>& nodes) const
+         {
+            if (task_of[index] != ~0u)
+            {
+               const Task& task = tasks[task_of[index]];
+               unsigned offset = nodes.size();
+               for (unsigned i = 0; i < task.nodes.size(); i++)
+               {
+                  BVHNode node = task.nodes[i];
+                  if (!node.count)
+                     node.first += offset;
+                  nodes.push_back(node);
+               }
+               return;
+            }
+
+            unsigned at = nodes.size();
+            nodes.push_back(top[index]);
+            if (top[index].count)
+               return;
+
+            emit(top, index + 1, nodes);
+            nodes[at].first = nodes.size();
+            emit(top, top[index].first, nodes);
+         }
+   };
+
+   void World::build(Threading::ThreadPool *pool)
+   {
+      nodes.clear();
+      indices.clear();
+
+      merge_coplanar();
+      generation++;
+
+      if (polygons.empty())
+         return;
+
+      vector<vec3> centroids(polygons.size());
+      indices.resize(polygons.size());
+      for (unsigned i = 0; i < polygons.size(); i++)
+      {
+         const Polygon& poly = polygons[i];
+         PolygonVerts verts = polygon_verts(poly);
+         vec3 sum(0.0f);
+         for (unsigned j = 0; j < poly.count; j++)
+            sum += verts[j];
+         centroids[i] = sum / vec3(float(poly.count));
+         indices[i] = i;
+      }
+
+      BVHBuilder<Polygon> builder(polygons, centroids, indices, pool);
+      builder.build(nodes);
+   }
+
+   unsigned World::add_body(const vector<vec3>& vertices, unsigned material, const mat4& transform)
+   {
+      Body body;
+      body.shape = std1::shared_ptr<World>(new World());
+      for (unsigned i = 0; i + 2 < vertices.size(); i += 3)
+         body.shape->add_triangle(vertices[i + 0], vertices[i + 1], vertices[i + 2], material);
+      body.shape->build();
+
+      // Nothing to hit parks the body where no query can reach.
+      body.local_min = vec3(numeric_limits<float>::max());
+      body.local_max = vec3(numeric_limits<float>::max());
+      for (unsigned i = 0; i < body.shape->polygon_count(); i++)
+      {
+         const Polygon& poly = body.shape->get_polygon(i);
+         body.local_min = i ? min(body.local_min, poly.bb_min) : poly.bb_min;
+         body.local_max = i ? max(body.local_max, poly.bb_max) : poly.bb_max;
+      }
+
+      unsigned index = bodies.size();
+      bodies.push_back(body);
+      set_body_transform(index, transform);
+      bodies[index].previous = transform;
+
+      build_bodies();
+      return index;
+   }
+
+   static inline void update_body_bounds(Body& body)
+   {
+      transform_box(body.to_espace, body.local_min, body.local_max, body.bb_min, body.bb_max);
+   }
+
+   // Topology over bodies. Only needed when bodies are added.
+   void World::build_bodies()
+   {
+      vector<vec3> centroids(bodies.size());
+      body_indices.resize(bodies.size());
+      for (unsigned i = 0; i < bodies.size(); i++)
+      {
+         update_body_bounds(bodies[i]);
+         centroids[i] = (bodies[i].bb_min + bodies[i].bb_max) * vec3(0.5f);
+         body_indices[i] = i;
+      }
+
+      BVHBuilder<Body> builder(bodies, centroids, body_indices, NULL);
+      builder.build(body_nodes);
+   }
+
+   void World::refit()
+   {
+      for (unsigned i = 0; i < bodies.size(); i++)
+         update_body_bounds(bodies[i]);
+
+      // Children always come after their parent, so going backwards visits them first.
+      for (unsigned i = body_nodes.size(); i-- > 0; )
+      {
+         BVHNode& node = body_nodes[i];
+         if (node.count)
+         {
+            node.bb_min = bodies[body_indices[node.first]].bb_min;
+            node.bb_max = bodies[body_indices[node.first]].bb_max;
+            for (unsigned j = node.first + 1; j < node.first + node.count; j++)
+            {
+               node.bb_min = min(node.bb_min, bodies[body_indices[j]].bb_min);
+               node.bb_max = max(node.bb_max, bodies[body_indices[j]].bb_max);
+            }
+         }
+         else
+         {
+            node.bb_min = min(body_nodes[i + 1].bb_min, body_nodes[node.first].bb_min);
+            node.bb_max = max(body_nodes[i + 1].bb_max, body_nodes[node.first].bb_max);
+         }
+      }
+   }
+
+   // FNV-1a, over the bytes that make up the triangles.
+   static inline void hash_bytes(uint64_t& hash, const void *data, size_t size)
+   {
+      const uint8_t *bytes = static_cast<const uint8_t*>(data);
+      for (size_t i = 0; i < size; i++)
+      {
+         hash ^= bytes[i];
+         hash *= 1099511628211ull;
+      }
+   }
+
+   uint64_t World::source_hash() const
+   {
+      uint64_t hash = 14695981039346656037ull;
+      hash_bytes(hash, &ellipsoid, sizeof(ellipsoid));
+      for (unsigned i = 0; i < materials.size(); i++)
+      {
+         hash_bytes(hash, &positions[i * 3], 3 * sizeof(vec3));
+         hash_bytes(hash, &materials[i], sizeof(materials[i]));
+      }
+      return hash;
+   }
+
+   // Bump whenever the merge or the builder changes what they produce.
+   static const uint32_t serialize_magic = 0x42435753; // "SWCB"
+   static const uint32_t serialize_version = 2;
+
+   struct SerializeHeader
+   {
+      uint32_t magic;
+      uint32_t version;
+      uint32_t polygon_size, node_size; // Catches struct layout differences.
+      uint64_t hash;
+      uint32_t triangles, polygons, polygon_vertices, polygon_triangles, nodes, indices;
+   };
+
+   template<typename T>
+   static inline void append(vector<uint8_t>& data, const vector<T>& src)
+   {
+      if (src.empty())
+         return;
+      const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&src[0]);
+      data.insert(data.end(), bytes, bytes + src.size() * sizeof(T));
+   }
+
+   template<typename T>
+   static inline bool extract(const vector<uint8_t>& data, size_t& offset, vector<T>& dst, size_t count)
+   {
+      if (count > (data.size() - offset) / sizeof(T))
+         return false;
+      dst.resize(count);
+      if (count)
+         memcpy(static_cast<void*>(&dst[0]), &data[offset], count * sizeof(T));
+      offset += count * sizeof(T);
+      return true;
+   }
+
+   void World::serialize(vector<uint8_t>& data) const
+   {
+      SerializeHeader header;
+      memset(&header, 0, sizeof(header));
+      header.magic = serialize_magic;
+      header.version = serialize_version;
+      header.polygon_size = sizeof(Polygon);
+      header.node_size = sizeof(BVHNode);
+      header.hash = source_hash();
+      header.triangles = size();
+      header.polygons = polygons.size();
+      header.polygon_vertices = polygon_vertices.size();
+      header.polygon_triangles = polygon_triangles.size();
+      header.nodes = nodes.size();
+      header.indices = indices.size();
+
+      data.clear();
+      const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&header);
+      data.insert(data.end(), bytes, bytes + sizeof(header));
+      append(data, polygons);
+      append(data, polygon_vertices);
+      append(data, polygon_triangles);
+      append(data, nodes);
+      append(data, indices);
+   }
+
+   bool World::unserialize(const vector<uint8_t>& data)
+   {
+      SerializeHeader header;
+      if (data.size() < sizeof(header))
+         return false;
+      memcpy(&header, &data[0], sizeof(header));
+
+      if (header.magic != serialize_magic || header.version != serialize_version ||
+            header.polygon_size != sizeof(Polygon) || header.node_size != sizeof(BVHNode) ||
+            header.triangles != size() || header.hash != source_hash())
+         return false;
+
+      vector<Polygon> new_polygons;
+      vector<unsigned> new_polygon_vertices, new_polygon_triangles, new_indices;
+      vector<BVHNode> new_nodes;
+      size_t offset = sizeof(header);
+      if (!extract(data, offset, new_polygons, header.polygons) ||
+            !extract(data, offset, new_polygon_vertices, header.polygon_vertices) ||
+            !extract(data, offset, new_polygon_triangles, header.polygon_triangles) ||
+            !extract(data, offset, new_nodes, header.nodes) ||
+            !extract(data, offset, new_indices, header.indices) ||
+            offset != data.size())
+         return false;
+
+      // Don't trust indices from disk blindly.
+      for (unsigned i = 0; i < new_polygons.size(); i++)
+      {
+         const Polygon& poly = new_polygons[i];
+         if (poly.count < 3 || poly.count > Polygon::max_vertices || !poly.triangle_count ||
+               poly.first_vertex > new_polygon_vertices.size() ||
+               poly.count > new_polygon_vertices.size() - poly.first_vertex ||
+               poly.first_triangle > new_polygon_triangles.size() ||
+               poly.triangle_count > new_polygon_triangles.size() - poly.first_triangle)
+            return false;
+      }
+      for (unsigned i = 0; i < new_polygon_vertices.size(); i++)
+         if (new_polygon_vertices[i] >= positions.size())
+            return false;
+      for (unsigned i = 0; i < new_polygon_triangles.size(); i++)
+         if (new_polygon_triangles[i] >= size())
+            return false;
+      for (unsigned i = 0; i < new_indices.size(); i++)
+         if (new_indices[i] >= new_polygons.size())
+            return false;
+      // Children always come after their parent, so depths can be found in one pass.
+      // Anything deeper than the traversal stack allows is rejected, and rebuilt.
+      vector<unsigned> depths(new_nodes.size(), 0);
+      for (unsigned i = 0; i < new_nodes.size(); i++)
+      {
+         const BVHNode& node = new_nodes[i];
+         if (node.count ? node.first > new_indices.size() || node.count > new_indices.size() - node.first
+               : node.first <= i + 1 || node.first >= new_nodes.size())
+            return false;
+
+         if (node.count)
+            continue;
+         if (depths[i] >= bvh_max_depth)
+            return false;
+         depths[i + 1] = std::max(depths[i + 1], depths[i] + 1);
+         depths[node.first] = std::max(depths[node.first], depths[i] + 1);
+      }
+
+      polygons.swap(new_polygons);
+      polygon_vertices.swap(new_polygon_vertices);
+      polygon_triangles.swap(new_polygon_triangles);
+      nodes.swap(new_nodes);
+      indices.swap(new_indices);
+      generation++;
+      return true;
+   }
+}
+
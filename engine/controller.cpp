@@ -0,0 +1,194 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "controller.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include <cmath>
+#include <cstring>
+#include <cassert>
+
+using namespace glm;
+using namespace std;
+
+namespace Collision
+{
+   CharacterController::CharacterController(const vec3& pos) :
+      pos(pos),
+      gravity(0.0f),
+      can_jump(false)
+   {}
+
+   void CharacterController::set_pos(const vec3& pos)
+   {
+      this->pos = pos;
+      gravity = vec3(0.0f);
+   }
+
+   void CharacterController::save_state(ControllerState& state) const
+   {
+      memset(&state, 0, sizeof(state));
+      for (unsigned i = 0; i < 3; i++)
+      {
+         state.pos[i] = pos[i];
+         state.gravity[i] = gravity[i];
+      }
+      state.ground_body = last.ground_body;
+      state.can_jump = can_jump;
+      state.on_ground = last.on_ground;
+   }
+
+   void CharacterController::load_state(const ControllerState& state)
+   {
+      pos = vec3(state.pos[0], state.pos[1], state.pos[2]);
+      gravity = vec3(state.gravity[0], state.gravity[1], state.gravity[2]);
+      can_jump = state.can_jump;
+
+      // Only what step() looks at comes back, the rest is from the last move.
+      last = MoveResult();
+      last.on_ground = state.on_ground;
+      last.ground_body = state.ground_body;
+
+      // Gathering walks the hierarchy in a fixed order, so a fresh cache finds the same candidates.
+      cache.invalidate();
+   }
+
+   // At 60 steps per second, falling speeds up by 0.01 per step, a jump gives 0.3,
+   // and air drag takes away 1% per step.
+   static const float gravity_accel = 36.0f;
+   static const float jump_speed = 18.0f;
+   static const float drag_per_tick = 0.99f;
+   static const float tick_rate = 60.0f;
+
+   void CharacterController::step(const World& world, const ControllerInput& input, float dt)
+   {
+      gravity[1] -= gravity_accel * dt;
+      if (can_jump && input.jump)
+      {
+         gravity[1] += jump_speed;
+         can_jump = false;
+      }
+      gravity[1] *= std::pow(drag_per_tick, tick_rate * dt);
+
+      const vec3& ellipsoid = world.get_ellipsoid();
+      vec3 pos_espace = pos / ellipsoid;
+
+      // Ride along with whatever body we're standing on, before moving on our own.
+      // Done as a separate move, so being carried into a wall still collides.
+      if (last.on_ground && last.ground_body != ~0u)
+      {
+         vec3 carry = (world.body_motion(last.ground_body, pos) - pos) / ellipsoid;
+         vec3 no_fall(0.0f);
+         if (carry != vec3(0.0f))
+            world.move(pos_espace, carry, no_fall, cache);
+      }
+
+      vec3 fall = gravity * vec3(dt);
+      last = world.move(pos_espace, input.walk * vec3(dt) / ellipsoid, fall, cache);
+      if (last.on_ground)
+         can_jump = true;
+      if (last.on_ground || last.on_ceiling)
+         gravity = vec3(0.0f);
+
+      pos = pos_espace * ellipsoid;
+   }
+
+   struct BatchJob
+   {
+      const World *world;
+      CharacterController *controllers;
+      const ControllerInput *inputs;
+      float dt;
+   };
+
+   static void step_range(void *data, size_t begin, size_t end)
+   {
+      const BatchJob *job = static_cast<const BatchJob*>(data);
+      for (size_t i = begin; i < end; i++)
+         job->controllers[i].step(*job->world, job->inputs[i], job->dt);
+   }
+
+   void step_batch(const World& world,
+         CharacterController *controllers, const ControllerInput *inputs,
+         size_t count, float dt, Threading::ThreadPool *pool)
+   {
+      BatchJob job;
+      job.world = &world;
+      job.controllers = controllers;
+      job.inputs = inputs;
+      job.dt = dt;
+
+      if (pool)
+         pool->parallel_for(count, 32, step_range, &job);
+      else
+         step_range(&job, 0, count);
+   }
+
+   // Walks back and forth over a floor and a moving lift, jumping now and then.
+   static void replay(World& world, unsigned body, CharacterController& player,
+         unsigned first, unsigned count, vector<vec3>& path)
+   {
+      path.clear();
+      for (unsigned tick = first; tick < first + count; tick++)
+      {
+         float lift = 1.0f - std::cos(tick * 0.05f);
+         world.set_body_transform(body, translate(mat4(1.0f), vec3(0, lift, 0)));
+         world.refit();
+
+         ControllerInput input;
+         input.walk = vec3(std::sin(tick * 0.03f) * 4.0f, 0, 0);
+         input.jump = tick % 45 == 0;
+         player.step(world, input, 1.0f / 60.0f);
+         path.push_back(player.get_pos());
+      }
+   }
+
+   void test_controller_state()
+   {
+      World world;
+      world.set_ellipsoid(vec3(0.4f, 0.8f, 0.4f));
+      world.add_triangle(vec3(-10, 0, -10), vec3(-10, 0, 10), vec3(10, 0, -10));
+      world.add_triangle(vec3(10, 0, -10), vec3(-10, 0, 10), vec3(10, 0, 10));
+      world.build();
+
+      vector<vec3> slab;
+      slab.push_back(vec3(2, 0.5f, -2));
+      slab.push_back(vec3(2, 0.5f, 2));
+      slab.push_back(vec3(6, 0.5f, -2));
+      slab.push_back(vec3(6, 0.5f, -2));
+      slab.push_back(vec3(2, 0.5f, 2));
+      slab.push_back(vec3(6, 0.5f, 2));
+      unsigned body = world.add_body(slab, 0);
+
+      CharacterController player(vec3(3, 2, 0));
+      vector<vec3> path, replayed;
+      replay(world, body, player, 0, 100, path);
+
+      ControllerState state;
+      player.save_state(state);
+      replay(world, body, player, 100, 200, path);
+
+      player.load_state(state);
+      replay(world, body, player, 100, 200, replayed);
+      assert(path == replayed);
+
+      // Saving right after loading gives back the same bytes.
+      ControllerState again;
+      player.load_state(state);
+      player.save_state(again);
+      assert(memcmp(&again, &state, sizeof(state)) == 0);
+   }
+}
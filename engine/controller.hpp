@@ -0,0 +1,89 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTROLLER_HPP__
+#define CONTROLLER_HPP__
+
+#include "collision.hpp"
+#include "thread_pool.hpp"
+#include <cstddef>
+
+namespace Collision
+{
+   // What an agent wants to do this frame.
+   struct ControllerInput
+   {
+      ControllerInput() : walk(0.0f), jump(false) {}
+
+      glm::vec3 walk; // World space, units per second.
+      bool jump;      // Jump if standing on something.
+   };
+
+   // Everything a controller carries from one step to the next, as plain data.
+   // The contact cache is left out, it only makes gathering faster.
+   struct ControllerState
+   {
+      float pos[3];
+      float gravity[3];
+      uint32_t ground_body; // ~0u if not standing on a body.
+      uint8_t can_jump;
+      uint8_t on_ground;
+      uint8_t padding[2];
+   };
+
+   // Walking, jumping and falling for one agent. Standing on a moving body carries it along.
+   // Only reads the world, so any number of controllers can step against it at once.
+   class CharacterController
+   {
+      public:
+         CharacterController(const glm::vec3& pos = glm::vec3(0.0f));
+
+         // Advances by dt seconds. Tuned for steps of 1 / 60 s, but any fixed step works.
+         void step(const World& world, const ControllerInput& input, float dt);
+
+         const glm::vec3& get_pos() const { return pos; }
+         void set_pos(const glm::vec3& pos);
+
+         bool on_ground() const { return last.on_ground; }
+         const MoveResult& get_last_move() const { return last; }
+         const ContactCache& get_cache() const { return cache; }
+
+         // Restoring a saved state and stepping again gives bit for bit the same result.
+         void save_state(ControllerState& state) const;
+         void load_state(const ControllerState& state);
+
+      private:
+         glm::vec3 pos;     // World space.
+         glm::vec3 gravity; // Ellipsoid space, units per second.
+         bool can_jump;
+
+         ContactCache cache;
+         MoveResult last;
+   };
+
+   // Steps count controllers with their respective inputs, spread over pool.
+   // If pool is NULL, runs on the calling thread.
+   void step_batch(const World& world,
+         CharacterController *controllers, const ControllerInput *inputs,
+         std::size_t count, float dt, Threading::ThreadPool *pool);
+
+   // Checks that save, step, load, step replays exactly.
+   void test_controller_state();
+}
+
+#endif
+
@@ -0,0 +1,142 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gpu_timer.hpp"
+#include <cstdio>
+#include <cstring>
+
+// GLES only has timer queries through EXT_disjoint_timer_query, which libGLESv2 needn't export,
+// so they're looked up at runtime like everything is on desktop.
+#ifdef GLES
+#define TIMER_SYM(sym, ext_type) (::GL::symbol<ext_type>(#sym "EXT"))
+#define TIMER_ENUM(e) e##_EXT
+#else
+#define TIMER_SYM(sym, ext_type) SYM(sym)
+#define TIMER_ENUM(e) e
+#endif
+
+namespace GL
+{
+   GpuTimer::GpuTimer() : last_usec(0.0), valid(false)
+   {
+#ifdef HAVE_GPU_TIMER
+      TIMER_SYM(glGenQueries, PFNGLGENQUERIESEXTPROC)(latency, queries);
+      memset(pending, 0, sizeof(pending));
+      next = 0;
+      active = false;
+#endif
+   }
+
+   GpuTimer::~GpuTimer()
+   {
+#ifdef HAVE_GPU_TIMER
+      if (!dead_state)
+         TIMER_SYM(glDeleteQueries, PFNGLDELETEQUERIESEXTPROC)(latency, queries);
+#endif
+   }
+
+   bool GpuTimer::supported()
+   {
+#if defined(HAVE_GPU_TIMER) && defined(GLES)
+      const char *extensions = reinterpret_cast<const char*>(SYM(glGetString)(GL_EXTENSIONS));
+      return extensions && strstr(extensions, "GL_EXT_disjoint_timer_query");
+#elif defined(HAVE_GPU_TIMER)
+      const char *version = reinterpret_cast<const char*>(SYM(glGetString)(GL_VERSION));
+      unsigned major = 0, minor = 0;
+      if (version && sscanf(version, "%u.%u", &major, &minor) == 2 && (major > 3 || (major == 3 && minor >= 3)))
+         return true;
+
+      const char *extensions = reinterpret_cast<const char*>(SYM(glGetString)(GL_EXTENSIONS));
+      return extensions && strstr(extensions, "GL_ARB_timer_query");
+#else
+      return false;
+#endif
+   }
+
+#ifdef HAVE_GPU_TIMER
+   // Collects whatever has finished, oldest first, without waiting.
+   void GpuTimer::poll()
+   {
+      bool collected = false;
+      double usec = 0.0;
+      for (unsigned i = 0; i < latency; i++)
+      {
+         unsigned slot = (next + i) % latency;
+         if (!pending[slot])
+            continue;
+
+         GLint available = 0;
+         TIMER_SYM(glGetQueryObjectiv, PFNGLGETQUERYOBJECTIVEXTPROC)(queries[slot],
+               TIMER_ENUM(GL_QUERY_RESULT_AVAILABLE), &available);
+         if (!available)
+            break;
+
+         GLuint64 ns = 0;
+         TIMER_SYM(glGetQueryObjectui64v, PFNGLGETQUERYOBJECTUI64VEXTPROC)(queries[slot],
+               TIMER_ENUM(GL_QUERY_RESULT), &ns);
+         pending[slot] = false;
+         usec = ns / 1000.0;
+         collected = true;
+      }
+
+#ifdef GLES
+      // Something like a clock change made the results meaningless. Reading the flag clears it.
+      GLint disjoint = 0;
+      SYM(glGetIntegerv)(GL_GPU_DISJOINT_EXT, &disjoint);
+      if (disjoint)
+         return;
+#endif
+
+      if (collected)
+      {
+         last_usec = usec;
+         valid = true;
+      }
+   }
+#endif
+
+   void GpuTimer::begin()
+   {
+#ifdef HAVE_GPU_TIMER
+      poll();
+
+      // If the GPU is that far behind, skip a frame rather than wait for it.
+      active = !pending[next];
+      if (active)
+         TIMER_SYM(glBeginQuery, PFNGLBEGINQUERYEXTPROC)(TIMER_ENUM(GL_TIME_ELAPSED), queries[next]);
+#endif
+   }
+
+   void GpuTimer::end()
+   {
+#ifdef HAVE_GPU_TIMER
+      if (!active)
+         return;
+
+      TIMER_SYM(glEndQuery, PFNGLENDQUERYEXTPROC)(TIMER_ENUM(GL_TIME_ELAPSED));
+      pending[next] = true;
+      next = (next + 1) % latency;
+      active = false;
+#endif
+   }
+
+   bool GpuTimer::result(double& usec) const
+   {
+      usec = last_usec;
+      return valid;
+   }
+}
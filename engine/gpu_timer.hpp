@@ -0,0 +1,72 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GPU_TIMER_HPP__
+#define GPU_TIMER_HPP__
+
+#include "gl.hpp"
+
+#if defined(GLES) && !defined(IOS)
+#include <GLES2/gl2ext.h>
+#endif
+
+#if defined(GLES)
+#if defined(GL_EXT_disjoint_timer_query)
+#define HAVE_GPU_TIMER
+#endif
+#elif defined(GL_TIME_ELAPSED)
+#define HAVE_GPU_TIMER
+#endif
+
+namespace GL
+{
+   // Times GPU work with timer queries (GL 3.3 or ARB_timer_query, EXT_disjoint_timer_query on GLES).
+   // Results are read back a few frames late, so the CPU never waits on the GPU.
+   class GpuTimer
+   {
+      public:
+         GpuTimer();
+         ~GpuTimer();
+
+         // Needs a current context.
+         static bool supported();
+
+         // Around the work to time, once per frame. Timers can't nest.
+         void begin();
+         void end();
+
+         // Time of the most recent frame which has finished on the GPU.
+         bool result(double& usec) const;
+
+      private:
+         enum { latency = 4 };
+#ifdef HAVE_GPU_TIMER
+         GLuint queries[latency];
+         bool pending[latency];
+         unsigned next;
+         bool active;
+         void poll();
+#endif
+         double last_usec;
+         bool valid;
+
+         GpuTimer(const GpuTimer&);
+         void operator=(const GpuTimer&);
+   };
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "input_trace.hpp"
+#include "util.hpp"
+#include <cstring>
+
+using namespace std;
+
+namespace Input
+{
+   struct TraceHeader
+   {
+      uint32_t magic;
+      uint32_t version;
+      uint32_t frame_size;
+      uint32_t physics_hz;
+      uint32_t frames;
+   };
+
+   static const uint32_t trace_magic = 0x4e495753; // "SWIN"
+   static const uint32_t trace_version = 1;
+
+   Trace::Trace() : physics_hz(0)
+   {}
+
+   void Trace::record(size_t index, const Frame& frame)
+   {
+      if (index < frames.size())
+         frames.resize(index);
+      frames.push_back(frame);
+   }
+
+   bool Trace::get(size_t index, Frame& frame) const
+   {
+      if (index >= frames.size())
+         return false;
+      frame = frames[index];
+      return true;
+   }
+
+   bool Trace::load(const string& path)
+   {
+      vector<uint8_t> data;
+      if (!File::read(path, data) || data.size() < sizeof(TraceHeader))
+         return false;
+
+      TraceHeader header;
+      memcpy(&header, &data[0], sizeof(header));
+      if (header.magic != trace_magic || header.version != trace_version ||
+            header.frame_size != sizeof(Frame) ||
+            (data.size() - sizeof(header)) / sizeof(Frame) != header.frames)
+         return false;
+
+      frames.resize(header.frames);
+      if (header.frames)
+         memcpy(&frames[0], &data[sizeof(header)], header.frames * sizeof(Frame));
+      physics_hz = header.physics_hz;
+      return true;
+   }
+
+   bool Trace::save(const string& path) const
+   {
+      TraceHeader header;
+      header.magic = trace_magic;
+      header.version = trace_version;
+      header.frame_size = sizeof(Frame);
+      header.physics_hz = physics_hz;
+      header.frames = frames.size();
+
+      vector<uint8_t> data(sizeof(header) + frames.size() * sizeof(Frame));
+      memcpy(&data[0], &header, sizeof(header));
+      if (!frames.empty())
+         memcpy(&data[sizeof(header)], &frames[0], frames.size() * sizeof(Frame));
+      return File::write(path, data);
+   }
+}
+
@@ -0,0 +1,70 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INPUT_TRACE_HPP__
+#define INPUT_TRACE_HPP__
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+namespace Input
+{
+   // Pad state for one frame, and how long the frame was.
+   // Together with the starting state, this decides everything the simulation does.
+   struct Frame
+   {
+      uint32_t usec;
+      int16_t analog[4]; // Left x, left y, right x, right y.
+      uint16_t buttons;  // Bit n is RETRO_DEVICE_ID_JOYPAD n.
+      uint16_t padding;
+
+      bool pressed(unsigned id) const { return buttons & (1u << id); }
+   };
+
+   // Frames of input, kept in memory and saved to or loaded from a file.
+   class Trace
+   {
+      public:
+         Trace();
+
+         // Records a frame at index, dropping anything after it.
+         // Rewinding or loading a savestate while recording just continues from there.
+         void record(std::size_t index, const Frame& frame);
+
+         // False past the end.
+         bool get(std::size_t index, Frame& frame) const;
+
+         std::size_t size() const { return frames.size(); }
+         void clear() { frames.clear(); }
+
+         // Physics rate the trace was recorded at. Replays only match at the same rate.
+         unsigned get_physics_hz() const { return physics_hz; }
+         void set_physics_hz(unsigned hz) { physics_hz = hz; }
+
+         bool load(const std::string& path);
+         bool save(const std::string& path) const;
+
+      private:
+         std::vector<Frame> frames;
+         unsigned physics_hz;
+   };
+}
+
+#endif
+
@@ -0,0 +1,91 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "memory.hpp"
+#include "shared.hpp"
+
+namespace Memory
+{
+   static Counter counters[CATEGORY_COUNT];
+   static Counter sum;
+
+   static const char *names[CATEGORY_COUNT] = {
+      "geometry_cpu",
+      "geometry_gpu",
+      "texture_rgba8",
+      "texture_compressed",
+      "texture_mipmaps",
+      "collision",
+      "loader",
+   };
+
+   void add(Category category, size_t bytes)
+   {
+      Counter& counter = counters[category];
+      counter.current += bytes;
+      if (counter.current > counter.peak)
+         counter.peak = counter.current;
+
+      sum.current += bytes;
+      if (sum.current > sum.peak)
+         sum.peak = sum.current;
+   }
+
+   void sub(Category category, size_t bytes)
+   {
+      counters[category].current -= bytes;
+      sum.current -= bytes;
+   }
+
+   const char *name(Category category)
+   {
+      return names[category];
+   }
+
+   const Counter& counter(Category category)
+   {
+      return counters[category];
+   }
+
+   const Counter& total()
+   {
+      return sum;
+   }
+
+   void reset_peaks()
+   {
+      for (unsigned i = 0; i < CATEGORY_COUNT; i++)
+         counters[i].peak = counters[i].current;
+      sum.peak = sum.current;
+   }
+
+   static double mb(size_t bytes)
+   {
+      return bytes / (1024.0 * 1024.0);
+   }
+
+   void log_report()
+   {
+      if (!log_cb)
+         return;
+
+      log_cb(RETRO_LOG_INFO, "Memory: %.2f MB, peak %.2f MB.\n", mb(sum.current), mb(sum.peak));
+      for (unsigned i = 0; i < CATEGORY_COUNT; i++)
+         log_cb(RETRO_LOG_INFO, "   %-20s %9.2f MB, peak %9.2f MB.\n",
+               names[i], mb(counters[i].current), mb(counters[i].peak));
+   }
+}
@@ -0,0 +1,105 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEMORY_HPP__
+#define MEMORY_HPP__
+
+#include <cstddef>
+
+// Byte counters for the big allocations, by what they are for.
+// Nothing is intercepted, owners report what they hold, so the counts are estimates
+// of the payload (GPU sizes in particular, drivers add their own overhead).
+// Not thread safe, only count from the main thread.
+
+namespace Memory
+{
+   enum Category
+   {
+      GEOMETRY_CPU,       // Vertices and indices kept on the CPU after upload.
+      GEOMETRY_GPU,       // Vertex and index buffers.
+      TEXTURE_RGBA8,      // Uncompressed textures, top level.
+      TEXTURE_COMPRESSED, // DDS textures, all levels in the file.
+      TEXTURE_MIPMAPS,    // Levels generated by the driver.
+      COLLISION,          // Triangles, polygons and hierarchies.
+      LOADER,             // Parsing and decoding temporaries.
+      CATEGORY_COUNT
+   };
+
+   struct Counter
+   {
+      size_t current;
+      size_t peak;
+   };
+
+   void add(Category category, size_t bytes);
+   void sub(Category category, size_t bytes);
+
+   const char *name(Category category);
+   const Counter& counter(Category category);
+
+   // Over all categories. The peak is of the sum, not the sum of peaks.
+   const Counter& total();
+
+   // Forgets the peaks, e.g. to see what one load costs.
+   void reset_peaks();
+
+   // Current and peak per category, through log_cb.
+   void log_report();
+
+   // Bytes held by one object. Follows it as it grows and shrinks, and gives them back when destroyed.
+   class Allocation
+   {
+      public:
+         Allocation(Category category, size_t bytes = 0) : category(category), bytes(0) { set(bytes); }
+         Allocation(const Allocation& other) : category(other.category), bytes(0) { set(other.bytes); }
+         ~Allocation() { set(0); }
+
+         Allocation& operator=(const Allocation& other)
+         {
+            if (this != &other)
+            {
+               set(other.category, other.bytes);
+            }
+            return *this;
+         }
+
+         void set(size_t bytes)
+         {
+            if (bytes > this->bytes)
+               add(category, bytes - this->bytes);
+            else
+               sub(category, this->bytes - bytes);
+            this->bytes = bytes;
+         }
+
+         // Moves to another category, e.g. once a texture's format is known.
+         void set(Category category, size_t bytes)
+         {
+            set(0);
+            this->category = category;
+            set(bytes);
+         }
+
+         size_t size() const { return bytes; }
+
+      private:
+         Category category;
+         size_t bytes;
+   };
+}
+
+#endif
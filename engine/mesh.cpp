@@ -16,6 +16,8 @@
  */
 
 #include "mesh.hpp"
+#include "profiler.hpp"
+#include <cstring>
 
 using namespace glm;
 using namespace std;
@@ -24,7 +26,26 @@ using namespace std1;
 namespace GL
 {
    Mesh::Mesh() : 
+      ibo(0),
+      depth_vbo(0),
+      depth_stream(false),
       vertex_type(GL_TRIANGLES),
+      vertex_count(0),
+      index_type(GL_UNSIGNED_SHORT),
+      lod(0),
+      lod_threshold(0.0f),
+      bounds_center(0.0f),
+      bounds_radius(0.0f),
+      uploaded(false),
+      requested_format(VERTEX_FLOAT),
+      format(VERTEX_FLOAT),
+      pos_scale(1.0f),
+      pos_offset(0.0f),
+      tex_scale(1.0f),
+      tex_offset(0.0f),
+      cpu_memory(Memory::GEOMETRY_CPU),
+      gpu_memory(Memory::GEOMETRY_GPU),
+      features(0),
       light_pos(0, 10, 0),
       light_ambient(0.25f, 0.25f, 0.25f),
       model(mat4(1.0)),
@@ -41,6 +62,10 @@ namespace GL
          return;
 
       SYM(glDeleteBuffers)(1, &vbo);
+      if (ibo)
+         SYM(glDeleteBuffers)(1, &ibo);
+      if (depth_vbo)
+         SYM(glDeleteBuffers)(1, &depth_vbo);
    }
 
    void Mesh::set_vertices(vector<Vertex> vertex)
@@ -53,6 +78,95 @@ namespace GL
       vertex_type = type;
    }
 
+   void Mesh::set_vertex_format(VertexFormat format)
+   {
+      requested_format = format;
+   }
+
+   void Mesh::set_depth_stream(bool enable)
+   {
+      depth_stream = enable;
+   }
+
+   // Positions snap to one grid for every mesh, so vertices shared between meshes stay shared
+   // and no cracks open up. About a millimetre for scenes in metres, which limits packed meshes
+   // to 64 units across. Texture coordinates only need to be precise to 1/8 texel at 512x512.
+   static const float pos_step = 1.0f / 1024.0f;
+   static const float max_tex_step = 1.0f / 4096.0f;
+
+   static inline uint16_t quantize(float v, float offset, float scale)
+   {
+      float q = scale > 0.0f ? (v - offset) / scale : 0.0f;
+      return uint16_t(clamp(q, 0.0f, 1.0f) * 65535.0f + 0.5f);
+   }
+
+   static inline uint16_t quantize_grid(float v, float offset)
+   {
+      return uint16_t(clamp(floor((v - offset) / pos_step + 0.5f), 0.0f, 65535.0f));
+   }
+
+   static inline int8_t quantize_snorm(float v)
+   {
+      return int8_t(floor(clamp(v, -1.0f, 1.0f) * 127.0f + 0.5f));
+   }
+
+   bool Mesh::pack(vector<PackedVertex>& packed)
+   {
+      if (vertex->empty())
+         return false;
+
+      vec3 pos_min = (*vertex)[0].vert, pos_max = pos_min;
+      vec2 tex_min = (*vertex)[0].tex, tex_max = tex_min;
+      for (unsigned i = 1; i < vertex->size(); i++)
+      {
+         const Vertex& v = (*vertex)[i];
+         pos_min = min(pos_min, v.vert);
+         pos_max = max(pos_max, v.vert);
+         tex_min = min(tex_min, v.tex);
+         tex_max = max(tex_max, v.tex);
+      }
+
+      pos_min = floor(pos_min / pos_step) * pos_step;
+      vec3 pos_extent = pos_max - pos_min;
+      vec2 tex_extent = tex_max - tex_min;
+      float pos_size = std::max(std::max(pos_extent.x, pos_extent.y), pos_extent.z);
+      float tex_step = std::max(tex_extent.x, tex_extent.y) / 65535.0f;
+      if (pos_size / pos_step > 65535.0f || tex_step > max_tex_step)
+      {
+         if (log_cb)
+            log_cb(RETRO_LOG_INFO, "Mesh: Too large to pack (%.1f units, %.6f per texture step), keeping floats.\n",
+                  pos_size, tex_step);
+         return false;
+      }
+
+      packed.resize(vertex->size());
+      for (unsigned i = 0; i < vertex->size(); i++)
+      {
+         const Vertex& v = (*vertex)[i];
+         PackedVertex& p = packed[i];
+
+         for (unsigned c = 0; c < 3; c++)
+            p.vert[c] = quantize_grid(v.vert[c], pos_min[c]);
+         p.vert[3] = 0;
+
+         // Only the direction matters, the shader normalizes.
+         float len = length(v.normal);
+         vec3 normal = len > 0.0f ? v.normal / len : vec3(0.0f);
+         for (unsigned c = 0; c < 3; c++)
+            p.normal[c] = quantize_snorm(normal[c]);
+         p.normal[3] = 0;
+
+         for (unsigned c = 0; c < 2; c++)
+            p.tex[c] = quantize(v.tex[c], tex_min[c], tex_extent[c]);
+      }
+
+      pos_scale = vec3(65535.0f * pos_step);
+      pos_offset = pos_min;
+      tex_scale = tex_extent;
+      tex_offset = tex_min;
+      return true;
+   }
+
    void Mesh::set_light_pos(const glm::vec3& light_pos)
    {
       this->light_pos = light_pos;
@@ -63,14 +177,172 @@ namespace GL
       this->eye_pos = eye_pos;
    }
 
+   void Mesh::set_vertices(const std1::shared_ptr<vector<Vertex> >& vertex,
+         const std1::shared_ptr<vector<uint32_t> >& indices)
+   {
+#ifdef GLES
+      if (vertex->size() > 0x10000)
+      {
+         std1::shared_ptr<vector<Vertex> > expanded(new vector<Vertex>(indices->size()));
+         for (size_t i = 0; i < indices->size(); i++)
+            (*expanded)[i] = (*vertex)[(*indices)[i]];
+         set_vertices(expanded);
+         return;
+      }
+#endif
+
+      set_vertices(vertex);
+      this->indices = indices;
+      LodLevel full = { 0, GLsizei(indices->size()), 0.0f };
+      lods.assign(1, full);
+
+      size_t bytes;
+      if (!ibo)
+         SYM(glGenBuffers)(1, &ibo);
+      SYM(glBindBuffer)(GL_ELEMENT_ARRAY_BUFFER, ibo);
+
+      if (vertex->size() <= 0x10000)
+      {
+         vector<uint16_t> shorts(indices->begin(), indices->end());
+         index_type = GL_UNSIGNED_SHORT;
+         bytes = shorts.size() * sizeof(uint16_t);
+         SYM(glBufferData)(GL_ELEMENT_ARRAY_BUFFER, bytes, &shorts[0], GL_STATIC_DRAW);
+      }
+      else
+      {
+         index_type = GL_UNSIGNED_INT;
+         bytes = indices->size() * sizeof(uint32_t);
+         SYM(glBufferData)(GL_ELEMENT_ARRAY_BUFFER, bytes, &(*indices)[0], GL_STATIC_DRAW);
+      }
+
+      uploaded = uploaded && SYM(glGetError)() == GL_NO_ERROR;
+      SYM(glBindBuffer)(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+      cpu_memory.set(cpu_memory.size() + indices->capacity() * sizeof(uint32_t));
+      gpu_memory.set(gpu_memory.size() + bytes);
+   }
+
    void Mesh::set_vertices(const std1::shared_ptr<vector<Vertex> >& vertex)
    {
       this->vertex = vertex;
+      vertex_count = vertex->size();
+      indices.reset();
+      lods.clear();
+      lod = 0;
+
+      vec3 bounds_min(0.0f), bounds_max(0.0f);
+      for (unsigned i = 0; i < vertex->size(); i++)
+      {
+         bounds_min = i ? min(bounds_min, (*vertex)[i].vert) : (*vertex)[i].vert;
+         bounds_max = i ? max(bounds_max, (*vertex)[i].vert) : (*vertex)[i].vert;
+      }
+      bounds_center = (bounds_min + bounds_max) * 0.5f;
+      bounds_radius = length(bounds_max - bounds_center);
+
+      PROFILE_ZONE("upload");
+      format = VERTEX_FLOAT;
+      pos_scale = vec3(1.0f);
+      pos_offset = vec3(0.0f);
+      tex_scale = vec2(1.0f);
+      tex_offset = vec2(0.0f);
+
+      vector<PackedVertex> packed;
+      if (requested_format == VERTEX_PACKED && pack(packed))
+         format = VERTEX_PACKED;
+
+      size_t bytes = format == VERTEX_PACKED ?
+         packed.size() * sizeof(PackedVertex) : vertex->size() * sizeof(Vertex);
+      const void *data = format == VERTEX_PACKED ?
+         static_cast<const void*>(&packed[0]) : static_cast<const void*>(&(*vertex)[0]);
 
       SYM(glBindBuffer)(GL_ARRAY_BUFFER, vbo);
-      SYM(glBufferData)(GL_ARRAY_BUFFER, vertex->size() * sizeof(Vertex),
-            &(*vertex)[0], GL_STATIC_DRAW);
+      SYM(glBufferData)(GL_ARRAY_BUFFER, bytes, data, GL_STATIC_DRAW);
+      // Out of memory is the one to worry about. Errors from before only make us keep the copy.
+      uploaded = SYM(glGetError)() == GL_NO_ERROR;
       SYM(glBindBuffer)(GL_ARRAY_BUFFER, 0);
+
+      cpu_memory.set(vertex->capacity() * sizeof(Vertex));
+      gpu_memory.set(bytes);
+
+      if (!depth_stream)
+         return;
+
+      // In the same format as the main stream, so both passes come up with the same depth.
+      vector<vec3> positions;
+      vector<uint16_t> packed_positions;
+      if (format == VERTEX_PACKED)
+      {
+         packed_positions.resize(packed.size() * 4);
+         for (unsigned i = 0; i < packed.size(); i++)
+            memcpy(&packed_positions[i * 4], packed[i].vert, sizeof(packed[i].vert));
+         bytes = packed_positions.size() * sizeof(uint16_t);
+         data = &packed_positions[0];
+      }
+      else
+      {
+         positions.resize(vertex->size());
+         for (unsigned i = 0; i < vertex->size(); i++)
+            positions[i] = (*vertex)[i].vert;
+         bytes = positions.size() * sizeof(vec3);
+         data = &positions[0];
+      }
+
+      if (!depth_vbo)
+         SYM(glGenBuffers)(1, &depth_vbo);
+      SYM(glBindBuffer)(GL_ARRAY_BUFFER, depth_vbo);
+      SYM(glBufferData)(GL_ARRAY_BUFFER, bytes, data, GL_STATIC_DRAW);
+      uploaded = uploaded && SYM(glGetError)() == GL_NO_ERROR;
+      SYM(glBindBuffer)(GL_ARRAY_BUFFER, 0);
+
+      gpu_memory.set(gpu_memory.size() + bytes);
+   }
+
+   void Mesh::set_lods(const vector<LodLevel>& lods)
+   {
+      if (!this->lods.empty() && !lods.empty())
+         this->lods = lods;
+   }
+
+   void Mesh::set_lod_threshold(float threshold)
+   {
+      lod_threshold = threshold;
+   }
+
+   // The coarsest level which is fine from the nearest point of the bounds.
+   unsigned Mesh::select_lod() const
+   {
+      if (lods.size() < 2 || lod_threshold <= 0.0f)
+         return 0;
+
+      vec3 center = vec3(model * vec4(bounds_center, 1.0f));
+      float distance = std::max(length(center - eye_pos) - bounds_radius, 0.0f);
+      float max_error = lod_threshold * distance;
+
+      unsigned level = 0;
+      while (level + 1 < lods.size() && lods[level + 1].error <= max_error)
+         level++;
+      return level;
+   }
+
+   bool Mesh::is_transparent() const
+   {
+      return material.alpha_mod < 1.0f || (material.diffuse_map && material.diffuse_map->has_alpha());
+   }
+
+   float Mesh::get_view_depth() const
+   {
+      return -(view * model * vec4(bounds_center, 1.0f)).z;
+   }
+
+   bool Mesh::release_vertices()
+   {
+      if (!uploaded)
+         return false;
+
+      vertex.reset();
+      indices.reset();
+      cpu_memory.set(0);
+      return true;
    }
 
    void Mesh::set_material(const Material& material)
@@ -78,14 +350,44 @@ namespace GL
       this->material = material;
    }
 
-   void Mesh::set_blank(const std1::shared_ptr<Texture>& blank)
+   unsigned shader_features(const Material& material)
+   {
+      unsigned features = 0;
+      if (material.diffuse_map)
+         features |= SHADER_DIFFUSE_MAP;
+      if (material.ambient_map && material.ambient_map != material.diffuse_map)
+         features |= SHADER_AMBIENT_MAP;
+      if ((material.diffuse_map && material.diffuse_map->has_alpha()) ||
+            (material.ambient_map && material.ambient_map->has_alpha()))
+         features |= SHADER_TEXTURE_ALPHA;
+      if (material.specular != vec3(0.0f))
+         features |= SHADER_SPECULAR;
+      if (material.alpha_mod != 1.0f)
+         features |= SHADER_ALPHA_MOD;
+      return features;
+   }
+
+   vector<string> shader_feature_names()
+   {
+      static const char *names[] = {
+         "DIFFUSE_MAP",
+         "AMBIENT_MAP",
+         "TEXTURE_ALPHA",
+         "SPECULAR",
+         "ALPHA_MOD",
+      };
+      return vector<string>(names, names + sizeof(names) / sizeof(names[0]));
+   }
+
+   void Mesh::set_depth_shader(const std1::shared_ptr<Shader>& shader)
    {
-      this->blank = blank;
+      depth_shader = shader;
    }
 
-   void Mesh::set_shader(const std1::shared_ptr<Shader>& shader)
+   void Mesh::set_shader_cache(const std1::shared_ptr<ShaderCache>& shaders)
    {
-      this->shader = shader;
+      features = shader_features(material);
+      shader = shaders->get(features);
    }
 
    void Mesh::set_model(const mat4& model)
@@ -106,45 +408,102 @@ namespace GL
       mvp = projection * view * model;
    }
 
+   void Mesh::draw()
+   {
+      if (!lods.empty())
+      {
+         lod = select_lod();
+         size_t index_size = index_type == GL_UNSIGNED_INT ? sizeof(uint32_t) : sizeof(uint16_t);
+
+         SYM(glBindBuffer)(GL_ELEMENT_ARRAY_BUFFER, ibo);
+         SYM(glDrawElements)(vertex_type, lods[lod].count, index_type,
+               reinterpret_cast<const GLvoid*>(lods[lod].first * index_size));
+         SYM(glBindBuffer)(GL_ELEMENT_ARRAY_BUFFER, 0);
+      }
+      else
+         SYM(glDrawArrays)(vertex_type, 0, vertex_count);
+   }
+
+   void Mesh::render_depth()
+   {
+      if (!vertex_count || !depth_vbo || !depth_shader)
+         return;
+
+      PROFILE_ZONE("mesh_depth");
+
+      depth_shader->use();
+      SYM(glUniformMatrix4fv)(depth_shader->uniform("uMVP"),
+            1, GL_FALSE, value_ptr(mvp));
+      SYM(glUniform3fv)(depth_shader->uniform("uPosScale"),
+            1, value_ptr(pos_scale));
+      SYM(glUniform3fv)(depth_shader->uniform("uPosOffset"),
+            1, value_ptr(pos_offset));
+
+      GLint aVertex = depth_shader->attrib("aVertex");
+      bool packed = format == VERTEX_PACKED;
+
+      SYM(glBindBuffer)(GL_ARRAY_BUFFER, depth_vbo);
+      if (aVertex >= 0)
+      {
+         SYM(glEnableVertexAttribArray)(aVertex);
+         SYM(glVertexAttribPointer)(aVertex, 3, packed ? GL_UNSIGNED_SHORT : GL_FLOAT,
+               packed ? GL_TRUE : GL_FALSE, packed ? 4 * sizeof(uint16_t) : sizeof(vec3), 0);
+      }
+
+      draw();
+
+      if (aVertex >= 0)
+         SYM(glDisableVertexAttribArray)(aVertex);
+      SYM(glBindBuffer)(GL_ARRAY_BUFFER, 0);
+      Shader::unbind();
+   }
+
    void Mesh::render()
    {
-      if (!vertex || !shader)
+      if (!vertex_count || !shader)
          return;
 
-      if (material.diffuse_map)
-         material.diffuse_map->bind(0);
-      else if (blank)
-         blank->bind(0);
+      PROFILE_ZONE("mesh");
 
-      if (material.ambient_map)
+      // Only what the variant samples.
+      if (features & SHADER_DIFFUSE_MAP)
+         material.diffuse_map->bind(0);
+      if (features & SHADER_AMBIENT_MAP)
          material.ambient_map->bind(1);
-      else if (material.diffuse_map)
-         material.diffuse_map->bind(1);
-      else if (blank)
-         blank->bind(1);
 
       shader->use();
 
-      SYM(glUniform1i)(shader->uniform("sDiffuse"), 0);
-      SYM(glUniform1i)(shader->uniform("sAmbient"), 1);
+      if (features & SHADER_DIFFUSE_MAP)
+         SYM(glUniform1i)(shader->uniform("sDiffuse"), 0);
+      if (features & SHADER_AMBIENT_MAP)
+         SYM(glUniform1i)(shader->uniform("sAmbient"), 1);
 
       SYM(glUniformMatrix4fv)(shader->uniform("uModel"),
             1, GL_FALSE, value_ptr(model));
       SYM(glUniformMatrix4fv)(shader->uniform("uMVP"),
             1, GL_FALSE, value_ptr(mvp));
-      SYM(glUniform3fv)(shader->uniform("uEyePos"),
-            1, value_ptr(eye_pos));
-
-      SYM(glUniform3fv)(shader->uniform("uMTLAmbient"),
-            1, value_ptr(material.ambient));
-      SYM(glUniform3fv)(shader->uniform("uMTLDiffuse"),
-            1, value_ptr(material.diffuse));
-      SYM(glUniform3fv)(shader->uniform("uMTLSpecular"),
-            1, value_ptr(material.specular));
-      SYM(glUniform1f)(shader->uniform("uMTLSpecularPower"),
-            material.specular_power);
-      SYM(glUniform1f)(shader->uniform("uMTLAlphaMod"),
-            material.alpha_mod);
+
+      if (features & SHADER_TEXTURE_ALPHA)
+      {
+         SYM(glUniform3fv)(shader->uniform("uMTLAmbient"),
+               1, value_ptr(material.ambient));
+         SYM(glUniform3fv)(shader->uniform("uMTLDiffuse"),
+               1, value_ptr(material.diffuse));
+      }
+
+      if (features & SHADER_SPECULAR)
+      {
+         SYM(glUniform3fv)(shader->uniform("uEyePos"),
+               1, value_ptr(eye_pos));
+         SYM(glUniform3fv)(shader->uniform("uMTLSpecular"),
+               1, value_ptr(material.specular));
+         SYM(glUniform1f)(shader->uniform("uMTLSpecularPower"),
+               material.specular_power);
+      }
+
+      if (features & SHADER_ALPHA_MOD)
+         SYM(glUniform1f)(shader->uniform("uMTLAlphaMod"),
+               material.alpha_mod);
 
       SYM(glUniform3fv)(shader->uniform("uLightPos"),
             1, value_ptr(light_pos));
@@ -152,6 +511,15 @@ namespace GL
       SYM(glUniform3fv)(shader->uniform("uLightAmbient"),
             1, value_ptr(light_ambient));
 
+      SYM(glUniform3fv)(shader->uniform("uPosScale"),
+            1, value_ptr(pos_scale));
+      SYM(glUniform3fv)(shader->uniform("uPosOffset"),
+            1, value_ptr(pos_offset));
+      SYM(glUniform2fv)(shader->uniform("uTexScale"),
+            1, value_ptr(tex_scale));
+      SYM(glUniform2fv)(shader->uniform("uTexOffset"),
+            1, value_ptr(tex_offset));
+
 
       GLint aVertex = shader->attrib("aVertex");
       GLint aNormal = shader->attrib("aNormal");
@@ -159,31 +527,34 @@ namespace GL
 
       SYM(glBindBuffer)(GL_ARRAY_BUFFER, vbo);
 
+      bool packed = format == VERTEX_PACKED;
+      GLsizei stride = packed ? sizeof(PackedVertex) : sizeof(Vertex);
+
       if (aVertex >= 0)
       {
          SYM(glEnableVertexAttribArray)(aVertex);
-         SYM(glVertexAttribPointer)(aVertex, 3, GL_FLOAT,
-               GL_FALSE, sizeof(Vertex),
-               reinterpret_cast<const GLvoid*>(offsetof(Vertex, vert)));
+         SYM(glVertexAttribPointer)(aVertex, 3, packed ? GL_UNSIGNED_SHORT : GL_FLOAT,
+               packed ? GL_TRUE : GL_FALSE, stride,
+               reinterpret_cast<const GLvoid*>(packed ? offsetof(PackedVertex, vert) : offsetof(Vertex, vert)));
       }
 
       if (aNormal >= 0)
       {
          SYM(glEnableVertexAttribArray)(aNormal);
-         SYM(glVertexAttribPointer)(aNormal, 3, GL_FLOAT,
-               GL_FALSE, sizeof(Vertex),
-               reinterpret_cast<const GLvoid*>(offsetof(Vertex, normal)));
+         SYM(glVertexAttribPointer)(aNormal, 3, packed ? GL_BYTE : GL_FLOAT,
+               packed ? GL_TRUE : GL_FALSE, stride,
+               reinterpret_cast<const GLvoid*>(packed ? offsetof(PackedVertex, normal) : offsetof(Vertex, normal)));
       }
 
       if (aTex >= 0)
       {
          SYM(glEnableVertexAttribArray)(aTex);
-         SYM(glVertexAttribPointer)(aTex, 2, GL_FLOAT,
-               GL_FALSE, sizeof(Vertex),
-               reinterpret_cast<const GLvoid*>(offsetof(Vertex, tex)));
+         SYM(glVertexAttribPointer)(aTex, 2, packed ? GL_UNSIGNED_SHORT : GL_FLOAT,
+               packed ? GL_TRUE : GL_FALSE, stride,
+               reinterpret_cast<const GLvoid*>(packed ? offsetof(PackedVertex, tex) : offsetof(Vertex, tex)));
       }
 
-      SYM(glDrawArrays)(vertex_type, 0, vertex->size());
+      draw();
 
       if (aVertex >= 0)
          SYM(glDisableVertexAttribArray)(aVertex);
@@ -194,8 +565,10 @@ namespace GL
 
       SYM(glBindBuffer)(GL_ARRAY_BUFFER, 0);
 
-      Texture::unbind(0);
-      Texture::unbind(1);
+      if (features & SHADER_DIFFUSE_MAP)
+         Texture::unbind(0);
+      if (features & SHADER_AMBIENT_MAP)
+         Texture::unbind(1);
       Shader::unbind();
    }
 }
@@ -21,6 +21,7 @@
 #include "gl.hpp"
 #include "shader.hpp"
 #include "texture.hpp"
+#include "memory.hpp"
 #include <vector>
 #include <cstddef>
 #include <memory>
@@ -38,6 +39,30 @@ namespace GL
       glm::vec2 tex;
    };
 
+   // What a vertex looks like in the buffer. Packed is 16 bytes instead of 32:
+   // positions and texture coordinates as 16-bit fractions of the mesh's bounds
+   // (scaled back in the shader), normals as signed bytes.
+   enum VertexFormat
+   {
+      VERTEX_FLOAT,
+      VERTEX_PACKED
+   };
+
+   struct PackedVertex
+   {
+      uint16_t vert[4]; // The 4th is padding, so normals are aligned.
+      int8_t normal[4];
+      uint16_t tex[2];
+   };
+
+   // A range of the index buffer which can be drawn instead of the whole mesh,
+   // if error (object space units) is small enough at the distance it's seen from.
+   struct LodLevel
+   {
+      GLsizei first, count; // In indices.
+      float error;
+   };
+
    struct Material
    {
       Material() :
@@ -45,7 +70,11 @@ namespace GL
          diffuse(0, 0, 0),
          specular(0, 0, 0),
          specular_power(60.0),
-         alpha_mod(1.0f)
+         alpha_mod(1.0f),
+         render(true),
+         collide(true),
+         motion(0.0f),
+         motion_period(0.0f)
       {}
 
       glm::vec3 ambient;
@@ -53,27 +82,78 @@ namespace GL
       glm::vec3 specular;
       float specular_power;
       float alpha_mod;
+      bool render;  // False for collision proxies (MTL "collision only").
+      bool collide; // False for visual-only detail (MTL "collision off").
+      glm::vec3 motion;    // Moves back and forth by this much (MTL "motion x y z period").
+      float motion_period; // In seconds. 0 for static geometry.
       std1::shared_ptr<Texture> diffuse_map;
       std1::shared_ptr<Texture> ambient_map;
    };
 
+   // What a material needs from the fragment shader. Variants are compiled per combination.
+   enum ShaderFeature
+   {
+      SHADER_DIFFUSE_MAP   = 1 << 0, // Otherwise white.
+      SHADER_AMBIENT_MAP   = 1 << 1, // Separate from the diffuse map, which is used otherwise.
+      SHADER_TEXTURE_ALPHA = 1 << 2, // Texture alpha blends between the MTL and texture colours.
+      SHADER_SPECULAR      = 1 << 3, // Ks isn't black.
+      SHADER_ALPHA_MOD     = 1 << 4  // d or Tr make it translucent.
+   };
+
+   unsigned shader_features(const Material& material);
+   // The #defines for a ShaderCache, in bit order.
+   std::vector<std::string> shader_feature_names();
+
    class Mesh
    {
       public:
          Mesh();
          ~Mesh();
 
+         // NULL once released. Without indices, every three vertices are a triangle.
          std1::shared_ptr<std::vector<Vertex> > get_vertex() const { return vertex; }
+         std1::shared_ptr<std::vector<uint32_t> > get_indices() const { return indices; }
+         GLsizei get_vertex_count() const { return vertex_count; }
+         // Full detail, and as last rendered.
+         GLsizei get_triangle_count() const { return (lods.empty() ? vertex_count : lods[0].count) / 3; }
+         GLsizei get_drawn_triangle_count() const { return (lods.empty() ? vertex_count : lods[lod].count) / 3; }
+         unsigned get_lod() const { return lod; }
          const Material& get_material() const { return material; }
+         // Needs blending, from d/Tr or alpha in the diffuse map. Drawn after everything opaque.
+         bool is_transparent() const;
+         // Of the centre of the bounds, along the view direction. For sorting draws.
+         float get_view_depth() const;
 
          void set_vertices(std::vector<Vertex> vertex);
          void set_vertices(const std1::shared_ptr<std::vector<Vertex> >& vertex);
+         // Drawn with an index buffer, 16-bit where the vertices allow it. GLES has no 32-bit
+         // indices without an extension, so larger meshes are expanded there instead.
+         void set_vertices(const std1::shared_ptr<std::vector<Vertex> >& vertex,
+               const std1::shared_ptr<std::vector<uint32_t> >& indices);
+         // After indexed set_vertices(), finest first. The first level is the whole mesh.
+         void set_lods(const std::vector<LodLevel>& lods);
+         // Levels are picked so their error is at most threshold times the distance, 0 for full detail.
+         void set_lod_threshold(float threshold);
+
+         // Drops the CPU copy, if the upload went through. Only the buffer is drawn from,
+         // and a lost context reloads the scene from disk anyway.
+         bool release_vertices();
+
          void set_vertex_type(GLenum type);
+
+         // Before set_vertices(). Meshes too large to pack precisely stay float.
+         void set_vertex_format(VertexFormat format);
+         VertexFormat get_vertex_format() const { return format; }
+         // Before set_vertices(). Also uploads the positions on their own, for render_depth().
+         void set_depth_stream(bool enable);
          void set_material(const Material& material);
-         void set_blank(const std1::shared_ptr<Texture>& blank);
-         void set_shader(const std1::shared_ptr<Shader>& shader);
+         // After set_material(). Only the variant the material needs is compiled.
+         void set_shader_cache(const std1::shared_ptr<ShaderCache>& shaders);
+         // Takes aVertex, uMVP, uPosScale and uPosOffset like the main shader.
+         void set_depth_shader(const std1::shared_ptr<Shader>& shader);
 
          void set_model(const glm::mat4& model);
+         const glm::mat4& get_model() const { return model; }
          void set_view(const glm::mat4& view);
          void set_projection(const glm::mat4& projection);
          void set_eye(const glm::vec3& eye_pos);
@@ -82,13 +162,40 @@ namespace GL
          void set_light_ambient(const glm::vec3& light_ambient);
 
          void render();
+         // Depth alone, from the position stream. Same level of detail, so render() matches it exactly.
+         void render_depth();
 
       private:
          GLuint vbo;
+         GLuint ibo;
+         GLuint depth_vbo; // Positions only, 0 without a depth stream.
+         bool depth_stream;
          GLenum vertex_type;
          std1::shared_ptr<std::vector<Vertex> > vertex;
+         std1::shared_ptr<std::vector<uint32_t> > indices;
+         GLsizei vertex_count;
+         GLenum index_type;
+         std::vector<LodLevel> lods; // Empty without indices.
+         unsigned lod;
+         float lod_threshold;
+         glm::vec3 bounds_center; // Bounding sphere, in object space.
+         float bounds_radius;
+         bool uploaded;
+         VertexFormat requested_format;
+         VertexFormat format;
+
+         // Unpacks to vert * pos_scale + pos_offset. Identity for floats.
+         glm::vec3 pos_scale, pos_offset;
+         glm::vec2 tex_scale, tex_offset;
+
+         bool pack(std::vector<PackedVertex>& packed);
+         unsigned select_lod() const;
+         void draw();
+         Memory::Allocation cpu_memory;
+         Memory::Allocation gpu_memory;
          std1::shared_ptr<Shader> shader;
-         std1::shared_ptr<Texture> blank;
+         unsigned features;
+         std1::shared_ptr<Shader> depth_shader;
 
          Material material;
          glm::vec3 light_pos;
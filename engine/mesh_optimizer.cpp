@@ -0,0 +1,392 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mesh_optimizer.hpp"
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+
+using namespace glm;
+using namespace std;
+
+namespace GL
+{
+   VertexCacheStats& VertexCacheStats::operator+=(const VertexCacheStats& other)
+   {
+      triangles += other.triangles;
+      vertices += other.vertices;
+      transforms += other.transforms;
+      return *this;
+   }
+
+   // A FIFO cache as timestamps. A vertex is in the cache if it was added within the last
+   // size misses, and bumping the time by more than that empties it.
+   struct CacheSim
+   {
+      CacheSim(size_t vertex_count, unsigned size) :
+         stamps(vertex_count, 0), time(size + 1), size(size)
+      {}
+
+      unsigned misses(const uint32_t *triangle)
+      {
+         unsigned count = 0;
+         for (unsigned i = 0; i < 3; i++)
+         {
+            if (time - stamps[triangle[i]] > size)
+            {
+               stamps[triangle[i]] = time++;
+               count++;
+            }
+         }
+         return count;
+      }
+
+      void flush()
+      {
+         time += size + 1;
+      }
+
+      vector<unsigned> stamps;
+      unsigned time;
+      unsigned size;
+   };
+
+   VertexCacheStats analyze_vertex_cache(const vector<uint32_t>& indices,
+         size_t vertex_count, unsigned cache_size)
+   {
+      VertexCacheStats stats;
+      stats.triangles = indices.size() / 3;
+
+      vector<bool> used(vertex_count, false);
+      for (size_t i = 0; i < indices.size(); i++)
+      {
+         if (!used[indices[i]])
+            stats.vertices++;
+         used[indices[i]] = true;
+      }
+
+      CacheSim cache(vertex_count, cache_size);
+      for (size_t i = 0; i + 2 < indices.size(); i += 3)
+         stats.transforms += cache.misses(&indices[i]);
+      return stats;
+   }
+
+   // Orders vertices bytewise, then by where they are, so the first of equal vertices comes first.
+   struct VertexLess
+   {
+      VertexLess(const vector<Vertex>& vertices) : vertices(vertices) {}
+
+      bool operator()(uint32_t a, uint32_t b) const
+      {
+         int cmp = memcmp(&vertices[a], &vertices[b], sizeof(Vertex));
+         return cmp ? cmp < 0 : a < b;
+      }
+
+      const vector<Vertex>& vertices;
+   };
+
+   void build_index(const vector<Vertex>& triangles,
+         vector<Vertex>& vertices, vector<uint32_t>& indices)
+   {
+      vector<uint32_t> order(triangles.size());
+      for (size_t i = 0; i < order.size(); i++)
+         order[i] = i;
+      sort(order.begin(), order.end(), VertexLess(triangles));
+
+      vector<uint32_t> first(triangles.size());
+      for (size_t i = 0; i < order.size(); i++)
+      {
+         bool same = i && !memcmp(&triangles[order[i]], &triangles[order[i - 1]], sizeof(Vertex));
+         first[order[i]] = same ? first[order[i - 1]] : order[i];
+      }
+
+      vertices.clear();
+      indices.resize(triangles.size());
+      vector<uint32_t> remap(triangles.size(), ~0u);
+      for (size_t i = 0; i < triangles.size(); i++)
+      {
+         uint32_t& index = remap[first[i]];
+         if (index == ~0u)
+         {
+            index = vertices.size();
+            vertices.push_back(triangles[i]);
+         }
+         indices[i] = index;
+      }
+   }
+
+   // Forsyth's scoring. The cache modelled is larger than real ones, which only makes the
+   // order less sensitive to the actual size.
+   static const unsigned forsyth_cache_size = 32;
+
+   static float vertex_score(int position, unsigned remaining)
+   {
+      if (!remaining)
+         return -1.0f;
+
+      float score = 0.0f;
+      if (position >= 0)
+      {
+         // The last triangle's vertices score the same, so its winding doesn't matter.
+         if (position < 3)
+            score = 0.75f;
+         else
+            score = powf(1.0f - float(position - 3) / (forsyth_cache_size - 3), 1.5f);
+      }
+
+      // Finishing off vertices with few triangles left avoids coming back to them later.
+      return score + 2.0f / sqrtf(float(remaining));
+   }
+
+   void optimize_vertex_cache(vector<uint32_t>& indices, size_t vertex_count)
+   {
+      size_t triangle_count = indices.size() / 3;
+      if (!triangle_count)
+         return;
+
+      // Triangles of each vertex. The first remaining[v] of them aren't drawn yet.
+      vector<unsigned> remaining(vertex_count, 0);
+      for (size_t i = 0; i < triangle_count * 3; i++)
+         remaining[indices[i]]++;
+
+      vector<unsigned> offsets(vertex_count + 1, 0);
+      for (size_t v = 0; v < vertex_count; v++)
+         offsets[v + 1] = offsets[v] + remaining[v];
+
+      vector<unsigned> adjacency(triangle_count * 3);
+      vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+      for (size_t i = 0; i < triangle_count * 3; i++)
+         adjacency[fill[indices[i]]++] = i / 3;
+
+      vector<int> position(vertex_count, -1);
+      vector<float> score(vertex_count);
+      for (size_t v = 0; v < vertex_count; v++)
+         score[v] = vertex_score(-1, remaining[v]);
+
+      vector<float> triangle_score(triangle_count);
+      size_t best = 0;
+      for (size_t t = 0; t < triangle_count; t++)
+      {
+         triangle_score[t] = score[indices[t * 3 + 0]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+         if (triangle_score[t] > triangle_score[best])
+            best = t;
+      }
+
+      vector<bool> emitted(triangle_count, false);
+      vector<uint32_t> out;
+      out.reserve(triangle_count * 3);
+
+      uint32_t cache[forsyth_cache_size + 3];
+      unsigned cache_count = 0;
+      size_t next_unemitted = 0;
+
+      for (;;)
+      {
+         const uint32_t *triangle = &indices[best * 3];
+         out.insert(out.end(), triangle, triangle + 3);
+         emitted[best] = true;
+
+         for (unsigned i = 0; i < 3; i++)
+         {
+            uint32_t v = triangle[i];
+            unsigned *tris = &adjacency[offsets[v]];
+            unsigned *end = tris + remaining[v];
+            unsigned *itr = find(tris, end, unsigned(best));
+            if (itr != end)
+            {
+               *itr = end[-1];
+               remaining[v]--;
+            }
+         }
+
+         // The triangle's vertices move to the front, the rest shift down and may fall out.
+         uint32_t new_cache[forsyth_cache_size + 3];
+         unsigned new_count = 0;
+         for (unsigned i = 0; i < 3; i++)
+            if (find(new_cache, new_cache + new_count, triangle[i]) == new_cache + new_count)
+               new_cache[new_count++] = triangle[i];
+         for (unsigned i = 0; i < cache_count; i++)
+            if (find(triangle, triangle + 3, cache[i]) == triangle + 3)
+               new_cache[new_count++] = cache[i];
+
+         for (unsigned i = 0; i < new_count; i++)
+         {
+            uint32_t v = new_cache[i];
+            position[v] = i < forsyth_cache_size ? int(i) : -1;
+            float new_score = vertex_score(position[v], remaining[v]);
+            float delta = new_score - score[v];
+            score[v] = new_score;
+
+            for (unsigned j = 0; j < remaining[v]; j++)
+               triangle_score[adjacency[offsets[v] + j]] += delta;
+         }
+
+         cache_count = std::min(new_count, forsyth_cache_size);
+         copy(new_cache, new_cache + cache_count, cache);
+
+         // Only triangles touching the cache are considered, which keeps it linear.
+         float best_score = -1.0f;
+         best = triangle_count;
+         for (unsigned i = 0; i < cache_count; i++)
+         {
+            uint32_t v = cache[i];
+            for (unsigned j = 0; j < remaining[v]; j++)
+            {
+               unsigned t = adjacency[offsets[v] + j];
+               if (triangle_score[t] > best_score)
+               {
+                  best_score = triangle_score[t];
+                  best = t;
+               }
+            }
+         }
+
+         if (best == triangle_count)
+         {
+            while (next_unemitted < triangle_count && emitted[next_unemitted])
+               next_unemitted++;
+            if (next_unemitted == triangle_count)
+               break;
+            best = next_unemitted;
+         }
+      }
+
+      out.insert(out.end(), indices.begin() + triangle_count * 3, indices.end());
+      indices.swap(out);
+   }
+
+   struct Cluster
+   {
+      size_t begin, end;
+      float sort_key;
+   };
+
+   static bool cluster_before(const Cluster& a, const Cluster& b)
+   {
+      return a.sort_key > b.sort_key;
+   }
+
+   void optimize_overdraw(vector<uint32_t>& indices, const vector<Vertex>& vertices, float threshold)
+   {
+      size_t triangle_count = indices.size() / 3;
+      if (triangle_count < 2)
+         return;
+
+      // Hard boundaries, where all of a triangle's vertices miss and the cache starts over anyway.
+      vector<size_t> hard;
+      CacheSim cache(vertices.size(), 16);
+      for (size_t t = 0; t < triangle_count; t++)
+         if (cache.misses(&indices[t * 3]) == 3)
+            hard.push_back(t);
+      hard.push_back(triangle_count);
+
+      // Soft boundaries within those, wherever the cluster so far does almost as well as all of it.
+      vector<Cluster> clusters;
+      for (size_t h = 0; h + 1 < hard.size(); h++)
+      {
+         size_t begin = hard[h], end = hard[h + 1];
+
+         cache.flush();
+         unsigned misses = 0;
+         for (size_t t = begin; t < end; t++)
+            misses += cache.misses(&indices[t * 3]);
+         float limit = threshold * misses / (end - begin);
+
+         cache.flush();
+         misses = 0;
+         size_t start = begin;
+         for (size_t t = begin; t < end; t++)
+         {
+            misses += cache.misses(&indices[t * 3]);
+            if (t + 1 == end || misses <= limit * (t + 1 - start))
+            {
+               Cluster cluster = { start, t + 1, 0.0f };
+               clusters.push_back(cluster);
+               cache.flush();
+               misses = 0;
+               start = t + 1;
+            }
+         }
+      }
+
+      // Area weighted centroids and normals.
+      vector<vec3> centroids(clusters.size(), vec3(0.0f)), normals(clusters.size(), vec3(0.0f));
+      vec3 mesh_centroid(0.0f);
+      float mesh_area = 0.0f;
+      for (size_t c = 0; c < clusters.size(); c++)
+      {
+         float area = 0.0f;
+         for (size_t t = clusters[c].begin; t < clusters[c].end; t++)
+         {
+            const vec3& a = vertices[indices[t * 3 + 0]].vert;
+            const vec3& b = vertices[indices[t * 3 + 1]].vert;
+            const vec3& d = vertices[indices[t * 3 + 2]].vert;
+            vec3 normal = cross(b - a, d - a);
+            float triangle_area = length(normal);
+
+            centroids[c] += (a + b + d) * (triangle_area / 3.0f);
+            normals[c] += normal;
+            area += triangle_area;
+         }
+
+         mesh_centroid += centroids[c];
+         mesh_area += area;
+         if (area > 0.0f)
+            centroids[c] /= area;
+      }
+
+      if (mesh_area > 0.0f)
+         mesh_centroid /= mesh_area;
+
+      for (size_t c = 0; c < clusters.size(); c++)
+      {
+         float len = length(normals[c]);
+         clusters[c].sort_key = len > 0.0f ? dot(centroids[c] - mesh_centroid, normals[c] / len) : 0.0f;
+      }
+
+      stable_sort(clusters.begin(), clusters.end(), cluster_before);
+
+      vector<uint32_t> out;
+      out.reserve(indices.size());
+      for (size_t c = 0; c < clusters.size(); c++)
+         out.insert(out.end(), indices.begin() + clusters[c].begin * 3, indices.begin() + clusters[c].end * 3);
+      out.insert(out.end(), indices.begin() + triangle_count * 3, indices.end());
+      indices.swap(out);
+   }
+
+   void optimize_vertex_fetch(vector<Vertex>& vertices, vector<uint32_t>& indices)
+   {
+      vector<uint32_t> remap(vertices.size(), ~0u);
+      vector<Vertex> out;
+      out.reserve(vertices.size());
+
+      for (size_t i = 0; i < indices.size(); i++)
+      {
+         uint32_t& index = remap[indices[i]];
+         if (index == ~0u)
+         {
+            index = out.size();
+            out.push_back(vertices[indices[i]]);
+         }
+         indices[i] = index;
+      }
+
+      vertices.swap(out);
+   }
+}
+
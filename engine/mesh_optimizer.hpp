@@ -0,0 +1,71 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MESH_OPTIMIZER_HPP__
+#define MESH_OPTIMIZER_HPP__
+
+#include "mesh.hpp"
+#include <vector>
+#include <stdint.h>
+
+// Load time reordering of indexed triangle lists, so the GPU transforms each vertex as few
+// times as possible and early depth testing rejects as much as possible.
+// Run in the order below: index, vertex cache, overdraw, vertex fetch.
+
+namespace GL
+{
+   // How a triangle order does with a FIFO post-transform cache, as most GPUs have.
+   // ACMR is transforms per triangle, from 3 down to about 0.5 for regular grids.
+   // ATVR is transforms per vertex, 1 at best.
+   struct VertexCacheStats
+   {
+      VertexCacheStats() : triangles(0), vertices(0), transforms(0) {}
+
+      uint64_t triangles;
+      uint64_t vertices;
+      uint64_t transforms;
+
+      float acmr() const { return triangles ? float(transforms) / triangles : 0.0f; }
+      float atvr() const { return vertices ? float(transforms) / vertices : 0.0f; }
+
+      VertexCacheStats& operator+=(const VertexCacheStats& other);
+   };
+
+   VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t>& indices,
+         size_t vertex_count, unsigned cache_size = 16);
+
+   // Merges identical vertices of a triangle list. Vertices keep the order they're first used in.
+   void build_index(const std::vector<Vertex>& triangles,
+         std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+   // Forsyth's linear-speed vertex cache optimisation.
+   void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertex_count);
+
+   // Splits the cache ordered triangles into clusters where the cache starts over anyway,
+   // or where that costs at most threshold times the ACMR, and draws the clusters facing
+   // away from the centre first, as they tend to hide the rest (Sander et al. 2007).
+   void optimize_overdraw(std::vector<uint32_t>& indices,
+         const std::vector<Vertex>& vertices, float threshold = 1.05f);
+
+   // Renumbers vertices in the order they're drawn in, so fetches stream through the buffer.
+   // Vertices no triangle uses are dropped.
+   void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+}
+
+#endif
+
@@ -0,0 +1,288 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mesh_simplifier.hpp"
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+
+using namespace glm;
+using namespace std;
+
+namespace GL
+{
+   // Sum of squared distances to a set of planes, the upper half of a symmetric 4x4 matrix.
+   struct Quadric
+   {
+      Quadric()
+      {
+         memset(m, 0, sizeof(m));
+      }
+
+      void add_plane(double a, double b, double c, double d)
+      {
+         m[0] += a * a; m[1] += a * b; m[2] += a * c; m[3] += a * d;
+         m[4] += b * b; m[5] += b * c; m[6] += b * d;
+         m[7] += c * c; m[8] += c * d;
+         m[9] += d * d;
+      }
+
+      Quadric& operator+=(const Quadric& other)
+      {
+         for (unsigned i = 0; i < 10; i++)
+            m[i] += other.m[i];
+         return *this;
+      }
+
+      double error(const vec3& p) const
+      {
+         double x = p.x, y = p.y, z = p.z;
+         double e = m[0] * x * x + 2.0 * (m[1] * x * y + m[2] * x * z + m[3] * x) +
+            m[4] * y * y + 2.0 * (m[5] * y * z + m[6] * y) +
+            m[7] * z * z + 2.0 * m[8] * z +
+            m[9];
+         return std::max(e, 0.0);
+      }
+
+      double m[10];
+   };
+
+   struct PositionLess
+   {
+      PositionLess(const vector<Vertex>& vertices) : vertices(vertices) {}
+
+      bool operator()(uint32_t a, uint32_t b) const
+      {
+         int cmp = memcmp(&vertices[a].vert, &vertices[b].vert, sizeof(vec3));
+         return cmp ? cmp < 0 : a < b;
+      }
+
+      const vector<Vertex>& vertices;
+   };
+
+   // Seams, boundaries and non-manifold edges, found on positions so seams don't look like boundaries.
+   static vector<bool> find_locked(const vector<uint32_t>& indices, const vector<Vertex>& vertices)
+   {
+      vector<uint32_t> order(vertices.size());
+      for (size_t i = 0; i < order.size(); i++)
+         order[i] = i;
+      sort(order.begin(), order.end(), PositionLess(vertices));
+
+      vector<uint32_t> position(vertices.size());
+      vector<unsigned> sharing;
+      for (size_t i = 0; i < order.size(); i++)
+      {
+         if (!i || memcmp(&vertices[order[i]].vert, &vertices[order[i - 1]].vert, sizeof(vec3)))
+            sharing.push_back(0);
+         position[order[i]] = sharing.size() - 1;
+         sharing.back()++;
+      }
+
+      vector<bool> position_locked(sharing.size(), false);
+      for (size_t p = 0; p < sharing.size(); p++)
+         position_locked[p] = sharing[p] > 1;
+
+      // An edge is interior if it appears once each way.
+      vector<uint64_t> edges;
+      edges.reserve(indices.size());
+      for (size_t i = 0; i < indices.size(); i++)
+      {
+         uint64_t a = position[indices[i]];
+         uint64_t b = position[indices[i - i % 3 + (i + 1) % 3]];
+         edges.push_back(a << 32 | b);
+      }
+      sort(edges.begin(), edges.end());
+
+      for (size_t i = 0; i < edges.size(); i++)
+      {
+         uint64_t reverse = edges[i] << 32 | edges[i] >> 32;
+         bool twice = (i && edges[i - 1] == edges[i]) || (i + 1 < edges.size() && edges[i + 1] == edges[i]);
+         if (twice || !binary_search(edges.begin(), edges.end(), reverse))
+         {
+            position_locked[edges[i] >> 32] = true;
+            position_locked[edges[i] & 0xffffffffu] = true;
+         }
+      }
+
+      vector<bool> locked(vertices.size());
+      for (size_t v = 0; v < vertices.size(); v++)
+         locked[v] = position_locked[position[v]];
+      return locked;
+   }
+
+   struct Collapse
+   {
+      uint32_t from, to;
+      double cost;
+   };
+
+   static bool cheaper(const Collapse& a, const Collapse& b)
+   {
+      return a.cost < b.cost;
+   }
+
+   // Whether moving from onto to would turn any of from's triangles over, or leave one
+   // with only locked corners, which would stand edge-on across a seam or boundary.
+   static bool flips(uint32_t from, uint32_t to, const vector<uint32_t>& indices,
+         const vector<unsigned>& offsets, const vector<unsigned>& adjacency,
+         const vector<uint32_t>& remap, const vector<bool>& locked, const vector<Vertex>& vertices)
+   {
+      for (unsigned i = offsets[from]; i < offsets[from + 1]; i++)
+      {
+         const uint32_t *triangle = &indices[adjacency[i] * 3];
+         uint32_t corners[3];
+         for (unsigned k = 0; k < 3; k++)
+            corners[k] = remap[triangle[k]];
+
+         // Those with both go away.
+         if (find(corners, corners + 3, to) != corners + 3)
+            continue;
+
+         bool all_locked = true;
+         vec3 before[3], after[3];
+         for (unsigned k = 0; k < 3; k++)
+         {
+            all_locked = all_locked && locked[corners[k] == from ? to : corners[k]];
+            before[k] = vertices[corners[k]].vert;
+            after[k] = corners[k] == from ? vertices[to].vert : before[k];
+         }
+
+         vec3 normal_before = cross(before[1] - before[0], before[2] - before[0]);
+         vec3 normal_after = cross(after[1] - after[0], after[2] - after[0]);
+         if (all_locked || (dot(normal_before, normal_after) <= 0.0f && dot(normal_before, normal_before) > 0.0f))
+            return true;
+      }
+
+      return false;
+   }
+
+   float simplify(vector<uint32_t>& indices, const vector<Vertex>& vertices, size_t target_index_count)
+   {
+      size_t vertex_count = vertices.size();
+      vector<bool> locked = find_locked(indices, vertices);
+
+      vector<Quadric> quadrics(vertex_count);
+      for (size_t i = 0; i + 2 < indices.size(); i += 3)
+      {
+         const vec3& a = vertices[indices[i + 0]].vert;
+         const vec3& b = vertices[indices[i + 1]].vert;
+         const vec3& c = vertices[indices[i + 2]].vert;
+         vec3 normal = cross(b - a, c - a);
+         float len = length(normal);
+         if (len <= 0.0f)
+            continue;
+
+         normal /= len;
+         for (unsigned k = 0; k < 3; k++)
+            quadrics[indices[i + k]].add_plane(normal.x, normal.y, normal.z, -dot(normal, a));
+      }
+
+      vector<uint32_t> remap(vertex_count);
+      for (size_t v = 0; v < vertex_count; v++)
+         remap[v] = v;
+
+      double max_cost = 0.0;
+      while (indices.size() > target_index_count)
+      {
+         size_t triangle_count = indices.size() / 3;
+
+         vector<unsigned> offsets(vertex_count + 1, 0);
+         for (size_t i = 0; i < indices.size(); i++)
+            offsets[indices[i] + 1]++;
+         for (size_t v = 0; v < vertex_count; v++)
+            offsets[v + 1] += offsets[v];
+         vector<unsigned> adjacency(indices.size());
+         vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+         for (size_t i = 0; i < indices.size(); i++)
+            adjacency[fill[indices[i]]++] = i / 3;
+
+         // The cheapest way to get rid of each vertex.
+         vector<Collapse> best(vertex_count);
+         vector<bool> candidate(vertex_count, false);
+         for (size_t i = 0; i < indices.size(); i++)
+         {
+            uint32_t a = indices[i];
+            uint32_t b = indices[i - i % 3 + (i + 1) % 3];
+            for (unsigned k = 0; k < 2; k++, swap(a, b))
+            {
+               if (locked[a])
+                  continue;
+               Quadric q = quadrics[a];
+               q += quadrics[b];
+               double cost = q.error(vertices[b].vert);
+               if (!candidate[a] || cost < best[a].cost)
+               {
+                  Collapse collapse = { a, b, cost };
+                  best[a] = collapse;
+                  candidate[a] = true;
+               }
+            }
+         }
+
+         vector<Collapse> collapses;
+         for (size_t v = 0; v < vertex_count; v++)
+            if (candidate[v])
+               collapses.push_back(best[v]);
+
+         if (collapses.empty())
+            break;
+         sort(collapses.begin(), collapses.end(), cheaper);
+
+         // Each collapse of an interior vertex takes two triangles with it. Only the cheaper part
+         // is tried in one pass, as costs change around every collapse.
+         size_t goal = triangle_count - target_index_count / 3;
+         size_t removed = 0;
+         vector<bool> touched(vertex_count, false);
+         for (size_t i = 0; i < collapses.size() && removed < goal; i++)
+         {
+            if (i > collapses.size() / 4 && removed)
+               break;
+
+            const Collapse& collapse = collapses[i];
+            if (touched[collapse.from] || touched[collapse.to])
+               continue;
+            if (flips(collapse.from, collapse.to, indices, offsets, adjacency, remap, locked, vertices))
+               continue;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to] += quadrics[collapse.from];
+            touched[collapse.from] = touched[collapse.to] = true;
+            max_cost = std::max(max_cost, collapse.cost);
+            removed += 2;
+         }
+
+         if (!removed)
+            break;
+
+         size_t out = 0;
+         for (size_t i = 0; i + 2 < indices.size(); i += 3)
+         {
+            uint32_t a = remap[indices[i + 0]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (a == b || b == c || c == a)
+               continue;
+            indices[out++] = a;
+            indices[out++] = b;
+            indices[out++] = c;
+         }
+         indices.resize(out);
+      }
+
+      return sqrt(max_cost);
+   }
+}
+
@@ -0,0 +1,40 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MESH_SIMPLIFIER_HPP__
+#define MESH_SIMPLIFIER_HPP__
+
+#include "mesh.hpp"
+#include <vector>
+#include <stdint.h>
+
+namespace GL
+{
+   // Quadric error edge collapse (Garland and Heckbert), collapsing vertices onto neighbours
+   // so no new vertices are made and every level can share one vertex buffer.
+   // Vertices on the mesh boundary, which is where the material changes, and vertices sharing
+   // their position with others (texture or normal seams) never move.
+   //
+   // Collapses until at most target_index_count indices are left, or nothing more can go,
+   // and returns how far the result may be from the input, in object space units.
+   float simplify(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices,
+         size_t target_index_count);
+}
+
+#endif
+
@@ -16,7 +16,9 @@
  */
 
 #include "object.hpp"
+#include "mesh_simplifier.hpp"
 #include "util.hpp"
+#include "profiler.hpp"
 #include <fstream>
 #include <string>
 #include <map>
@@ -125,8 +127,9 @@ namespace OBJ
       }
    }
 
-   static map<string, Material> parse_mtllib(const string& path, map<string, std1::shared_ptr<Texture> >& textures)
+   map<string, Material> parse_mtllib(const string& path, TextureCache& textures)
    {
+      PROFILE_ZONE("mtllib");
       map<string, Material> materials;
 
       ifstream file(path.c_str(), ios::in);
@@ -164,6 +167,20 @@ namespace OBJ
             current.alpha_mod = String::stof(data);
          else if (type == "Tr")
             current.alpha_mod = 1.0f - String::stof(data);
+         else if (type == "collision") // Not standard MTL.
+         {
+            current.render = data != "only";
+            current.collide = data != "off";
+         }
+         else if (type == "motion") // Not standard MTL either.
+         {
+            vector<string> split = String::split(data, " ");
+            if (split.size() >= 4)
+            {
+               current.motion = parse_line<vec3>(data);
+               current.motion_period = String::stof(split[3]);
+            }
+         }
          else if (type == "map_Kd")
          {
             if (!textures[data])
@@ -191,7 +208,69 @@ namespace OBJ
       return materials;
    }
 
-   vector<std1::shared_ptr<Mesh> > load_from_file(const string& path)
+   static size_t loader_bytes(const vector<vec3>& vertex, const vector<vec3>& normal,
+         const vector<vec2>& tex, const vector<Vertex>& vertices, const vector<Vertex>& proxy_vertices)
+   {
+      return (vertex.capacity() + normal.capacity()) * sizeof(vec3) +
+         tex.capacity() * sizeof(vec2) +
+         (vertices.capacity() + proxy_vertices.capacity()) * sizeof(Vertex);
+   }
+
+   static std1::shared_ptr<Mesh> make_mesh(const vector<Vertex>& triangles, const Material& material,
+         const LoadOptions& options, LoadStats& stats)
+   {
+      std1::shared_ptr<Mesh> mesh(new Mesh());
+      mesh->set_vertex_format(options.format);
+      mesh->set_material(material);
+      // Transparent meshes don't write depth, so they're left out of the pre-pass.
+      mesh->set_depth_stream(options.depth_prepass && !mesh->is_transparent());
+
+      if (!options.optimize)
+      {
+         mesh->set_vertices(triangles);
+         return mesh;
+      }
+
+      PROFILE_ZONE("optimize");
+      std1::shared_ptr<vector<Vertex> > vertices(new vector<Vertex>);
+      std1::shared_ptr<vector<uint32_t> > indices(new vector<uint32_t>);
+      build_index(triangles, *vertices, *indices);
+      stats.original += analyze_vertex_cache(*indices, vertices->size());
+
+      optimize_vertex_cache(*indices, vertices->size());
+      optimize_overdraw(*indices, *vertices);
+      stats.optimized += analyze_vertex_cache(*indices, vertices->size());
+
+      // Levels go after each other in the one index buffer, and share the vertices.
+      LodLevel full = { 0, GLsizei(indices->size()), 0.0f };
+      vector<LodLevel> lods(1, full);
+      vector<uint32_t> level = *indices;
+      float error = 0.0f;
+      for (unsigned i = 0; i < options.lod_levels; i++)
+      {
+         size_t previous = level.size();
+         error += simplify(level, *vertices, previous / 2);
+         if (level.size() > previous * 3 / 4) // Not worth drawing.
+            break;
+
+         vector<uint32_t> optimized = level;
+         optimize_vertex_cache(optimized, vertices->size());
+         optimize_overdraw(optimized, *vertices);
+
+         LodLevel lod = { GLsizei(indices->size()), GLsizei(optimized.size()), error };
+         lods.push_back(lod);
+         indices->insert(indices->end(), optimized.begin(), optimized.end());
+         stats.lod_triangles += optimized.size() / 3;
+      }
+
+      optimize_vertex_fetch(*vertices, *indices);
+      mesh->set_vertices(vertices, indices);
+      mesh->set_lods(lods);
+      return mesh;
+   }
+
+   vector<std1::shared_ptr<Mesh> > load_from_file(const string& path, vector<vec3> *collision,
+         const LoadOptions& options, LoadStats *stats)
    {
       ifstream file(path.c_str(), ios::in);
       vector<std1::shared_ptr<Mesh> > meshes;
@@ -203,12 +282,17 @@ namespace OBJ
       vector<vec2> tex;
 
       vector<Vertex> vertices;
+      vector<Vertex> proxy_vertices;
+      bool in_proxy_group = false;
 
-      // Texture cache.
-      map<string, std1::shared_ptr<Texture> > textures;
+      TextureCache textures;
       Material current_material;
 
       map<string, Material> materials;
+      LoadStats load_stats;
+
+      // Capacity only grows, so updating whenever a mesh is made catches the peak.
+      Memory::Allocation temporaries(Memory::LOADER);
 
       for (string line; getline(file, line); )
       {
@@ -225,17 +309,30 @@ namespace OBJ
          else if (type == "vt")
             tex.push_back(parse_line<vec2>(data));
          else if (type == "f")
-            parse_vertex(data, vertices, vertex, normal, tex);
+         {
+            if (in_proxy_group || !current_material.render)
+            {
+               proxy_vertices.clear();
+               parse_vertex(data, proxy_vertices, vertex, normal, tex);
+               if (collision && proxy_vertices.size() == 3 &&
+                     (in_proxy_group || current_material.collide))
+               {
+                  for (unsigned i = 0; i < proxy_vertices.size(); i++)
+                     collision->push_back(proxy_vertices[i].vert);
+               }
+            }
+            else
+               parse_vertex(data, vertices, vertex, normal, tex);
+         }
+         else if (type == "g" || type == "o")
+            in_proxy_group = data.compare(0, 10, "collision_") == 0;
          else if (type == "texture") // Not standard OBJ, but do it like this for simplicity ...
          {
             if (vertices.size()) // Different texture, new mesh.
             {
-               std1::shared_ptr<Mesh> mesh(new Mesh());
-               mesh->set_vertices(vertices);
+               temporaries.set(loader_bytes(vertex, normal, tex, vertices, proxy_vertices));
+               meshes.push_back(make_mesh(vertices, current_material, options, load_stats));
                vertices.clear();
-
-               mesh->set_material(current_material);
-               meshes.push_back(mesh);
             }
 
             if (!textures[data])
@@ -252,12 +349,9 @@ namespace OBJ
          {
             if (vertices.size()) // Different texture, new mesh.
             {
-               std1::shared_ptr<Mesh> mesh(new Mesh());
-               mesh->set_vertices(vertices);
+               temporaries.set(loader_bytes(vertex, normal, tex, vertices, proxy_vertices));
+               meshes.push_back(make_mesh(vertices, current_material, options, load_stats));
                vertices.clear();
-
-               mesh->set_material(current_material);
-               meshes.push_back(mesh);
             }
 
             current_material = materials[data];
@@ -268,14 +362,23 @@ namespace OBJ
 
       if (vertices.size())
       {
-         std1::shared_ptr<Mesh> mesh(new Mesh());
-         mesh->set_vertices(vertices);
+         temporaries.set(loader_bytes(vertex, normal, tex, vertices, proxy_vertices));
+         meshes.push_back(make_mesh(vertices, current_material, options, load_stats));
          vertices.clear();
+      }
 
-         mesh->set_material(current_material);
-         meshes.push_back(mesh);
+      if (options.optimize && log_cb)
+      {
+         log_cb(RETRO_LOG_INFO, "Mesh: %llu triangles, %llu unique vertices. ACMR %.3f -> %.3f, ATVR %.3f -> %.3f.\n",
+               (unsigned long long)load_stats.optimized.triangles, (unsigned long long)load_stats.optimized.vertices,
+               load_stats.original.acmr(), load_stats.optimized.acmr(),
+               load_stats.original.atvr(), load_stats.optimized.atvr());
+         log_cb(RETRO_LOG_INFO, "Mesh: %llu triangles in simplified levels.\n",
+               (unsigned long long)load_stats.lod_triangles);
       }
 
+      if (stats)
+         *stats = load_stats;
       return meshes;
    }
 }
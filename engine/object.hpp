@@ -19,14 +19,46 @@
 #define OBJECT_HPP__
 
 #include "mesh.hpp"
+#include "mesh_optimizer.hpp"
 #include <string>
 #include <vector>
+#include <map>
 #include <memory>
 #include "shared.hpp"
 
 namespace OBJ
 {
-   std::vector<std1::shared_ptr<GL::Mesh> > load_from_file(const std::string& path);
+   struct LoadOptions
+   {
+      LoadOptions() : format(GL::VERTEX_FLOAT), optimize(true), lod_levels(3), depth_prepass(false) {}
+
+      GL::VertexFormat format; // Meshes are uploaded in this format where they fit it.
+      bool optimize;           // Index meshes and reorder them for the vertex cache and overdraw.
+      unsigned lod_levels;     // Simplified levels to make, each about half the last. Needs optimize.
+      bool depth_prepass;      // Upload positions again on their own, for a depth-only pass.
+   };
+
+   // Over all meshes, in file order (indexed) and as uploaded, at full detail. Empty without optimize.
+   struct LoadStats
+   {
+      LoadStats() : lod_triangles(0) {}
+
+      GL::VertexCacheStats original;
+      GL::VertexCacheStats optimized;
+      uint64_t lod_triangles; // In all simplified levels together.
+   };
+
+   // Faces in groups or objects named collision_*, or using a material with
+   // "collision only", are collision proxies. They are never rendered,
+   // but their positions are appended to collision (three per triangle) if it's not NULL.
+   std::vector<std1::shared_ptr<GL::Mesh> > load_from_file(const std::string& path,
+         std::vector<glm::vec3> *collision = NULL, const LoadOptions& options = LoadOptions(),
+         LoadStats *stats = NULL);
+
+   typedef std::map<std::string, std1::shared_ptr<GL::Texture> > TextureCache;
+
+   // Materials by name. Textures are loaded into textures, unless already there.
+   std::map<std::string, GL::Material> parse_mtllib(const std::string& path, TextureCache& textures);
 }
 
 #endif
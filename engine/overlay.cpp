@@ -0,0 +1,213 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "overlay.hpp"
+#include <cctype>
+#include <algorithm>
+
+using namespace std;
+
+namespace GL
+{
+   // ASCII 32 to 95, one byte per row, bit 4 is the leftmost column.
+   static const unsigned char font[64][7] = {
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ' '
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '!'
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '"'
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '#'
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '$'
+      { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 }, // '%'
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '&'
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // "'"
+      { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 }, // '('
+      { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 }, // ')'
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '*'
+      { 0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00 }, // '+'
+      { 0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08 }, // ','
+      { 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00 }, // '-'
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c }, // '.'
+      { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 }, // '/'
+      { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e }, // '0'
+      { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e }, // '1'
+      { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f }, // '2'
+      { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e }, // '3'
+      { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 }, // '4'
+      { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e }, // '5'
+      { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e }, // '6'
+      { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 }, // '7'
+      { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e }, // '8'
+      { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c }, // '9'
+      { 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00 }, // ':'
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ';'
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '<'
+      { 0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00 }, // '='
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '>'
+      { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 }, // '?'
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '@'
+      { 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 }, // 'A'
+      { 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e }, // 'B'
+      { 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e }, // 'C'
+      { 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c }, // 'D'
+      { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f }, // 'E'
+      { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10 }, // 'F'
+      { 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f }, // 'G'
+      { 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 }, // 'H'
+      { 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e }, // 'I'
+      { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c }, // 'J'
+      { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 }, // 'K'
+      { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f }, // 'L'
+      { 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11 }, // 'M'
+      { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 }, // 'N'
+      { 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e }, // 'O'
+      { 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 }, // 'P'
+      { 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d }, // 'Q'
+      { 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11 }, // 'R'
+      { 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e }, // 'S'
+      { 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, // 'T'
+      { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e }, // 'U'
+      { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04 }, // 'V'
+      { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a }, // 'W'
+      { 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11 }, // 'X'
+      { 0x11, 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04 }, // 'Y'
+      { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f }, // 'Z'
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '['
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '\\'
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ']'
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '^'
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '_'
+   };
+
+   static const unsigned glyph_width = 5;
+   static const unsigned glyph_height = 7;
+   static const unsigned cell_width = 6;
+   static const unsigned cell_height = 9;
+   static const unsigned margin = 2;
+
+   static const char *vertex_shader =
+      "attribute vec2 aVertex;\n"
+      "uniform vec2 uScale;\n"
+      "void main() {\n"
+      "  gl_Position = vec4(aVertex * uScale - 1.0, 0.0, 1.0);\n"
+      "}";
+
+   static const char *fragment_shader =
+      "#ifdef GL_ES\n"
+      "precision mediump float;\n"
+      "#endif\n"
+      "uniform vec4 uColor;\n"
+      "void main() {\n"
+      "  gl_FragColor = uColor;\n"
+      "}";
+
+   Overlay::Overlay() : vbo(0), box_vertices(0), dirty(false)
+   {
+      shader = std1::shared_ptr<Shader>(new Shader(vertex_shader, fragment_shader));
+      SYM(glGenBuffers)(1, &vbo);
+   }
+
+   Overlay::~Overlay()
+   {
+      if (!dead_state)
+         SYM(glDeleteBuffers)(1, &vbo);
+   }
+
+   void Overlay::set_text(const vector<string>& lines)
+   {
+      if (lines == this->lines)
+         return;
+
+      this->lines = lines;
+      dirty = true;
+   }
+
+   static void add_rect(vector<GLfloat>& vertices, float x0, float y0, float x1, float y1)
+   {
+      const GLfloat rect[12] = { x0, y0, x1, y0, x0, y1, x0, y1, x1, y0, x1, y1 };
+      vertices.insert(vertices.end(), rect, rect + 12);
+   }
+
+   // Two triangles per lit pixel. A screenful of text is a few thousand, which is nothing.
+   void Overlay::build()
+   {
+      vertices.clear();
+
+      size_t columns = 0;
+      for (unsigned i = 0; i < lines.size(); i++)
+         columns = max(columns, lines[i].size());
+
+      if (columns)
+         add_rect(vertices, 0, 0, 2 * margin + columns * cell_width, 2 * margin + lines.size() * cell_height);
+      box_vertices = vertices.size() / 2;
+
+      for (unsigned line = 0; line < lines.size(); line++)
+      {
+         for (unsigned c = 0; c < lines[line].size(); c++)
+         {
+            unsigned ch = toupper(static_cast<unsigned char>(lines[line][c]));
+            if (ch < 32 || ch >= 96)
+               ch = '?';
+
+            const unsigned char *glyph = font[ch - 32];
+            float x = margin + c * cell_width;
+            float y = margin + line * cell_height + 1;
+            for (unsigned row = 0; row < glyph_height; row++)
+               for (unsigned col = 0; col < glyph_width; col++)
+                  if (glyph[row] & (0x10 >> col))
+                     add_rect(vertices, x + col, y + row, x + col + 1, y + row + 1);
+         }
+      }
+
+      SYM(glBindBuffer)(GL_ARRAY_BUFFER, vbo);
+      if (!vertices.empty())
+         SYM(glBufferData)(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), &vertices[0], GL_DYNAMIC_DRAW);
+      SYM(glBindBuffer)(GL_ARRAY_BUFFER, 0);
+      dirty = false;
+   }
+
+   void Overlay::render(unsigned width, unsigned height)
+   {
+      if (dirty)
+         build();
+      if (vertices.empty())
+         return;
+
+      // Bigger pixels on bigger screens, so it stays readable.
+      float pixel = max(1u, height / 240);
+
+      SYM(glDisable)(GL_DEPTH_TEST);
+      SYM(glDisable)(GL_CULL_FACE);
+      SYM(glEnable)(GL_BLEND);
+      SYM(glBlendFunc)(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+      shader->use();
+      SYM(glUniform2f)(shader->uniform("uScale"), 2.0f * pixel / width, 2.0f * pixel / height);
+
+      GLint aVertex = shader->attrib("aVertex");
+      SYM(glBindBuffer)(GL_ARRAY_BUFFER, vbo);
+      SYM(glEnableVertexAttribArray)(aVertex);
+      SYM(glVertexAttribPointer)(aVertex, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+      SYM(glUniform4f)(shader->uniform("uColor"), 0.0f, 0.0f, 0.0f, 0.6f);
+      SYM(glDrawArrays)(GL_TRIANGLES, 0, box_vertices);
+      SYM(glUniform4f)(shader->uniform("uColor"), 1.0f, 1.0f, 1.0f, 1.0f);
+      SYM(glDrawArrays)(GL_TRIANGLES, box_vertices, vertices.size() / 2 - box_vertices);
+
+      SYM(glDisableVertexAttribArray)(aVertex);
+      SYM(glBindBuffer)(GL_ARRAY_BUFFER, 0);
+      SYM(glBlendFunc)(GL_ONE, GL_ZERO);
+   }
+}
@@ -0,0 +1,58 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OVERLAY_HPP__
+#define OVERLAY_HPP__
+
+#include "gl.hpp"
+#include "shader.hpp"
+#include <string>
+#include <vector>
+#include "shared.hpp"
+
+namespace GL
+{
+   // Lines of text in the top left corner, over a dark box.
+   // Uses a built-in 5x7 font with upper case letters, digits and some punctuation.
+   class Overlay
+   {
+      public:
+         Overlay();
+         ~Overlay();
+
+         // Geometry is only rebuilt when the text changes.
+         void set_text(const std::vector<std::string>& lines);
+
+         // Expects a framebuffer with the top row first, like the rest of the core renders.
+         void render(unsigned width, unsigned height);
+
+      private:
+         std1::shared_ptr<Shader> shader;
+         GLuint vbo;
+         std::vector<std::string> lines;
+         std::vector<GLfloat> vertices; // Pixel positions, in character cells.
+         unsigned box_vertices;
+         bool dirty;
+
+         void build();
+
+         Overlay(const Overlay&);
+         void operator=(const Overlay&);
+   };
+}
+
+#endif
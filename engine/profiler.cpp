@@ -0,0 +1,198 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "profiler.hpp"
+#include "shared.hpp"
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+namespace Profiler
+{
+   bool enabled;
+   static retro_perf_get_time_usec_t clock;
+
+   struct Zone
+   {
+      Zone() : calls(0), total(0), max(0) {}
+      uint64_t calls;
+      retro_time_t total;
+      retro_time_t max;
+   };
+
+   // The same name can be a different literal in every file, so compare the text.
+   struct NameLess
+   {
+      bool operator()(const char *a, const char *b) const { return strcmp(a, b) < 0; }
+   };
+   typedef map<const char*, Zone, NameLess> ZoneMap;
+
+   static ZoneMap zones;
+   static unsigned frames;
+   static const unsigned summary_frames = 600;
+
+   struct Event
+   {
+      const char *name;
+      retro_time_t start;
+      retro_time_t duration;
+   };
+
+   // Around 24 MB. Beyond that, events are counted, but dropped.
+   static const size_t max_events = 1 << 20;
+   static vector<Event> events;
+   static bool capture;
+   static size_t dropped;
+
+   void set_clock(retro_perf_get_time_usec_t clock_)
+   {
+      clock = clock_;
+      if (!clock)
+         enabled = false;
+   }
+
+   void set_enabled(bool enable)
+   {
+      if (enable && !clock)
+      {
+         if (log_cb)
+            log_cb(RETRO_LOG_WARN, "Profiler: No timer from the frontend, staying off.\n");
+         enable = false;
+      }
+
+      if (enable != enabled)
+      {
+         zones.clear();
+         frames = 0;
+      }
+      enabled = enable;
+   }
+
+   void start_capture()
+   {
+      events.clear();
+      events.reserve(4096);
+      dropped = 0;
+      capture = true;
+   }
+
+   bool capturing()
+   {
+      return capture;
+   }
+
+   retro_time_t now()
+   {
+      return clock();
+   }
+
+   void record(const char *name, retro_time_t start)
+   {
+      if (!enabled)
+         return;
+
+      retro_time_t duration = clock() - start;
+      Zone& zone = zones[name];
+      zone.calls++;
+      zone.total += duration;
+      zone.max = std::max(zone.max, duration);
+
+      if (!capture)
+         return;
+
+      if (events.size() < max_events)
+      {
+         Event event = { name, start, duration };
+         events.push_back(event);
+      }
+      else
+         dropped++;
+   }
+
+   bool write_trace(const std::string& path)
+   {
+      capture = false;
+
+      FILE *file = fopen(path.c_str(), "w");
+      if (!file)
+         return false;
+
+      // Complete events, timestamps and durations in microseconds.
+      fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+      fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"Scenewalker\"}}");
+      for (size_t i = 0; i < events.size(); i++)
+      {
+         fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%lld,\"dur\":%lld}",
+               events[i].name, (long long)events[i].start, (long long)events[i].duration);
+      }
+      fprintf(file, "\n]}\n");
+
+      bool ok = !ferror(file);
+      if (fclose(file) != 0)
+         ok = false;
+
+      if (log_cb)
+      {
+         if (ok)
+            log_cb(RETRO_LOG_INFO, "Profiler: Wrote %u events to %s.\n", (unsigned)events.size(), path.c_str());
+         if (dropped)
+            log_cb(RETRO_LOG_WARN, "Profiler: Capture was full, dropped %u events.\n", (unsigned)dropped);
+      }
+
+      vector<Event>().swap(events);
+      return ok;
+   }
+
+   static bool heavier(const ZoneMap::value_type *a, const ZoneMap::value_type *b)
+   {
+      return a->second.total > b->second.total;
+   }
+
+   static void log_summary()
+   {
+      vector<const ZoneMap::value_type*> sorted;
+      for (ZoneMap::const_iterator itr = zones.begin(); itr != zones.end(); ++itr)
+         sorted.push_back(&*itr);
+      sort(sorted.begin(), sorted.end(), heavier);
+
+      log_cb(RETRO_LOG_INFO, "Profiler: Last %u frames, per frame:\n", frames);
+      for (unsigned i = 0; i < sorted.size(); i++)
+      {
+         const Zone& zone = sorted[i]->second;
+         log_cb(RETRO_LOG_INFO, "  %-20s %8.3f ms %8.1f calls, max %.3f ms\n",
+               sorted[i]->first, zone.total / (1000.0 * frames), double(zone.calls) / frames, zone.max / 1000.0);
+      }
+   }
+
+   void end_frame()
+   {
+      if (!enabled)
+         return;
+
+      if (++frames < summary_frames)
+         return;
+
+      if (log_cb)
+         log_summary();
+      zones.clear();
+      frames = 0;
+   }
+}
@@ -0,0 +1,75 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROFILER_HPP__
+#define PROFILER_HPP__
+
+#include "libretro.h"
+#include <string>
+
+// Scoped CPU timing. Zones are named by string literals, and nest.
+//
+//    PROFILE_ZONE("render");
+//
+// times from there to the end of the enclosing scope. When the profiler is off,
+// a zone costs a test of one flag. Not thread safe, only use zones on the main thread.
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ::Profiler::Scope PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+
+namespace Profiler
+{
+   extern bool enabled;
+
+   // Without a clock, e.g. when the frontend has no perf interface, the profiler stays off.
+   void set_clock(retro_perf_get_time_usec_t clock);
+   void set_enabled(bool enable);
+
+   // Besides timing, keeps every zone until write_trace(), for a Chrome / Perfetto trace.
+   void start_capture();
+   bool capturing();
+
+   // Writes what was captured as Chrome trace event JSON, and stops capturing.
+   bool write_trace(const std::string& path);
+
+   // Call once after every frame. Logs a summary per zone now and then.
+   void end_frame();
+
+   retro_time_t now();
+   void record(const char *name, retro_time_t start);
+
+   class Scope
+   {
+      public:
+         Scope(const char *name) : name(name), start(enabled ? now() : -1) {}
+         ~Scope()
+         {
+            if (start >= 0)
+               record(name, start);
+         }
+
+      private:
+         const char *name;
+         retro_time_t start;
+
+         Scope(const Scope&);
+         void operator=(const Scope&);
+   };
+}
+
+#endif
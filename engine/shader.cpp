@@ -137,5 +137,38 @@ namespace GL
 
       return ret;
    }
-}
 
+   ShaderCache::ShaderCache(const std::string& vertex, const std::string& fragment,
+         const std::vector<std::string>& feature_names) :
+      vertex(vertex), fragment(fragment), feature_names(feature_names)
+   {}
+
+   // #version has to stay the first line, so defines go after it.
+   static std::string add_defines(const std::string& source, const std::string& defines)
+   {
+      if (source.compare(0, 8, "#version") != 0)
+         return defines + source;
+
+      size_t end = source.find('\n');
+      if (end == std::string::npos)
+         return source + "\n" + defines;
+      return source.substr(0, end + 1) + defines + source.substr(end + 1);
+   }
+
+   std1::shared_ptr<Shader> ShaderCache::get(unsigned features)
+   {
+      std1::shared_ptr<Shader>& shader = shaders[features];
+      if (shader)
+         return shader;
+
+      std::string defines;
+      for (unsigned i = 0; i < feature_names.size(); i++)
+         if (features & (1u << i))
+            defines += "#define " + feature_names[i] + "\n";
+
+      if (log_cb)
+         log_cb(RETRO_LOG_INFO, "Shader: Compiling variant %u.\n", features);
+      shader = std1::shared_ptr<Shader>(new Shader(add_defines(vertex, defines), add_defines(fragment, defines)));
+      return shader;
+   }
+}
@@ -19,6 +19,11 @@
 #define SHADER_HPP__
 
 #include "gl.hpp"
+#include "shared.hpp"
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
 
 namespace GL
 {
@@ -40,6 +45,24 @@ namespace GL
 
          GLuint compile_shader(GLenum type, const std::string& source);
    };
+
+   // Variants of one shader, each compiled on first use with a #define for every bit set in its key.
+   // Bit i is named feature_names[i].
+   class ShaderCache
+   {
+      public:
+         ShaderCache(const std::string& vertex, const std::string& fragment,
+               const std::vector<std::string>& feature_names);
+
+         std1::shared_ptr<Shader> get(unsigned features);
+         size_t size() const { return shaders.size(); }
+
+      private:
+         std::string vertex;
+         std::string fragment;
+         std::vector<std::string> feature_names;
+         std::map<unsigned, std1::shared_ptr<Shader> > shaders;
+   };
 }
 
 #endif
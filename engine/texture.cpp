@@ -18,6 +18,7 @@
 #include "texture.hpp"
 #include "rpng.h"
 #include "util.hpp"
+#include "profiler.hpp"
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
@@ -52,6 +53,7 @@ static bool texture_image_load_tga(const char *path,
       fclose(file);
       return false;
    }
+   Memory::Allocation temporaries(Memory::LOADER, len);
 
    fread(buffer, 1, len, file);
    fclose(file);
@@ -120,7 +122,29 @@ static bool texture_image_load_tga(const char *path,
 
 namespace GL
 {
-   Texture::Texture() : tex(0)
+   bool load_image_rgba(const std::string& path, uint8_t*& data, unsigned& width, unsigned& height)
+   {
+      string ext = Path::ext(path);
+      if (ext == "png")
+         return rpng_load_image_rgba(path.c_str(), &data, &width, &height);
+      else if (ext == "tga")
+         return texture_image_load_tga(path.c_str(), data, width, height);
+
+      if (log_cb)
+         log_cb(RETRO_LOG_ERROR, "Unrecognized extension: \"%s\"\n", ext.c_str());
+      return false;
+   }
+
+#ifndef GLES
+   size_t read_dds(const std::string& path)
+   {
+      gli::storage storage(gli::loadStorageDDS(path));
+      return storage.empty() ? 0 : storage.size();
+   }
+#endif
+
+   Texture::Texture() :
+      tex(0), alpha(false), level_memory(Memory::TEXTURE_RGBA8), mipmap_memory(Memory::TEXTURE_MIPMAPS)
    {}
 
    void Texture::upload_data(const void* data, unsigned width, unsigned height,
@@ -136,6 +160,15 @@ namespace GL
             GL_RGBA, GL_UNSIGNED_BYTE,
             data);
 
+      const uint8_t *texels = static_cast<const uint8_t*>(data);
+      alpha = false;
+      for (size_t i = 0; i < size_t(width) * height && !alpha; i++)
+         alpha = texels[i * 4 + 3] != 0xff;
+
+      // A full mip chain adds a third.
+      level_memory.set(Memory::TEXTURE_RGBA8, size_t(width) * height * 4);
+      mipmap_memory.set(generate_mipmap ? level_memory.size() / 3 : 0);
+
       if (generate_mipmap)
       {
          SYM(glGenerateMipmap)(GL_TEXTURE_2D);
@@ -171,10 +204,27 @@ namespace GL
       if (log_cb)
          log_cb(RETRO_LOG_INFO, "Loading DDS: %s.\n", path.c_str());
       unsigned levels = 0;
-      tex = gli::createTexture2D(path, &levels);
+      gli::format format = gli::FORMAT_NULL;
+      tex = gli::createTexture2D(path, &levels, &format);
+      // Texels aren't looked at, the format decides. DXT1 without the alpha flag and RGB have none.
+      alpha = gli::component_count(format) == 4;
 
       bind();
 
+      // Stored as in the file, which has a 128 byte header.
+      FILE *file = fopen(path.c_str(), "rb");
+      if (file)
+      {
+         fseek(file, 0, SEEK_END);
+         long size = ftell(file) - 128;
+         fclose(file);
+         if (size > 0)
+         {
+            level_memory.set(Memory::TEXTURE_COMPRESSED, size);
+            mipmap_memory.set(levels == 1 ? size / 3 : 0);
+         }
+      }
+
       if (levels == 1)
       {
          SYM(glGenerateMipmap)(GL_TEXTURE_2D);
@@ -195,8 +245,10 @@ namespace GL
    }
 #endif
 
-   Texture::Texture(const std::string& path) : tex(0)
+   Texture::Texture(const std::string& path) :
+      tex(0), alpha(false), level_memory(Memory::TEXTURE_RGBA8), mipmap_memory(Memory::TEXTURE_MIPMAPS)
    {
+      PROFILE_ZONE("texture");
       uint8_t* data = NULL;
       unsigned width = 0, height = 0;
 
@@ -208,22 +260,9 @@ namespace GL
       else
 #endif
       {
-         bool ret = false;
-         if (ext == "png")
-         {
-            ret = rpng_load_image_rgba(path.c_str(),
-                  &data, &width, &height);
-         }
-         else if (ext == "tga")
-         {
-            ret = texture_image_load_tga(path.c_str(),
-                  data, width, height);
-         }
-         else if (log_cb)
-            log_cb(RETRO_LOG_ERROR, "Unrecognized extension: \"%s\"\n", ext.c_str());
-
-         if (ret)
+         if (load_image_rgba(path, data, width, height))
          {
+            Memory::Allocation pixels(Memory::LOADER, size_t(width) * height * 4);
             upload_data(data, width, height, true);
             free(data);
          }
@@ -19,6 +19,7 @@
 #define TEXTURE_HPP__
 
 #include "gl.hpp"
+#include "memory.hpp"
 
 namespace GL
 {
@@ -38,9 +39,24 @@ namespace GL
          void upload_data(const void* data, unsigned width, unsigned height,
                bool generate_mipmap);
 
+         // Whether any texel is less than opaque. For DDS, whether the pixel format has an alpha channel.
+         bool has_alpha() const { return alpha; }
+
       private:
          GLuint tex;
+         bool alpha;
+         Memory::Allocation level_memory; // Top level, or the whole file for DDS.
+         Memory::Allocation mipmap_memory;
    };
+
+   // Decodes a PNG or TGA file to RGBA8, without touching GL.
+   // On success, data is allocated with malloc() and owned by the caller.
+   bool load_image_rgba(const std::string& path, uint8_t*& data, unsigned& width, unsigned& height);
+
+#ifndef GLES
+   // Reads a DDS file without touching GL. Returns the size of all its levels in bytes, 0 on failure.
+   size_t read_dds(const std::string& path);
+#endif
 }
 
 #endif
@@ -0,0 +1,164 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread_pool.hpp"
+#include <algorithm>
+
+#ifdef HAVE_THREADS
+#include <unistd.h>
+#endif
+
+namespace Threading
+{
+   unsigned cpu_count()
+   {
+#if defined(HAVE_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      if (cpus > 0)
+         return cpus;
+#endif
+      return 1;
+   }
+
+#ifdef HAVE_THREADS
+   ThreadPool::ThreadPool(unsigned threads) :
+      num_threads(threads ? threads : cpu_count()),
+      func(0), data(0), count(0), grain(1), next(0), remaining(0),
+      job_id(0), shutdown(false)
+   {
+      pthread_mutex_init(&lock, NULL);
+      pthread_cond_init(&work_cond, NULL);
+      pthread_cond_init(&done_cond, NULL);
+
+      // The caller is one of the threads.
+      for (unsigned i = 1; i < num_threads; i++)
+      {
+         pthread_t thread;
+         if (pthread_create(&thread, NULL, worker_entry, this) != 0)
+            break;
+         workers.push_back(thread);
+      }
+
+      num_threads = workers.size() + 1;
+   }
+
+   ThreadPool::~ThreadPool()
+   {
+      pthread_mutex_lock(&lock);
+      shutdown = true;
+      pthread_cond_broadcast(&work_cond);
+      pthread_mutex_unlock(&lock);
+
+      for (unsigned i = 0; i < workers.size(); i++)
+         pthread_join(workers[i], NULL);
+
+      pthread_cond_destroy(&done_cond);
+      pthread_cond_destroy(&work_cond);
+      pthread_mutex_destroy(&lock);
+   }
+
+   void *ThreadPool::worker_entry(void *self)
+   {
+      static_cast<ThreadPool*>(self)->worker_loop();
+      return NULL;
+   }
+
+   // Called with lock held. Grabs and runs one chunk with the lock released.
+   bool ThreadPool::run_chunk()
+   {
+      if (next >= count)
+         return false;
+
+      std::size_t begin = next;
+      std::size_t end = std::min(count, begin + grain);
+      next = end;
+
+      RangeFunc cb = func;
+      void *cb_data = data;
+
+      pthread_mutex_unlock(&lock);
+      cb(cb_data, begin, end);
+      pthread_mutex_lock(&lock);
+
+      remaining -= end - begin;
+      if (!remaining)
+         pthread_cond_broadcast(&done_cond);
+      return true;
+   }
+
+   void ThreadPool::worker_loop()
+   {
+      pthread_mutex_lock(&lock);
+      unsigned seen_job = job_id;
+
+      for (;;)
+      {
+         while (!shutdown && seen_job == job_id)
+            pthread_cond_wait(&work_cond, &lock);
+
+         if (shutdown)
+            break;
+
+         seen_job = job_id;
+         while (run_chunk());
+      }
+
+      pthread_mutex_unlock(&lock);
+   }
+
+   void ThreadPool::parallel_for(std::size_t count_, std::size_t grain_, RangeFunc func_, void *data_)
+   {
+      if (!count_)
+         return;
+
+      if (workers.empty())
+      {
+         func_(data_, 0, count_);
+         return;
+      }
+
+      pthread_mutex_lock(&lock);
+      func = func_;
+      data = data_;
+      count = count_;
+      grain = std::max<std::size_t>(grain_, 1);
+      next = 0;
+      remaining = count_;
+      job_id++;
+      pthread_cond_broadcast(&work_cond);
+
+      while (run_chunk());
+      while (remaining)
+         pthread_cond_wait(&done_cond, &lock);
+
+      pthread_mutex_unlock(&lock);
+   }
+#else
+   ThreadPool::ThreadPool(unsigned) : num_threads(1)
+   {}
+
+   ThreadPool::~ThreadPool()
+   {}
+
+   void ThreadPool::parallel_for(std::size_t count, std::size_t, RangeFunc func, void *data)
+   {
+      if (count)
+         func(data, 0, count);
+   }
+#endif
+}
+
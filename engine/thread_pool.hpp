@@ -0,0 +1,81 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREAD_POOL_HPP__
+#define THREAD_POOL_HPP__
+
+#include <cstddef>
+#include <vector>
+
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#endif
+
+namespace Threading
+{
+   typedef void (*RangeFunc)(void *data, std::size_t begin, std::size_t end);
+
+   // Number of CPUs we can run on, at least 1.
+   unsigned cpu_count();
+
+   // Fixed set of worker threads which chew through ranges of work.
+   // Without HAVE_THREADS, everything runs on the calling thread.
+   class ThreadPool
+   {
+      public:
+         // 0 threads means one per CPU.
+         ThreadPool(unsigned threads = 0);
+         ~ThreadPool();
+
+         // Total number of threads doing work, including the caller.
+         unsigned size() const { return num_threads; }
+
+         // Calls func over [0, count) in chunks of at most grain items and blocks until done.
+         // The calling thread helps out.
+         void parallel_for(std::size_t count, std::size_t grain, RangeFunc func, void *data);
+
+      private:
+         unsigned num_threads;
+
+#ifdef HAVE_THREADS
+         std::vector<pthread_t> workers;
+         pthread_mutex_t lock;
+         pthread_cond_t work_cond;
+         pthread_cond_t done_cond;
+
+         // Current job, protected by lock.
+         RangeFunc func;
+         void *data;
+         std::size_t count;
+         std::size_t grain;
+         std::size_t next;
+         std::size_t remaining;
+         unsigned job_id;
+         bool shutdown;
+
+         static void *worker_entry(void *self);
+         void worker_loop();
+         bool run_chunk();
+#endif
+
+         ThreadPool(const ThreadPool&);
+         void operator=(const ThreadPool&);
+   };
+}
+
+#endif
+
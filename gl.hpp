@@ -76,7 +76,15 @@ namespace GL
    // in destructors.
    extern bool dead_state;
 
-   typedef std::map<std::string, retro_proc_address_t> SymMap;
+   struct Symbol
+   {
+      Symbol() : proc(NULL), calls(0) {}
+
+      retro_proc_address_t proc;
+      uint64_t calls; // Every call goes through symbol(), so this counts GL calls.
+   };
+
+   typedef std::map<std::string, Symbol> SymMap;
 
    SymMap& symbol_map();
    void init_symbol_map();
@@ -89,17 +97,16 @@ namespace GL
    template<typename Func>
    inline Func symbol(const std::string& sym)
    {
-      std::map<std::string, retro_proc_address_t>& map = symbol_map();
-      
-      retro_proc_address_t func = map[sym];
-      if (!func)
+      Symbol& entry = symbol_map()[sym];
+      if (!entry.proc)
       {
-         func = get_symbol(sym);
-         if (!func && log_cb)
+         entry.proc = get_symbol(sym);
+         if (!entry.proc && log_cb)
             log_cb(RETRO_LOG_ERROR, "Didn't find GL symbol: %s\n", sym.c_str());
       }
 
-      return reinterpret_cast<Func>(func);
+      entry.calls++;
+      return reinterpret_cast<Func>(entry.proc);
    }
 }
 
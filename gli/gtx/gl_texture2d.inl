@@ -176,7 +176,7 @@ namespace detail
 
 }//namespace detail
 
-	inline GLuint createTexture2D(std::string const & Filename, unsigned *levels)
+	inline GLuint createTexture2D(std::string const & Filename, unsigned *levels, gli::format *format)
 	{
 		gli::texture2D Texture(gli::loadStorageDDS(Filename));
 		if(Texture.empty())
@@ -199,6 +199,8 @@ namespace detail
 
       if (levels)
          *levels = Texture.levels();
+      if (format)
+         *format = Texture.format();
 
       unsigned bpp = gli::bits_per_pixel(Texture.format());
       unsigned block_size = 8 * gli::block_size(Texture.format());
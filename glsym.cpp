@@ -38,6 +38,9 @@ namespace GL
          _D(glEnable),
          _D(glDisable),
          _D(glBlendFunc),
+         _D(glDepthMask),
+         _D(glDepthFunc),
+         _D(glColorMask),
          _D(glClearColor),
          _D(glTexImage2D),
          _D(glViewport),
@@ -74,13 +77,14 @@ namespace GL
          _D(glGenTextures),
          _D(glBindTexture),
          _D(glDrawArrays),
+         _D(glDrawElements),
          _D(glGetError),
          _D(glFrontFace),
       };
 #undef _D
 
       for (unsigned i = 0; i < sizeof(bind_map) / sizeof(bind_map[0]); i++)
-         map[bind_map[i].sym] = bind_map[i].proc;
+         map[bind_map[i].sym].proc = bind_map[i].proc;
    }
 
    static retro_hw_get_proc_address_t proc;
@@ -19,7 +19,7 @@ endif
 
 INCFLAGS = -I../ -I../engine
 LOCAL_SRC_FILES += $(wildcard ../*.cpp) $(wildcard ../engine/*.cpp) $(wildcard ../*.c)
-LOCAL_CXXFLAGS += -O2 -Wall -ffast-math -fexceptions -DGLES -DANDROID $(INCFLAGS)
+LOCAL_CXXFLAGS += -O2 -Wall -ffast-math -fexceptions -DGLES -DANDROID -DHAVE_THREADS $(INCFLAGS)
 LOCAL_CFLAGS += $(INCFLAGS)
 LOCAL_LDLIBS += -lz -llog -lGLESv2
 
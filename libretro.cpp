@@ -19,12 +19,22 @@
 #include "gl.hpp"
 #include "mesh.hpp"
 #include "object.hpp"
+#include "controller.hpp"
+#include "input_trace.hpp"
 #include "util.hpp"
+#include "stats.hpp"
+#include "profiler.hpp"
+#include "gpu_timer.hpp"
+#include "overlay.hpp"
+#include "memory.hpp"
 #include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <ctime>
 #include <string>
+#include <algorithm>
 #include <stdint.h>
 #include "shared.hpp"
-#include <assert.h>
 
 using namespace GL;
 using namespace glm;
@@ -45,6 +55,7 @@ using namespace std1;
 #endif
 static unsigned width = BASE_WIDTH;
 static unsigned height = BASE_HEIGHT;
+static const float fov_y = 45.0f; // Vertical, in degrees.
 
 static struct retro_hw_render_callback hw_render;
 retro_log_printf_t log_cb;
@@ -54,22 +65,106 @@ static retro_audio_sample_batch_t audio_batch_cb;
 static retro_environment_t environ_cb;
 static retro_input_poll_t input_poll_cb;
 static retro_input_state_t input_state_cb;
+static struct retro_perf_callback perf_cb;
 
 static string mesh_path;
 
 static vector<std1::shared_ptr<Mesh> > meshes;
-static std1::shared_ptr<Texture> blank;
+static vector<unsigned> opaque_meshes, transparent_meshes; // Indices into meshes, classified on load.
+static bool depth_prepass; // As the scene was loaded, meshes only have a position stream then.
 
 static vec3 player_size(0.4f, 0.8f, 0.4f);
 
-struct Triangle
+static Collision::World world;
+static const unsigned proxy_material = ~0u; // Material tag for collision-only triangles.
+static Collision::CharacterController player(vec3(0, 2, 0));
+static vector<unsigned> mesh_bodies; // Collision body for each moving mesh, ~0u otherwise.
+static Memory::Allocation collision_memory(Memory::COLLISION);
+
+// Rendering runs at fps, physics at a fixed physics_hz, whatever the frame rate.
+static unsigned fps = 60;
+static OBJ::LoadOptions load_options;
+static float lod_pixels = 1.0f; // Screen space error allowed for simplified meshes, 0 for full detail.
+static unsigned physics_hz = 60;
+static retro_usec_t frame_usec; // From the frontend, if it tells us. 0 otherwise.
+static const unsigned max_ticks_per_frame = 8;
+
+// Everything besides the player which carries over from one frame to the next.
+// Plain data, so savestates are a straight copy. Run-ahead and rewind save every frame.
+struct SimState
 {
-   vec3 a, b, c;
-   vec3 normal;
-   float n0;
+   uint64_t ticks;
+   uint64_t accumulator; // In microseconds times physics_hz, so ticks come out exact.
+   uint32_t input_frame; // Index into the input trace.
+   float previous_player_pos[3];
+   float view_deg_x;
+   float view_deg_y;
+   uint8_t old_jump;
+   uint8_t pending_jump;
+   uint8_t padding[2];
 };
+static SimState sim;
 
-static vector<Triangle> triangles;
+struct SaveState
+{
+   uint32_t magic;
+   uint32_t version;
+   uint32_t physics_hz; // Ticks and accumulator are scaled by this.
+   uint32_t padding;
+   SimState sim;
+   Collision::ControllerState player;
+};
+static const uint32_t save_magic = 0x54535753; // "SWST"
+static const uint32_t save_version = 2;
+
+// Input can be recorded to a trace next to the scene, and replayed bit for bit,
+// so benchmark runs follow the same path every time.
+enum TraceMode
+{
+   TRACE_OFF,
+   TRACE_RECORD,
+   TRACE_REPLAY
+};
+static TraceMode trace_mode;
+static Input::Trace trace;
+static string trace_path;
+static vector<retro_time_t> replay_frame_times;
+
+static Stats::LoadTimes last_load;
+static OBJ::LoadStats mesh_stats;
+
+// Performance overlay. The numbers are averages, refreshed every overlay_interval frames.
+struct OverlayStats
+{
+   retro_time_t cpu_usec;
+   double gpu_usec;
+   unsigned gpu_frames;
+   uint64_t triangles;
+   unsigned draws;
+   uint64_t prepass_triangles; // Depth pre-pass, kept apart so the shading numbers stay comparable.
+   unsigned prepass_draws;
+   unsigned frames;
+};
+static bool overlay_enabled;
+static const unsigned overlay_interval = 30;
+static OverlayStats overlay_stats;
+static std1::shared_ptr<Overlay> overlay;
+static std1::shared_ptr<GpuTimer> gpu_timer; // Not there without timer queries.
+static retro_time_t last_cpu_usec;
+
+const Stats::LoadTimes& Stats::load_times()
+{
+   return last_load;
+}
+
+Stats::VertexCache Stats::vertex_cache()
+{
+   VertexCache cache = {
+      mesh_stats.original.acmr(), mesh_stats.optimized.acmr(),
+      mesh_stats.original.atvr(), mesh_stats.optimized.atvr(),
+   };
+   return cache;
+}
 
 void retro_init(void)
 {
@@ -79,6 +174,15 @@ void retro_init(void)
       log_cb = log.log;
    else
       log_cb = NULL;
+
+   if (!environ_cb(RETRO_ENVIRONMENT_GET_PERF_INTERFACE, &perf_cb))
+      memset(&perf_cb, 0, sizeof(perf_cb));
+   Profiler::set_clock(perf_cb.get_time_usec);
+}
+
+static retro_time_t time_usec()
+{
+   return perf_cb.get_time_usec ? perf_cb.get_time_usec() : 0;
 }
 
 void retro_deinit(void)
@@ -104,7 +208,7 @@ void retro_get_system_info(struct retro_system_info *info)
 void retro_get_system_av_info(struct retro_system_av_info *info)
 {
    memset(info, 0, sizeof(*info));
-   info->timing.fps = 60.0;
+   info->timing.fps = fps;
    info->timing.sample_rate = 30000.0;
 
    info->geometry.base_width  = BASE_WIDTH;
@@ -132,6 +236,20 @@ void retro_set_environment(retro_environment_t cb)
          "Internal resolution; 320x240|360x480|480x272|512x384|512x512|640x240|640x448|640x480|720x576|800x600|960x720|1024x768" },
 #else
          "Internal resolution; 320x240|360x480|480x272|512x384|512x512|640x240|640x448|640x480|720x576|800x600|960x720|1024x768|1280x720|1280x960|1600x1200|1920x1080|1920x1440|1920x1600" },
+#endif
+      { "modelviewer_fps", "Frame rate (restart); 60|30|50|72|75|90|100|120|144|165|240" },
+      { "modelviewer_physics_hz", "Physics rate; 60|30|50|75|90|120|144|240" },
+      { "modelviewer_input_trace", "Input trace (restart); off|record|replay" },
+      { "modelviewer_profiler", "Profiler; off|on|capture" },
+      { "modelviewer_overlay", "Performance overlay; off|on" },
+      { "modelviewer_vertex_format", "Vertex format (restart); float|packed" },
+      { "modelviewer_mesh_optimize", "Optimize meshes (restart); on|off" },
+      { "modelviewer_lod_bias", "Level of detail error (pixels); 1|2|4|8|0.5|off" },
+      // Saves shading hidden pixels, but tilers already do that, and only pay for the extra pass.
+#if defined(GLES)
+      { "modelviewer_depth_prepass", "Depth pre-pass (restart); off|on" },
+#else
+      { "modelviewer_depth_prepass", "Depth pre-pass (restart); on|off" },
 #endif
       { NULL, NULL },
    };
@@ -164,425 +282,471 @@ void retro_set_video_refresh(retro_video_refresh_t cb)
    video_cb = cb;
 }
 
-// Probably not the most efficient way to do collision handling ... :)
-static inline bool inside_triangle(const Triangle& tri, const vec3& pos)
+// Reads the pad, and how long this frame is.
+static void read_input(Input::Frame& frame, retro_usec_t usec)
 {
-   vec3 real_normal = -tri.normal;
+   input_poll_cb();
 
-   vec3 ab = tri.b - tri.a;
-   vec3 ac = tri.c - tri.a;
-   vec3 ap = pos - tri.a;
-   vec3 bp = pos - tri.b;
-   vec3 bc = tri.c - tri.b;
+   memset(&frame, 0, sizeof(frame));
+   frame.usec = usec;
 
-   // Checks if point exists inside triangle.
-   if (dot(cross(ab, ap), real_normal) < 0.0f)
-      return false;
+   frame.analog[0] = input_state_cb(0, RETRO_DEVICE_ANALOG,
+         RETRO_DEVICE_INDEX_ANALOG_LEFT, RETRO_DEVICE_ID_ANALOG_X);
+   frame.analog[1] = input_state_cb(0, RETRO_DEVICE_ANALOG,
+         RETRO_DEVICE_INDEX_ANALOG_LEFT, RETRO_DEVICE_ID_ANALOG_Y);
+   frame.analog[2] = input_state_cb(0, RETRO_DEVICE_ANALOG,
+         RETRO_DEVICE_INDEX_ANALOG_RIGHT, RETRO_DEVICE_ID_ANALOG_X);
+   frame.analog[3] = input_state_cb(0, RETRO_DEVICE_ANALOG,
+         RETRO_DEVICE_INDEX_ANALOG_RIGHT, RETRO_DEVICE_ID_ANALOG_Y);
 
-   if (dot(cross(ap, ac), real_normal) < 0.0f)
-      return false;
+   for (unsigned i = 0; i <= RETRO_DEVICE_ID_JOYPAD_R3; i++)
+      if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, i))
+         frame.buttons |= 1u << i;
+}
 
-   if (dot(cross(bc, bp), real_normal) < 0.0f)
-      return false;
+// Looking around happens right away, at frame rate.
+// Walking is returned for the simulation to pick up.
+static Collision::ControllerInput handle_input(const Input::Frame& frame)
+{
+   int analog_x = frame.analog[0];
+   int analog_y = frame.analog[1];
+   int analog_rx = frame.analog[2];
+   int analog_ry = frame.analog[3];
 
-   return true;
-}
+   bool new_jump = frame.pressed(RETRO_DEVICE_ID_JOYPAD_B);
 
-static const float twiddle_factor = -0.5f;
+   bool jump = new_jump && !sim.old_jump;
+   sim.old_jump = new_jump;
 
-// Here be dragons. 2-3 pages of mathematical derivations.
-static inline float point_crash_time(const vec3& pos, const vec3& v, const vec3& edge)
-{
-   vec3 l = pos - edge;
+   bool run_pressed = frame.pressed(RETRO_DEVICE_ID_JOYPAD_Y);
+   bool mouselook_pressed = frame.pressed(RETRO_DEVICE_ID_JOYPAD_X);
 
-   float A = dot(v, v);
-   float B = 2 * dot(l, v);
-   float C = dot(l, l) - 1;
+   if (frame.pressed(RETRO_DEVICE_ID_JOYPAD_LEFT))
+      analog_rx = run_pressed ? -32767 : -16384;
+   if (frame.pressed(RETRO_DEVICE_ID_JOYPAD_RIGHT))
+      analog_rx = run_pressed ? 32767 : 16384;
 
-   float d = B * B - 4.0f * A * C;
-   if (d < 0.0f) // No solution, can't hit the sphere ever.
-      return 10.0f; // Return number > 1.0f to signal no collision. Makes taking min() easier.
+   if (frame.pressed(RETRO_DEVICE_ID_JOYPAD_UP))
+   {
+      if (mouselook_pressed)
+         analog_ry = run_pressed ? -32767 : -16384;
+      else
+         analog_y = run_pressed ? -32767 : -16384;
+   }
 
-   float d_sqrt = std::sqrt(d);
-   float sol0 = (-B + d_sqrt) / (2.0f * A);
-   float sol1 = (-B - d_sqrt) / (2.0f * A);
-   if (sol0 >= twiddle_factor && sol1 >= twiddle_factor)
-      return std::min(sol0, sol1);
-   else if (sol0 >= twiddle_factor && sol1 < twiddle_factor)
-      return sol0;
-   else if (sol0 < twiddle_factor && sol1 >= twiddle_factor)
-      return sol1;
+   if (frame.pressed(RETRO_DEVICE_ID_JOYPAD_DOWN))
+   {
+      if (mouselook_pressed)
+         analog_ry = run_pressed ? 32767 : 16384;
+      else
+         analog_y = run_pressed ? 32767 : 16384;
+   }
 
-   return 10.0f;
-}
 
-static inline float line_crash_time(const vec3& pos, const vec3& v, const vec3& a, const vec3& b, vec3& crash_pos)
-{
-   crash_pos = vec3(0.0f);
+   if (frame.pressed(RETRO_DEVICE_ID_JOYPAD_L))
+      analog_x = run_pressed ? -32767 : -16384;
 
-   vec3 ab = b - a;
-   vec3 d = pos - a;
+   if (frame.pressed(RETRO_DEVICE_ID_JOYPAD_R))
+      analog_x = run_pressed ? 32767 : 16384;
 
-   float ab_sqr = dot(ab, ab);
-   float T = dot(ab, v) / ab_sqr;
-   float S = dot(ab, d) / ab_sqr;
+   if (abs(analog_x) < 10000)
+      analog_x = 0;
+   if (abs(analog_y) < 10000)
+      analog_y = 0;
+   if (abs(analog_rx) < 10000)
+      analog_rx = 0;
+   if (abs(analog_ry) < 10000)
+      analog_ry = 0;
 
-   vec3 V = v - vec3(T) * ab;
-   vec3 W = d - vec3(S) * ab;
+#if 0
+   if (log_cb)
+   {
+      log_cb(RETRO_LOG_INFO, "analog_x: %d\n", analog_x);
+      log_cb(RETRO_LOG_INFO, "analog_y: %d\n", analog_y);
+      log_cb(RETRO_LOG_INFO, "analog_rx: %d\n", analog_rx);
+      log_cb(RETRO_LOG_INFO, "analog_ry: %d\n", analog_ry);
+   }
+#endif
 
-   float A = dot(V, V);
-   float B = 2.0f * dot(V, W);
-   float C = dot(W, W) - 1.0f;
+   // Speeds were tuned per frame at 60 fps.
+   float frames = frame.usec * (60.0f / 1000000.0f);
+   sim.view_deg_y += analog_rx * -0.00008f * frames;
+   sim.view_deg_x += analog_ry * -0.00005f * frames;
 
-   float D = B * B - 4.0f * A * C; 
-   if (D < 0.0f) // No solutions exist :(
-      return 10.0f;
+   sim.view_deg_x = clamp(sim.view_deg_x, -80.0f, 80.0f);
+   
+   mat4 rotate_y = rotate(mat4(1.0), sim.view_deg_y, vec3(0, 1, 0));
+   mat4 rotate_y_right = rotate(mat4(1.0), sim.view_deg_y - 90.0f, vec3(0, 1, 0));
 
-   float D_sqrt = std::sqrt(D);
-   float sol0 = (-B + D_sqrt) / (2.0f * A);
-   float sol1 = (-B - D_sqrt) / (2.0f * A);
+   vec3 right_walk_dir = vec3(rotate_y_right * vec4(0, 0, -1, 1));
+   vec3 front_walk_dir = vec3(rotate_y * vec4(0, 0, -1, 1));
 
-   float solution;
-   if (sol0 >= twiddle_factor && sol1 >= twiddle_factor)
-      solution = std::min(sol0, sol1);
-   else if (sol0 >= twiddle_factor && sol1 < twiddle_factor)
-      solution = sol0;
-   else if (sol0 < twiddle_factor && sol1 >= twiddle_factor)
-      solution = sol1;
-   else
-      return 10.0f;
+   vec3 velocity = front_walk_dir * vec3(analog_y * -0.000002f) +
+      right_walk_dir * vec3(analog_x * 0.000002f);
 
-   // Check if solution hits the actual line ...
-   float k = dot(ab, d + vec3(solution) * v) / ab_sqr;
-   if (k >= 0.0f && k <= 1.0f)
-   {
-      crash_pos = a + vec3(k) * ab;
-      return solution;
-   }
-   else
-      return 10.0f;
+   Collision::ControllerInput input;
+   input.walk = velocity * vec3(60.0f);
+   input.jump = jump;
+   return input;
 }
-/////////// End dragons
 
-static void wall_hug_detection(vec3& player_pos)
+// Places the camera between the last two simulation steps, alpha of the way.
+static void update_camera(float alpha)
 {
-   float min_dist = 1.0f;
-   const Triangle *closest_triangle_hug = 0;
+   mat4 rotate_x = rotate(mat4(1.0), sim.view_deg_x, vec3(1, 0, 0));
+   mat4 rotate_y = rotate(mat4(1.0), sim.view_deg_y, vec3(0, 1, 0));
+   vec3 look_dir = vec3(rotate_y * rotate_x * vec4(0, 0, -1, 1));
 
-   for (unsigned i = 0; i < triangles.size(); i++)
-   {
-      const Triangle& tri = triangles[i];
-      float plane_dist = tri.n0 - dot(player_pos, tri.normal); 
+   vec3 player_pos = mix(make_vec3(sim.previous_player_pos), player.get_pos(), alpha);
 
-      // Might be hugging too close.
-      if (plane_dist >= -0.01f && plane_dist < min_dist)
-      {
-         vec3 projected_pos = player_pos + tri.normal * vec3(plane_dist); 
-         if (inside_triangle(tri, projected_pos))
-         {
-            min_dist = plane_dist;
-            closest_triangle_hug = &tri;
-         }
-      }
-   }
+   mat4 view = lookAt(player_pos, player_pos + look_dir, vec3(0, 1, 0));
+
+   // An object space error of lod_threshold * distance covers lod_pixels on screen.
+   float lod_threshold = lod_pixels * 2.0f * tan(radians(fov_y * 0.5f)) / height;
 
-   if (closest_triangle_hug)
+   for (unsigned i = 0; i < meshes.size(); i++)
    {
-#if 0
-      if (log_cb)
-         log_cb(RETRO_LOG_INFO, "Fixup hugging: Dist: %.6f.\n", min_dist);
-#endif
-      // Push player out.
-      player_pos += vec3(min_dist - 1.0f) * closest_triangle_hug->normal;
+      meshes[i]->set_view(view);
+      meshes[i]->set_eye(player_pos);
+      meshes[i]->set_lod_threshold(lod_threshold);
    }
 }
 
-static void collision_detection(vec3& player_pos, vec3& velocity)
+// Profiles go to the save directory, or next to the scene if the frontend has none.
+static void write_profile()
 {
-   if (velocity == vec3(0.0))
-      return;
-
-   float min_time = 1.0f;
-   bool crash = false;
-   vec3 crash_point = vec3(0.0f);
+   const char *dir = NULL;
+   string base = environ_cb(RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY, &dir) && dir && *dir ?
+      string(dir) : Path::basedir(mesh_path);
 
-   const Triangle *closest_triangle = 0;
+   char name[64];
+   snprintf(name, sizeof(name), "scenewalker-profile-%lu.json", (unsigned long)time(NULL));
+   string path = Path::join(base, name);
 
-   for (unsigned i = 0; i < triangles.size(); i++)
-   {
-      const Triangle& tri = triangles[i];
+   if (!Profiler::write_trace(path) && log_cb)
+      log_cb(RETRO_LOG_WARN, "Profiler: Failed to write trace to %s.\n", path.c_str());
+}
 
-      float plane_dist = tri.n0 - dot(player_pos, tri.normal); 
-      float towards_plane_v = dot(velocity, tri.normal);
+static void update_variables()
+{
+   retro_variable var;
+   var.key = "modelviewer_resolution";
+   var.value = NULL;
 
-      if (towards_plane_v > 0.00001f) // We're moving towards the plane.
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      vector<string> list = String::split(var.value, "x");
+      if (list.size() == 2)
       {
-         float ticks_to_hit = (plane_dist - 1.0f) / towards_plane_v;
-
-         // We'll hit the plane in this frame.
-         if (ticks_to_hit >= 0.0f && ticks_to_hit < min_time)
-         {
-            vec3 projected_pos = (player_pos + tri.normal) + vec3(ticks_to_hit) * velocity; 
-
-            if (inside_triangle(tri, projected_pos))
-            {
-               min_time = ticks_to_hit;
-               closest_triangle = &tri;
-               crash = false;
-            }
-
-         }
-         else if (plane_dist >= 0.0f && plane_dist < 1.0f + towards_plane_v) // Can potentially hit vertex ...
-         {
-            vec3 crash_pos_tmp;
-            vec3 crash_pos_ab, crash_pos_ac, crash_pos_bc;
-
-            // Check how we can hit the triangle. Can hit edges or lines ...
-            float min_time_crash = point_crash_time(player_pos, velocity, tri.a);
-            crash_pos_tmp = tri.a;
-
-            float time_point_b = point_crash_time(player_pos, velocity, tri.b);
-            if (time_point_b < min_time_crash)
-            {
-               crash_pos_tmp  = tri.b;
-               min_time_crash = time_point_b;
-            }
-
-            float time_point_c = point_crash_time(player_pos, velocity, tri.c);
-            if (time_point_c < min_time_crash)
-            {
-               crash_pos_tmp  = tri.c;
-               min_time_crash = time_point_c; 
-            }
-
-            float time_line_ab = line_crash_time(player_pos, velocity, tri.a, tri.b, crash_pos_ab);
-            if (time_line_ab < min_time_crash)
-            {
-               crash_pos_tmp = crash_pos_ab;
-               min_time_crash = time_line_ab;
-            }
-
-            float time_line_ac = line_crash_time(player_pos, velocity, tri.a, tri.c, crash_pos_ac);
-            if (time_line_ac < min_time_crash)
-            {
-               crash_pos_tmp = crash_pos_ac;
-               min_time_crash = time_line_ac;
-            }
-
-            float time_line_bc = line_crash_time(player_pos, velocity, tri.b, tri.c, crash_pos_bc);
-            if (time_line_bc < min_time_crash)
-            {
-               crash_pos_tmp = crash_pos_bc;
-               min_time_crash = time_line_bc;
-            }
-
-            if (min_time_crash < min_time)
-            {
-               min_time = min_time_crash;
-               closest_triangle = &tri;
-               crash = true;
-               crash_point = crash_pos_tmp;
-            }
-         }
+         width = String::stoi(list[0]);
+         height = String::stoi(list[1]);
+         if (log_cb)
+            log_cb(RETRO_LOG_INFO, "Internal resolution: %u x %u\n", width, height);
       }
    }
 
-  
-   if (closest_triangle)
-   {
-      if (!crash)
-      {
-         vec3 normal = closest_triangle->normal;
-
-         // Move player to wall.
-         player_pos += vec3(1.0f * min_time) * velocity;
-
-         // Make velocity vector parallel with plane.
-         velocity -= vec3(dot(velocity, normal)) * normal;
+   // The frontend only asks for timing at load, so this one needs a restart.
+   var.key = "modelviewer_fps";
+   var.value = NULL;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && String::stoi(var.value) > 0)
+      fps = String::stoi(var.value);
 
-         // Used up some time moving to wall.
-         velocity *= vec3(1.0f - min_time);
-      }
-      else
+   var.key = "modelviewer_physics_hz";
+   var.value = NULL;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && String::stoi(var.value) > 0)
+   {
+      unsigned hz = String::stoi(var.value);
+      if (hz != physics_hz)
       {
-         // Avoid possible numerical inaccuracies by going fully to crash point.
-         player_pos += vec3(1.0f * min_time) * velocity;
-         vec3 normal = crash_point - player_pos;
-         velocity -= vec3(dot(velocity, normal) / dot(normal, normal)) * normal;
-         velocity *= vec3(1.0f - min_time);
+         // Keep the same fraction of a tick pending.
+         sim.accumulator = sim.accumulator * hz / physics_hz;
+         physics_hz = hz;
       }
    }
-}
-
-static void handle_input()
-{
-   static float player_view_deg_x;
-   static float player_view_deg_y;
-   static vec3 player_pos(0, 2, 0);
 
+   if (log_cb)
+      log_cb(RETRO_LOG_INFO, "Timing: %u fps, physics at %u Hz.\n", fps, physics_hz);
 
-   input_poll_cb();
+   // Capturing goes on until the option is changed again, or the game is unloaded.
+   var.key = "modelviewer_profiler";
+   var.value = NULL;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      bool capture = !strcmp(var.value, "capture");
+      if (!capture && Profiler::capturing())
+         write_profile();
 
-   int analog_x = input_state_cb(0, RETRO_DEVICE_ANALOG,
-         RETRO_DEVICE_INDEX_ANALOG_LEFT, RETRO_DEVICE_ID_ANALOG_X);
+      Profiler::set_enabled(capture || !strcmp(var.value, "on"));
+      if (capture && Profiler::enabled && !Profiler::capturing())
+         Profiler::start_capture();
+   }
 
-   int analog_y = input_state_cb(0, RETRO_DEVICE_ANALOG,
-         RETRO_DEVICE_INDEX_ANALOG_LEFT, RETRO_DEVICE_ID_ANALOG_Y);
+   // Meshes are packed as they are loaded.
+   var.key = "modelviewer_vertex_format";
+   var.value = NULL;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      load_options.format = !strcmp(var.value, "packed") ? VERTEX_PACKED : VERTEX_FLOAT;
 
-   int analog_ry = input_state_cb(0, RETRO_DEVICE_ANALOG,
-         RETRO_DEVICE_INDEX_ANALOG_RIGHT, RETRO_DEVICE_ID_ANALOG_Y);
+   // So is indexing and reordering them.
+   var.key = "modelviewer_mesh_optimize";
+   var.value = NULL;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      load_options.optimize = strcmp(var.value, "off");
 
-   int analog_rx = input_state_cb(0, RETRO_DEVICE_ANALOG,
-         RETRO_DEVICE_INDEX_ANALOG_RIGHT, RETRO_DEVICE_ID_ANALOG_X);
+   var.key = "modelviewer_depth_prepass";
+   var.value = NULL;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      load_options.depth_prepass = !strcmp(var.value, "on");
 
-   static bool old_jump;
-   bool new_jump = input_state_cb(0, RETRO_DEVICE_JOYPAD, 0,
-         RETRO_DEVICE_ID_JOYPAD_B);
+   var.key = "modelviewer_lod_bias";
+   var.value = NULL;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      lod_pixels = !strcmp(var.value, "off") ? 0.0f : String::stof(var.value);
 
-   bool jump = new_jump && !old_jump;
-   old_jump = new_jump;
+   var.key = "modelviewer_overlay";
+   var.value = NULL;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      overlay_enabled = !strcmp(var.value, "on");
+      memset(&overlay_stats, 0, sizeof(overlay_stats));
+   }
+}
 
-   bool run_pressed = input_state_cb(0, RETRO_DEVICE_JOYPAD, 0,
-         RETRO_DEVICE_ID_JOYPAD_Y);
-   bool mouselook_pressed = input_state_cb(0, RETRO_DEVICE_JOYPAD, 0,
-         RETRO_DEVICE_ID_JOYPAD_X);
+static void update_overlay(unsigned draws, uint64_t triangles,
+      unsigned prepass_draws, uint64_t prepass_triangles)
+{
+   if (!overlay)
+      overlay = std1::shared_ptr<Overlay>(new Overlay);
+   if (!gpu_timer && GpuTimer::supported())
+      gpu_timer = std1::shared_ptr<GpuTimer>(new GpuTimer);
+
+   overlay_stats.cpu_usec += last_cpu_usec;
+   overlay_stats.draws += draws;
+   overlay_stats.triangles += triangles;
+   overlay_stats.prepass_draws += prepass_draws;
+   overlay_stats.prepass_triangles += prepass_triangles;
+   double gpu_usec;
+   if (gpu_timer && gpu_timer->result(gpu_usec))
+   {
+      overlay_stats.gpu_usec += gpu_usec;
+      overlay_stats.gpu_frames++;
+   }
 
-   if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0,
-            RETRO_DEVICE_ID_JOYPAD_LEFT))
-      analog_rx = run_pressed ? -32767 : -16384;
-   if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0,
-            RETRO_DEVICE_ID_JOYPAD_RIGHT))
-      analog_rx = run_pressed ? 32767 : 16384;
+   if (++overlay_stats.frames < overlay_interval)
+      return;
 
-   if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0,
-            RETRO_DEVICE_ID_JOYPAD_UP))
+   const OverlayStats& s = overlay_stats;
+   vector<string> lines;
+   char line[64];
+   snprintf(line, sizeof(line), "CPU %6.2f MS", s.cpu_usec / (1000.0 * s.frames));
+   lines.push_back(line);
+   if (s.gpu_frames)
+      snprintf(line, sizeof(line), "GPU %6.2f MS", s.gpu_usec / (1000.0 * s.gpu_frames));
+   else
+      snprintf(line, sizeof(line), "GPU    N/A");
+   lines.push_back(line);
+   snprintf(line, sizeof(line), "DRAWS %u", s.draws / s.frames);
+   lines.push_back(line);
+   snprintf(line, sizeof(line), "TRIS %llu", (unsigned long long)(s.triangles / s.frames));
+   lines.push_back(line);
+   snprintf(line, sizeof(line), "MESHES %u/%u", s.draws / s.frames, (unsigned)meshes.size());
+   lines.push_back(line);
+   if (depth_prepass)
    {
-      if (mouselook_pressed)
-         analog_ry = run_pressed ? -32767 : -16384;
-      else
-         analog_y = run_pressed ? -32767 : -16384;
+      snprintf(line, sizeof(line), "PREPASS %u DRAWS %llu TRIS", s.prepass_draws / s.frames,
+            (unsigned long long)(s.prepass_triangles / s.frames));
+      lines.push_back(line);
    }
+   size_t texture_bytes = Memory::counter(Memory::TEXTURE_RGBA8).current +
+      Memory::counter(Memory::TEXTURE_COMPRESSED).current +
+      Memory::counter(Memory::TEXTURE_MIPMAPS).current;
+   snprintf(line, sizeof(line), "TEX %.1f MB", texture_bytes / (1024.0 * 1024.0));
+   lines.push_back(line);
+   snprintf(line, sizeof(line), "MEM %.1f MB PEAK %.1f", Memory::total().current / (1024.0 * 1024.0),
+         Memory::total().peak / (1024.0 * 1024.0));
+   lines.push_back(line);
+
+   overlay->set_text(lines);
+   memset(&overlay_stats, 0, sizeof(overlay_stats));
+}
+
+static void frame_time_cb(retro_usec_t usec)
+{
+   frame_usec = usec;
+}
+
+// Where a mesh with a motion is at a point in time.
+static mat4 motion_transform(const Material& material, double time)
+{
+   float phase = 0.5f - 0.5f * std::cos(2.0 * M_PI * time / material.motion_period);
+   return translate(mat4(1.0), material.motion * vec3(phase));
+}
 
-   if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0,
-            RETRO_DEVICE_ID_JOYPAD_DOWN))
+// Moves meshes with a motion along their path. Collision follows the simulation clock,
+// rendering is interpolated between ticks like the camera.
+static void update_bodies(double time, bool collision)
+{
+   bool moved = false;
+   for (unsigned i = 0; i < meshes.size(); i++)
    {
-      if (mouselook_pressed)
-         analog_ry = run_pressed ? 32767 : 16384;
-      else
-         analog_y = run_pressed ? 32767 : 16384;
-   }
+      if (mesh_bodies[i] == ~0u)
+         continue;
 
+      meshes[i]->set_model(motion_transform(meshes[i]->get_material(), time));
+      if (collision)
+      {
+         world.set_body_transform(mesh_bodies[i], meshes[i]->get_model());
+         moved = true;
+      }
+   }
 
-   if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0,
-            RETRO_DEVICE_ID_JOYPAD_L))
-      analog_x = run_pressed ? -32767 : -16384;
+   if (moved)
+      world.refit();
+}
 
-   if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0,
-            RETRO_DEVICE_ID_JOYPAD_R))
-      analog_x = run_pressed ? 32767 : 16384;
+static void set_previous_player_pos(const vec3& pos)
+{
+   for (unsigned i = 0; i < 3; i++)
+      sim.previous_player_pos[i] = pos[i];
+}
 
-   if (abs(analog_x) < 10000)
-      analog_x = 0;
-   if (abs(analog_y) < 10000)
-      analog_y = 0;
-   if (abs(analog_rx) < 10000)
-      analog_rx = 0;
-   if (abs(analog_ry) < 10000)
-      analog_ry = 0;
+// Runs as many fixed physics ticks as the time since last frame covers.
+// Returns how far we are into the next tick, in [0, 1).
+static float step_simulation(const Collision::ControllerInput& frame_input, retro_usec_t usec)
+{
+   sim.accumulator += usec * physics_hz;
+   sim.pending_jump |= frame_input.jump;
 
-#if 0
-   if (log_cb)
+   float dt = 1.0f / physics_hz;
+   unsigned ticks = 0;
+   while (sim.accumulator >= 1000000)
    {
-      log_cb(RETRO_LOG_INFO, "analog_x: %d\n", analog_x);
-      log_cb(RETRO_LOG_INFO, "analog_y: %d\n", analog_y);
-      log_cb(RETRO_LOG_INFO, "analog_rx: %d\n", analog_rx);
-      log_cb(RETRO_LOG_INFO, "analog_ry: %d\n", analog_ry);
-   }
-#endif
+      // Don't spiral if the device can't keep up. Drop time instead.
+      if (ticks++ == max_ticks_per_frame)
+      {
+         sim.accumulator %= 1000000;
+         break;
+      }
 
-   player_view_deg_y += analog_rx * -0.00008f;
-   player_view_deg_x += analog_ry * -0.00005f;
+      sim.ticks++;
+      {
+         PROFILE_ZONE("bodies");
+         update_bodies(double(sim.ticks) / physics_hz, true);
+      }
 
-   player_view_deg_x = clamp(player_view_deg_x, -80.0f, 80.0f);
-   
-   mat4 rotate_x = rotate(mat4(1.0), player_view_deg_x, vec3(1, 0, 0));
-   mat4 rotate_y = rotate(mat4(1.0), player_view_deg_y, vec3(0, 1, 0));
-   mat4 rotate_y_right = rotate(mat4(1.0), player_view_deg_y - 90.0f, vec3(0, 1, 0));
+      Collision::ControllerInput input = frame_input;
+      input.jump = sim.pending_jump;
+      sim.pending_jump = false;
 
-   vec3 look_dir = vec3(rotate_y * rotate_x * vec4(0, 0, -1, 1));
+      set_previous_player_pos(player.get_pos());
+      {
+         PROFILE_ZONE("controller");
+         player.step(world, input, dt);
+      }
+      sim.accumulator -= 1000000;
+   }
 
-   vec3 right_walk_dir = vec3(rotate_y_right * vec4(0, 0, -1, 1));
-   vec3 front_walk_dir = vec3(rotate_y * vec4(0, 0, -1, 1));
+   return sim.accumulator / 1000000.0f;
+}
 
-   vec3 velocity = front_walk_dir * vec3(analog_y * -0.000002f) +
-      right_walk_dir * vec3(analog_x * 0.000002f);
+static void log_replay_summary()
+{
+   if (!log_cb || replay_frame_times.empty())
+      return;
 
-   vec3 player_pos_espace = player_pos / player_size;
-   vec3 velocity_espace = velocity / player_size;
+   vector<retro_time_t> times = replay_frame_times;
+   sort(times.begin(), times.end());
 
-   collision_detection(player_pos_espace, velocity_espace);
-   player_pos_espace += velocity_espace;
-   wall_hug_detection(player_pos_espace);
+   retro_time_t total = 0;
+   for (unsigned i = 0; i < times.size(); i++)
+      total += times[i];
 
-   static vec3 gravity;
-   static bool can_jump;
-   gravity += vec3(0.0f, -0.01f, 0.0f);
-   if (can_jump && jump)
-   {
-      gravity[1] += 0.3f;
-      can_jump = false;
-   }
-   gravity[1] -= gravity[1] * 0.01f;
+   size_t n = times.size();
+   log_cb(RETRO_LOG_INFO, "Replay: %u frames, frame time avg %.3f ms, p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms.\n",
+         (unsigned)n, total / (1000.0 * n),
+         times[n / 2] / 1000.0, times[n * 95 / 100] / 1000.0, times[n * 99 / 100] / 1000.0,
+         times[n - 1] / 1000.0);
+}
 
-   vec3 old_gravity = gravity;
-   collision_detection(player_pos_espace, gravity);
-   if (old_gravity[1] != gravity[1])
+// Swaps in recorded input when replaying, and takes note of it when recording.
+static void trace_input(Input::Frame& frame)
+{
+   if (trace_mode == TRACE_RECORD)
+      trace.record(sim.input_frame, frame);
+   else if (trace_mode == TRACE_REPLAY && !trace.get(sim.input_frame, frame))
    {
-      gravity = vec3(0.0f);
-      can_jump = true;
+      // Out of input. Hand control back.
+      log_replay_summary();
+      replay_frame_times.clear();
+      trace_mode = TRACE_OFF;
    }
 
-   player_pos_espace += gravity;
-   wall_hug_detection(player_pos_espace);
+   sim.input_frame++;
+}
 
-   player_pos = player_pos_espace * player_size;
+struct DrawOrder
+{
+   float depth;
+   unsigned mesh;
+};
 
-   mat4 view = lookAt(player_pos, player_pos + look_dir, vec3(0, 1, 0));
+static bool nearer(const DrawOrder& a, const DrawOrder& b)
+{
+   return a.depth < b.depth;
+}
 
-   for (unsigned i = 0; i < meshes.size(); i++)
+static bool farther(const DrawOrder& a, const DrawOrder& b)
+{
+   return a.depth > b.depth;
+}
+
+// Sorted by view depth, front to back or back to front. Reused, so frames don't allocate.
+static const vector<DrawOrder>& sort_draws(const vector<unsigned>& indices, bool front_to_back)
+{
+   static vector<DrawOrder> order;
+   order.resize(indices.size());
+   for (unsigned i = 0; i < indices.size(); i++)
    {
-      meshes[i]->set_view(view);
-      meshes[i]->set_eye(player_pos);
+      order[i].depth = meshes[indices[i]]->get_view_depth();
+      order[i].mesh = indices[i];
    }
+   sort(order.begin(), order.end(), front_to_back ? nearer : farther);
+   return order;
 }
 
-static void update_variables()
+static void run_frame()
 {
-   retro_variable var;
-   var.key = "modelviewer_resolution";
-   var.value = NULL;
+   PROFILE_ZONE("frame");
 
-   if (!environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) || !var.value)
-      return;
+   retro_usec_t usec = frame_usec ? frame_usec : 1000000 / fps;
+   frame_usec = 0;
 
-   vector<string> list = String::split(var.value, "x");
-   if (list.size() != 2)
-      return;
+   Input::Frame frame;
+   Collision::ControllerInput input;
+   {
+      PROFILE_ZONE("input");
+      read_input(frame, usec);
+      trace_input(frame);
+      input = handle_input(frame);
+   }
 
-   width = String::stoi(list[0]);
-   height = String::stoi(list[1]);
-   if (log_cb)
-      log_cb(RETRO_LOG_INFO, "Internal resolution: %u x %u\n", width, height);
-}
+   float alpha;
+   {
+      PROFILE_ZONE("simulation");
+      alpha = step_simulation(input, frame.usec);
+   }
 
-void retro_run(void)
-{
-   handle_input();
+   {
+      PROFILE_ZONE("camera");
+      update_bodies((double(sim.ticks) - 1.0 + alpha) / physics_hz, false);
+      update_camera(alpha);
+   }
 
    bool updated = false;
    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated)
       update_variables();
 
+   PROFILE_ZONE("render");
    GLuint fb = hw_render.get_current_framebuffer();
    SYM(glBindFramebuffer)(GL_FRAMEBUFFER, fb);
    SYM(glViewport)(0, 0, width, height);
@@ -592,10 +756,76 @@ void retro_run(void)
    SYM(glEnable)(GL_DEPTH_TEST);
    SYM(glFrontFace)(GL_CW); // When we flip vertically, orientation changes.
    SYM(glEnable)(GL_CULL_FACE);
-   SYM(glEnable)(GL_BLEND);
 
-   for (unsigned i = 0; i < meshes.size(); i++)
-      meshes[i]->render();
+   if (gpu_timer && overlay_enabled)
+      gpu_timer->begin();
+
+   unsigned draws = 0;
+   uint64_t triangles = 0;
+   unsigned prepass_draws = 0;
+   uint64_t prepass_triangles = 0;
+
+   // Opaque front to back without blending, so the depth test rejects as much as it can.
+   {
+      const vector<DrawOrder>& order = sort_draws(opaque_meshes, true);
+
+      // With the pre-pass, depth is final before shading starts, and only visible pixels are shaded.
+      if (depth_prepass)
+      {
+         PROFILE_ZONE("depth_prepass");
+         SYM(glColorMask)(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+         for (unsigned i = 0; i < order.size(); i++)
+         {
+            meshes[order[i].mesh]->render_depth();
+            prepass_draws++;
+            prepass_triangles += meshes[order[i].mesh]->get_drawn_triangle_count();
+         }
+         SYM(glColorMask)(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+         SYM(glDepthFunc)(GL_LEQUAL);
+         SYM(glDepthMask)(GL_FALSE);
+      }
+
+      for (unsigned i = 0; i < order.size(); i++)
+      {
+         meshes[order[i].mesh]->render();
+         draws++;
+         triangles += meshes[order[i].mesh]->get_drawn_triangle_count();
+      }
+
+      if (depth_prepass)
+      {
+         SYM(glDepthFunc)(GL_LESS);
+         SYM(glDepthMask)(GL_TRUE);
+      }
+   }
+
+   // Then transparent back to front over it. They don't write depth, so they can't hide each other.
+   if (!transparent_meshes.empty())
+   {
+      SYM(glEnable)(GL_BLEND);
+      SYM(glBlendFunc)(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      SYM(glDepthMask)(GL_FALSE);
+
+      const vector<DrawOrder>& order = sort_draws(transparent_meshes, false);
+      for (unsigned i = 0; i < order.size(); i++)
+      {
+         meshes[order[i].mesh]->render();
+         draws++;
+         triangles += meshes[order[i].mesh]->get_drawn_triangle_count();
+      }
+
+      SYM(glDepthMask)(GL_TRUE);
+      SYM(glBlendFunc)(GL_ONE, GL_ZERO);
+   }
+
+   if (gpu_timer && overlay_enabled)
+      gpu_timer->end();
+
+   if (overlay_enabled)
+   {
+      update_overlay(draws, triangles, prepass_draws, prepass_triangles);
+      overlay->render(width, height);
+   }
 
    SYM(glDisable)(GL_BLEND);
    SYM(glDisable)(GL_DEPTH_TEST);
@@ -604,27 +834,54 @@ void retro_run(void)
    video_cb(RETRO_HW_FRAME_BUFFER_VALID, width, height, 0);
 }
 
+void retro_run(void)
+{
+   retro_time_t start = time_usec();
+   run_frame();
+   Profiler::end_frame();
+   last_cpu_usec = time_usec() - start;
+
+   if (trace_mode == TRACE_REPLAY)
+      replay_frame_times.push_back(time_usec() - start);
+}
+
 static void init_mesh(const string& path)
 {
    if (log_cb)
       log_cb(RETRO_LOG_INFO, "Loading Mesh ...\n");
 
+   // invariant gl_Position keeps the depth pre-pass and the shading pass bit-exact.
+   // Desktop GLSL only has it from 1.20, GLES 1.00 has it without a #version.
+#ifdef GLES
+   static const string vertex_shader_version = "";
+#else
+   static const string vertex_shader_version = "#version 120\n";
+#endif
+
    static const string vertex_shader =
+      vertex_shader_version +
       "uniform mat4 uModel;\n"
       "uniform mat4 uMVP;\n"
       "attribute vec4 aVertex;\n"
       "attribute vec3 aNormal;\n"
       "attribute vec2 aTex;\n"
+      "uniform vec3 uPosScale;\n"
+      "uniform vec3 uPosOffset;\n"
+      "uniform vec2 uTexScale;\n"
+      "uniform vec2 uTexOffset;\n"
       "varying vec4 vNormal;\n"
       "varying vec2 vTex;\n"
       "varying vec4 vPos;\n"
+      "invariant gl_Position;\n"
       "void main() {\n"
-      "  gl_Position = uMVP * aVertex;\n"
-      "  vTex = aTex;\n"
-      "  vPos = uModel * aVertex;\n"
+      "  vec4 vertex = vec4(aVertex.xyz * uPosScale + uPosOffset, 1.0);\n"
+      "  gl_Position = uMVP * vertex;\n"
+      "  vTex = aTex * uTexScale + uTexOffset;\n"
+      "  vPos = uModel * vertex;\n"
       "  vNormal = uModel * vec4(aNormal, 0.0);\n"
       "}";
 
+   // One variant per combination of GL::ShaderFeature the scene's materials use.
    static const string fragment_shader =
       "#ifdef GL_ES\n"
       "precision mediump float;\n"
@@ -646,13 +903,31 @@ static void init_mesh(const string& path)
       "uniform float uMTLSpecularPower;\n"
 
       "void main() {\n"
+      "#ifdef DIFFUSE_MAP\n"
       "  vec4 colorDiffuseFull = texture2D(sDiffuse, vTex);\n"
+      "#else\n"
+      "  vec4 colorDiffuseFull = vec4(1.0);\n"
+      "#endif\n"
+      "#ifdef AMBIENT_MAP\n"
       "  vec4 colorAmbientFull = texture2D(sAmbient, vTex);\n"
+      "#else\n"
+      "  vec4 colorAmbientFull = colorDiffuseFull;\n"
+      "#endif\n"
 
       "  vec3 lightDir = normalize(vPos.xyz - uLightPos);\n"
 
+      "#ifdef TEXTURE_ALPHA\n"
       "  vec3 colorDiffuse = mix(uMTLDiffuse, colorDiffuseFull.rgb, vec3(colorDiffuseFull.a));\n"
       "  vec3 colorAmbient = mix(uMTLAmbient, colorAmbientFull.rgb, vec3(colorAmbientFull.a));\n"
+      "  float alpha = colorDiffuseFull.a;\n"
+      "#else\n"
+      "  vec3 colorDiffuse = colorDiffuseFull.rgb;\n"
+      "  vec3 colorAmbient = colorAmbientFull.rgb;\n"
+      "  float alpha = 1.0;\n"
+      "#endif\n"
+      "#ifdef ALPHA_MOD\n"
+      "  alpha *= uMTLAlphaMod;\n"
+      "#endif\n"
 
       "  vec3 normal = normalize(vNormal.xyz);\n"
       "  float directivity = dot(lightDir, -normal);\n"
@@ -660,88 +935,232 @@ static void init_mesh(const string& path)
       "  vec3 diffuse = colorDiffuse * clamp(directivity, 0.0, 1.0);\n"
       "  vec3 ambient = colorAmbient * uLightAmbient;\n"
 
+      "#ifdef SPECULAR\n"
       "  vec3 modelToFace = normalize(uEyePos - vPos.xyz);\n"
       "  float specularity = pow(clamp(dot(modelToFace, reflect(lightDir, normal)), 0.0, 1.0), uMTLSpecularPower);\n"
       "  vec3 specular = uMTLSpecular * specularity;\n"
+      "#else\n"
+      "  vec3 specular = vec3(0.0);\n"
+      "#endif\n"
 
-      "  gl_FragColor = vec4(diffuse + ambient + specular, uMTLAlphaMod * colorDiffuseFull.a);\n"
+      "  gl_FragColor = vec4(diffuse + ambient + specular, alpha);\n"
       "}";
 
-   std1::shared_ptr<Shader> shader(new Shader(vertex_shader, fragment_shader));
-   meshes = OBJ::load_from_file(path);
+   // Positions only, transformed exactly as in vertex_shader, so the shading pass finds equal depths.
+   static const string depth_vertex_shader =
+      vertex_shader_version +
+      "uniform mat4 uMVP;\n"
+      "attribute vec4 aVertex;\n"
+      "uniform vec3 uPosScale;\n"
+      "uniform vec3 uPosOffset;\n"
+      "invariant gl_Position;\n"
+      "void main() {\n"
+      "  vec4 vertex = vec4(aVertex.xyz * uPosScale + uPosOffset, 1.0);\n"
+      "  gl_Position = uMVP * vertex;\n"
+      "}";
 
-   mat4 projection = scale(mat4(1.0), vec3(1, -1, 1)) * perspective(45.0f, 4.0f / 3.0f, 0.2f, 100.0f);
+   static const string depth_fragment_shader =
+      "#ifdef GL_ES\n"
+      "precision mediump float;\n"
+      "#endif\n"
+      "void main() {\n"
+      "  gl_FragColor = vec4(1.0);\n"
+      "}";
+
+   PROFILE_ZONE("load");
+
+   retro_time_t load_start = time_usec();
+   vector<vec3> proxies;
+   {
+      PROFILE_ZONE("scene");
+      meshes = OBJ::load_from_file(path, &proxies, load_options, &mesh_stats);
+   }
+   Memory::Allocation proxy_memory(Memory::LOADER, proxies.capacity() * sizeof(vec3));
+   retro_time_t scene_done = time_usec();
+
+   // Only the variants some material needs get compiled.
+   {
+      PROFILE_ZONE("shaders");
+      std1::shared_ptr<ShaderCache> shaders(new ShaderCache(vertex_shader, fragment_shader,
+               GL::shader_feature_names()));
+      for (unsigned i = 0; i < meshes.size(); i++)
+         meshes[i]->set_shader_cache(shaders);
+
+      if (log_cb)
+         log_cb(RETRO_LOG_INFO, "Shader: %u variants for %u meshes.\n",
+               (unsigned)shaders->size(), (unsigned)meshes.size());
+
+      depth_prepass = load_options.depth_prepass;
+      if (depth_prepass)
+      {
+         std1::shared_ptr<Shader> depth_shader(new Shader(depth_vertex_shader, depth_fragment_shader));
+         for (unsigned i = 0; i < meshes.size(); i++)
+            meshes[i]->set_depth_shader(depth_shader);
+      }
+   }
+   retro_time_t shaders_done = time_usec();
+
+   opaque_meshes.clear();
+   transparent_meshes.clear();
+   for (unsigned i = 0; i < meshes.size(); i++)
+      (meshes[i]->is_transparent() ? transparent_meshes : opaque_meshes).push_back(i);
+   if (log_cb)
+      log_cb(RETRO_LOG_INFO, "Mesh: %u opaque, %u transparent.\n",
+            (unsigned)opaque_meshes.size(), (unsigned)transparent_meshes.size());
+
+   PROFILE_ZONE("collision");
 
+   mat4 projection = scale(mat4(1.0), vec3(1, -1, 1)) * perspective(fov_y, 4.0f / 3.0f, 0.2f, 100.0f);
+
+   size_t collision_triangles = proxies.size() / 3;
+   for (unsigned i = 0; i < meshes.size(); i++)
+      if (meshes[i]->get_material().collide && meshes[i]->get_material().motion_period <= 0.0f)
+         collision_triangles += meshes[i]->get_drawn_triangle_count();
+   world.reserve(collision_triangles);
+
+   mesh_bodies.assign(meshes.size(), ~0u);
    for (unsigned i = 0; i < meshes.size(); i++)
    {
       meshes[i]->set_projection(projection);
-      meshes[i]->set_shader(shader);
-      meshes[i]->set_blank(blank);
+
+      const Material& material = meshes[i]->get_material();
+      if (!material.collide)
+         continue;
 
       const std::vector<Vertex>& vertices = *meshes[i]->get_vertex();
-      for (unsigned v = 0; v < vertices.size(); v += 3)
+      std1::shared_ptr<std::vector<uint32_t> > indices = meshes[i]->get_indices();
+
+      vector<vec3> positions(meshes[i]->get_triangle_count() * 3);
+      for (unsigned v = 0; v < positions.size(); v++)
+         positions[v] = vertices[indices ? (*indices)[v] : v].vert;
+
+      // Moving meshes keep their triangles in object space, and only move as a whole.
+      if (material.motion_period > 0.0f)
       {
-         Triangle tri;
-         tri.a = vertices[v + 0].vert / player_size;
-         tri.b = vertices[v + 1].vert / player_size;
-         tri.c = vertices[v + 2].vert / player_size;
-         tri.normal = -normalize(cross(tri.b - tri.a, tri.c - tri.a)); // Make normals point inward. Makes for simpler computation.
-         tri.n0 = dot(tri.normal, tri.a); // Plane constant
-         triangles.push_back(tri);
+         mesh_bodies[i] = world.add_body(positions, i, meshes[i]->get_model());
+         continue;
       }
+
+      for (unsigned v = 0; v < positions.size(); v += 3)
+         world.add_triangle(positions[v + 0], positions[v + 1], positions[v + 2], i);
+   }
+
+   // Collision-only geometry isn't part of any mesh.
+   for (unsigned v = 0; v + 2 < proxies.size(); v += 3)
+      world.add_triangle(proxies[v + 0], proxies[v + 1], proxies[v + 2], proxy_material);
+
+   // The hierarchy is cached next to the scene, and only rebuilt when the geometry changes.
+   string cache_path = path + ".collision";
+   vector<uint8_t> cache;
+   if (File::read(cache_path, cache) && world.unserialize(cache))
+   {
+      if (log_cb)
+         log_cb(RETRO_LOG_INFO, "Collision: Loaded hierarchy from %s.\n", cache_path.c_str());
+   }
+   else
+   {
+      retro_time_t start = time_usec();
+      {
+         PROFILE_ZONE("collision_build");
+         Threading::ThreadPool pool;
+         world.build(&pool);
+      }
+      retro_time_t end = time_usec();
+
+      if (log_cb)
+         log_cb(RETRO_LOG_INFO, "Collision: Built hierarchy (%u nodes) in %.3f ms.\n",
+               (unsigned)world.node_count(), (end - start) / 1000.0);
+
+      world.serialize(cache);
+      if (!File::write(cache_path, cache) && log_cb)
+         log_cb(RETRO_LOG_WARN, "Collision: Failed to save hierarchy to %s.\n", cache_path.c_str());
    }
+
+   collision_memory.set(world.memory_usage());
+
+   // Collision has its own copy of the positions now, and nothing else reads the vertices.
+   unsigned released = 0;
+   for (unsigned i = 0; i < meshes.size(); i++)
+      released += meshes[i]->release_vertices();
+   if (released != meshes.size() && log_cb)
+      log_cb(RETRO_LOG_WARN, "Mesh: Keeping vertices of %u meshes on the CPU, upload failed.\n",
+            (unsigned)meshes.size() - released);
+
+   if (log_cb)
+      log_cb(RETRO_LOG_INFO, "Collision: %u triangles, %u from proxies, merged into %u polygons, %u moving bodies.\n",
+            (unsigned)world.size(), (unsigned)(proxies.size() / 3), (unsigned)world.polygon_count(),
+            (unsigned)world.body_count());
+
+   retro_time_t collision_done = time_usec();
+   last_load.scene = scene_done - load_start;
+   last_load.shaders = shaders_done - scene_done;
+   last_load.collision = collision_done - shaders_done;
+
+   if (log_cb)
+      log_cb(RETRO_LOG_INFO, "Load: shaders %.3f ms, scene %.3f ms, collision %.3f ms.\n",
+            last_load.shaders / 1000.0, last_load.scene / 1000.0, last_load.collision / 1000.0);
+
+   Memory::log_report();
 }
 
 static void context_reset(void)
 {
    dead_state = true;
    meshes.clear();
-   blank.reset();
+   opaque_meshes.clear();
+   transparent_meshes.clear();
+   overlay.reset();
+   gpu_timer.reset();
    dead_state = false;
 
-   triangles.clear();
+   world.clear();
+   world.set_ellipsoid(player_size);
+   collision_memory.set(world.memory_usage());
 
    GL::set_function_cb(hw_render.get_proc_address);
    GL::init_symbol_map();
 
-   blank = Texture::blank();
    init_mesh(mesh_path);
 }
 
-static inline bool fequal(float a, float b)
+// Traces start with the game, so only looked at on load.
+static void init_trace()
 {
-   return std::fabs(a - b) < 0.0001f;
-}
+   trace_mode = TRACE_OFF;
+   trace_path = mesh_path + ".input";
+   trace.clear();
+   trace.set_physics_hz(physics_hz);
 
-static inline bool vequal(const vec3& a, const vec3& b)
-{
-   return fequal(a[0], b[0]) &&
-      fequal(a[1], b[1]) &&
-      fequal(a[2], b[2]);
-}
-
-static void test_crash_detection()
-{
-   vec3 pos = vec3(0.0f);
-   
-   float a = point_crash_time(pos, vec3(1, 0, 0), vec3(3, 0, 0));
-   assert(fequal(a, 2.0f));
-
-   float b = point_crash_time(pos, vec3(1, 0, 0), vec3(2, 2, 0));
-   assert(fequal(b, 10.0f));
-
-   float c = point_crash_time(pos, vec3(1, 0, 0), vec3(1.0, 0.5, 0.0));
-   assert(fequal(c, 1.0f - std::cos(30.0f / 180.0f * M_PI)));
-
-   float d = point_crash_time(pos, vec3(0, 1, 0), vec3(0.5, 1.0, 0.0));
-   assert(fequal(d, 1.0f - std::cos(30.0f / 180.0f * M_PI)));
+   retro_variable var;
+   var.key = "modelviewer_input_trace";
+   var.value = NULL;
+   if (!environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) || !var.value)
+      return;
 
-   vec3 out_pos;
-   float e = line_crash_time(pos, vec3(1, 0, 0), vec3(4, -1, 0), vec3(4, 1, 0), out_pos);
-   assert(fequal(e, 3.0f) && vequal(out_pos, vec3(4, 0, 0)));
+   if (!strcmp(var.value, "record"))
+      trace_mode = TRACE_RECORD;
+   else if (!strcmp(var.value, "replay"))
+   {
+      if (!trace.load(trace_path))
+      {
+         if (log_cb)
+            log_cb(RETRO_LOG_WARN, "Input: Failed to load trace from %s.\n", trace_path.c_str());
+         return;
+      }
 
-   if (log_cb)
-      log_cb(RETRO_LOG_INFO, "Collision tests passed!\n");
+      trace_mode = TRACE_REPLAY;
+      replay_frame_times.clear();
+      if (log_cb)
+      {
+         log_cb(RETRO_LOG_INFO, "Input: Replaying %u frames from %s.\n",
+               (unsigned)trace.size(), trace_path.c_str());
+         if (trace.get_physics_hz() != physics_hz)
+            log_cb(RETRO_LOG_WARN, "Input: Trace was recorded with physics at %u Hz, replay will drift.\n",
+                  trace.get_physics_hz());
+         if (!perf_cb.get_time_usec)
+            log_cb(RETRO_LOG_WARN, "Input: No timer from the frontend, frame times won't be measured.\n");
+      }
+   }
 }
 
 bool retro_load_game(const struct retro_game_info *info)
@@ -765,15 +1184,46 @@ bool retro_load_game(const struct retro_game_info *info)
    if (!environ_cb(RETRO_ENVIRONMENT_SET_HW_RENDER, &hw_render))
       return false;
 
-   test_crash_detection();
+   Collision::test_crash_detection();
+   Collision::test_controller_state();
 
    mesh_path = info->path;
    update_variables();
+
+   struct retro_frame_time_callback frame_time = { frame_time_cb, 1000000 / fps };
+   environ_cb(RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK, &frame_time);
+
+   init_trace();
+
+   set_previous_player_pos(player.get_pos());
    return true;
 }
 
 void retro_unload_game(void)
 {
+   if (trace_mode == TRACE_RECORD)
+   {
+      bool saved = trace.save(trace_path);
+      if (log_cb)
+      {
+         if (saved)
+            log_cb(RETRO_LOG_INFO, "Input: Recorded %u frames to %s.\n", (unsigned)trace.size(), trace_path.c_str());
+         else
+            log_cb(RETRO_LOG_WARN, "Input: Failed to save trace to %s.\n", trace_path.c_str());
+      }
+   }
+   else if (trace_mode == TRACE_REPLAY)
+      log_replay_summary();
+
+   if (log_cb)
+      log_cb(RETRO_LOG_INFO, "Contact cache: %llu hits, %llu misses.\n",
+            (unsigned long long)player.get_cache().hits,
+            (unsigned long long)player.get_cache().misses);
+
+   if (Profiler::capturing())
+      write_profile();
+
+   Memory::log_report();
    dead_state = true;
 }
 
@@ -789,17 +1239,48 @@ bool retro_load_game_special(unsigned, const struct retro_game_info *, size_t)
 
 size_t retro_serialize_size(void)
 {
-   return 0;
+   return sizeof(SaveState);
 }
 
-bool retro_serialize(void *, size_t)
+bool retro_serialize(void *data, size_t size)
 {
-   return false;
+   if (size < sizeof(SaveState))
+      return false;
+
+   SaveState state;
+   memset(&state, 0, sizeof(state));
+   state.magic = save_magic;
+   state.version = save_version;
+   state.physics_hz = physics_hz;
+   state.sim = sim;
+   player.save_state(state.player);
+
+   memcpy(data, &state, sizeof(state));
+   return true;
 }
 
-bool retro_unserialize(const void *, size_t)
+bool retro_unserialize(const void *data, size_t size)
 {
-   return false;
+   if (size < sizeof(SaveState))
+      return false;
+
+   SaveState state;
+   memcpy(&state, data, sizeof(state));
+   if (state.magic != save_magic || state.version != save_version || !state.physics_hz)
+      return false;
+
+   sim = state.sim;
+   if (state.physics_hz != physics_hz)
+   {
+      // Saved with another physics rate. Keep the same point in time.
+      sim.ticks = sim.ticks * physics_hz / state.physics_hz;
+      sim.accumulator = sim.accumulator * physics_hz / state.physics_hz;
+   }
+   player.load_state(state.player);
+
+   // Bodies only depend on the clock. Their previous transforms are replaced on the next tick.
+   update_bodies(double(sim.ticks) / physics_hz, true);
+   return true;
 }
 
 void *retro_get_memory_data(unsigned)
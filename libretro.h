@@ -583,6 +583,15 @@ enum retro_mod
                                            // If so, no such directory is defined,
                                            // and it's up to the implementation to find a suitable directory.
                                            //
+#define RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY 31
+                                           // const char ** --
+                                           // Returns the "save" directory of the frontend.
+                                           // This directory can be used to store SRAM, memory cards, high scores, etc, if the libretro core
+                                           // cannot use the regular memory interface (retro_get_memory_data()).
+                                           //
+                                           // The returned value can be NULL.
+                                           // If so, the frontend user has not set a specific save path.
+                                           //
 
 enum retro_log_level
 {
@@ -16,6 +16,7 @@
 #include "rpng.h"
 
 #include <zlib.h>
+#include "memory.hpp"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -321,6 +322,9 @@ bool rpng_load_image_rgba(const char *path, uint8_t **data, unsigned *width, uns
    struct idat_buffer idat_buf = {0};
    struct png_ihdr ihdr = {0};
 
+   // Compressed and inflated data. The decoded image is the caller's to count.
+   Memory::Allocation temporaries(Memory::LOADER);
+
    char header[8];
    if (fread(header, 1, sizeof(header), file) != sizeof(header))
       GOTO_END_ERROR();
@@ -388,6 +392,7 @@ bool rpng_load_image_rgba(const char *path, uint8_t **data, unsigned *width, uns
    inflate_buf = (uint8_t*)malloc(inflate_buf_size);
    if (!inflate_buf)
       GOTO_END_ERROR();
+   temporaries.set(idat_buf.size + inflate_buf_size);
 
    stream.next_in   = idat_buf.data;
    stream.avail_in  = idat_buf.size;
@@ -401,6 +406,11 @@ bool rpng_load_image_rgba(const char *path, uint8_t **data, unsigned *width, uns
    }
    inflateEnd(&stream);
 
+   // Not needed any more, so don't hold on to it while decoding.
+   free(idat_buf.data);
+   idat_buf.data = NULL;
+   temporaries.set(inflate_buf_size);
+
    *width  = ihdr.width;
    *height = ihdr.height;
    *data = (uint8_t*)malloc(ihdr.width * ihdr.height * sizeof(uint32_t));
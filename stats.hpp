@@ -0,0 +1,48 @@
+/*
+ *  Scenewalker Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATS_HPP__
+#define STATS_HPP__
+
+#include "libretro.h"
+
+namespace Stats
+{
+   // Where the time went the last time a scene was loaded, in microseconds.
+   // All zero if the frontend doesn't give us a timer.
+   struct LoadTimes
+   {
+      retro_time_t shaders;   // Compiling and linking.
+      retro_time_t scene;     // Parsing the OBJ, loading textures and uploading meshes.
+      retro_time_t collision; // Building or loading the collision hierarchy.
+   };
+
+   const LoadTimes& load_times();
+
+   // Post-transform cache use of the loaded scene's meshes, in file order and as optimized.
+   // All zero if meshes aren't optimized.
+   struct VertexCache
+   {
+      float acmr_before, acmr_after;
+      float atvr_before, atvr_after;
+   };
+
+   VertexCache vertex_cache();
+}
+
+#endif
+
@@ -21,6 +21,9 @@
 #include <string>
 #include <cstdlib>
 #include <vector>
+#include <fstream>
+#include <iterator>
+#include <stdint.h>
 
 #define DIR_BACK(string) (string[string.length()-1])
 
@@ -58,6 +61,30 @@ namespace Path
    }
 }
 
+namespace File
+{
+   inline bool read(const std::string& path, std::vector<uint8_t>& data)
+   {
+      std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+      if (!file.is_open())
+         return false;
+
+      data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+      return !file.bad();
+   }
+
+   inline bool write(const std::string& path, const std::vector<uint8_t>& data)
+   {
+      std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+      if (!file.is_open())
+         return false;
+
+      if (!data.empty())
+         file.write(reinterpret_cast<const char*>(&data[0]), data.size());
+      return file.good();
+   }
+}
+
 namespace String
 {
    inline std::vector<std::string> split(const std::string& str, const std::string& splitter, bool keep_empty = false)